@@ -0,0 +1,164 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*
+ * AES CFB128 on the AES-NI instructions, picked at run time by the crypto
+ * glue when the CPU has them. Round keys come from the AES_KEY schedule
+ * of the table driven code so both paths share one key expansion.
+ */
+
+#include <string.h>
+#include "aesni.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <cpuid.h>
+#include <wmmintrin.h>
+#include <tmmintrin.h>
+
+#define AESNI_TARGET  __attribute__((target("aes,ssse3")))
+
+int
+aesni_available(void)
+{
+  static int avail = -1;
+  unsigned int a, b, c, d;
+
+  if (avail < 0) {
+    avail = __get_cpuid(1, &a, &b, &c, &d) && (c & bit_AES) && (c & bit_SSSE3);
+  }
+  return avail;
+}
+
+/* Round keys of AES_KEY are words in host order, AES-NI takes them as
+ * bytes in the order of the standard */
+static inline AESNI_TARGET int
+aesni_key_load(const AES_KEY *key, __m128i *rk)
+{
+  const __m128i bswap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+  const unsigned int *w = (const unsigned int *)key->rd_key;
+  int i;
+
+  for (i = 0; i <= key->rounds; i++, w += 4) {
+    rk[i] = _mm_shuffle_epi8(_mm_set_epi32(w[3], w[2], w[1], w[0]), bswap);
+  }
+  return key->rounds;
+}
+
+static inline AESNI_TARGET __m128i
+aesni_block(__m128i b, const __m128i *rk, int rounds)
+{
+  int i;
+
+  b = _mm_xor_si128(b, rk[0]);
+  for (i = 1; i < rounds; i++) {
+    b = _mm_aesenc_si128(b, rk[i]);
+  }
+  return _mm_aesenclast_si128(b, rk[rounds]);
+}
+
+/* Four independent blocks interleaved to keep the AES unit busy */
+static inline AESNI_TARGET void
+aesni_block4(__m128i *b, const __m128i *rk, int rounds)
+{
+  int i;
+
+  b[0] = _mm_xor_si128(b[0], rk[0]);
+  b[1] = _mm_xor_si128(b[1], rk[0]);
+  b[2] = _mm_xor_si128(b[2], rk[0]);
+  b[3] = _mm_xor_si128(b[3], rk[0]);
+  for (i = 1; i < rounds; i++) {
+    b[0] = _mm_aesenc_si128(b[0], rk[i]);
+    b[1] = _mm_aesenc_si128(b[1], rk[i]);
+    b[2] = _mm_aesenc_si128(b[2], rk[i]);
+    b[3] = _mm_aesenc_si128(b[3], rk[i]);
+  }
+  b[0] = _mm_aesenclast_si128(b[0], rk[rounds]);
+  b[1] = _mm_aesenclast_si128(b[1], rk[rounds]);
+  b[2] = _mm_aesenclast_si128(b[2], rk[rounds]);
+  b[3] = _mm_aesenclast_si128(b[3], rk[rounds]);
+}
+
+/* Encrypt or decrypt len bytes from the start of a CFB128 stream. in and
+ * out may be the same buffer, or out may lie below in, as every block is
+ * read before its output is stored. */
+AESNI_TARGET void
+aesni_cfb128_encrypt(const unsigned char *in, unsigned char *out, size_t len, const AES_KEY *key, const unsigned char *ivec, int enc)
+{
+  __m128i rk[AES_MAXNR + 1], iv, c[4], b[4];
+  unsigned char tail[16];
+  int i, rounds;
+
+  rounds = aesni_key_load(key, rk);
+  iv = _mm_loadu_si128((const __m128i *)ivec);
+
+  if (enc) {
+    /* Each block chains on the cipher text of the one before */
+    for (; len >= 16; len -= 16, in += 16, out += 16) {
+      iv = _mm_xor_si128(aesni_block(iv, rk, rounds), _mm_loadu_si128((const __m128i *)in));
+      _mm_storeu_si128((__m128i *)out, iv);
+    }
+  } else {
+    /* The key stream only depends on cipher text at hand */
+    for (; len >= 64; len -= 64, in += 64, out += 64) {
+      for (i = 0; i < 4; i++) {
+        c[i] = _mm_loadu_si128((const __m128i *)(in + 16 * i));
+      }
+      b[0] = iv;
+      b[1] = c[0];
+      b[2] = c[1];
+      b[3] = c[2];
+      aesni_block4(b, rk, rounds);
+      for (i = 0; i < 4; i++) {
+        _mm_storeu_si128((__m128i *)(out + 16 * i), _mm_xor_si128(b[i], c[i]));
+      }
+      iv = c[3];
+    }
+    for (; len >= 16; len -= 16, in += 16, out += 16) {
+      c[0] = _mm_loadu_si128((const __m128i *)in);
+      _mm_storeu_si128((__m128i *)out, _mm_xor_si128(aesni_block(iv, rk, rounds), c[0]));
+      iv = c[0];
+    }
+  }
+
+  /* Partial last block */
+  if (len) {
+    memcpy(tail, in, len);
+    b[0] = _mm_xor_si128(aesni_block(iv, rk, rounds), _mm_loadu_si128((const __m128i *)tail));
+    _mm_storeu_si128((__m128i *)tail, b[0]);
+    memcpy(out, tail, len);
+  }
+}
+
+#else
+
+int
+aesni_available(void)
+{
+  return 0;
+}
+
+void
+aesni_cfb128_encrypt(const unsigned char *in, unsigned char *out, size_t len, const AES_KEY *key, const unsigned char *ivec, int enc)
+{
+}
+
+#endif
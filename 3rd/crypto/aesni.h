@@ -0,0 +1,31 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#ifndef _AESNI_H_
+#define _AESNI_H_
+
+#include <stddef.h>
+#include "openssl_aes.h"
+
+int aesni_available(void);
+void aesni_cfb128_encrypt(const unsigned char *in, unsigned char *out, size_t len, const AES_KEY *key, const unsigned char *ivec, int enc);
+
+#endif /* _AESNI_H_ */
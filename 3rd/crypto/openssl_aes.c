@@ -59,13 +59,13 @@
 #include "openssl_aes_local.h"
 
 #include "../../core/snmp.h"
+#include "aesni.h"
 
 /*******************************************************************
  * AES_Encrypt
  *
  * Parameters:
- *	*key		    Key bits for crypting.
- *	 keylen		  Length of key (buffer) in bytes.
+ *	*key		    Encryption key schedule (128, 192 or 256 bits).
  *	*iv		      IV bits for crypting.
  *	 ivlen		  Length of iv (buffer) in bytes.
  *	*plaintext	Plaintext to crypt.
@@ -73,35 +73,37 @@
  *	*ciphertext	Ciphertext to crypt.
  *	*ctlen		  Length of ciphertext.
  *
- * Encrypt plaintext into ciphertext using key and iv.
+ * Encrypt plaintext into ciphertext using key and iv. The key schedule is
+ * set up once by AES_set_encrypt_key() and reused for every message.
  *
  * ctlen contains actual number of crypted bytes in ciphertext upon
- * successful return.
+ * successful return. plaintext and ciphertext may be the same buffer.
  */
 void
-AES_Encrypt(const unsigned char *key, unsigned int keylen,
-            const unsigned char *iv, unsigned int ivlen,
+AES_Encrypt(const AES_KEY *key, const unsigned char *iv, unsigned int ivlen,
             const unsigned char *plaintext, unsigned int ptlen,
             unsigned char *ciphertext, unsigned int *ctlen)
 {
   unsigned char   my_iv[AES_SECRETKEYLEN * 8];
   int             new_ivlen = 0;
-  AES_KEY         aes_key;
 
   if (!key || !iv || !plaintext || !ciphertext || !ctlen ||
       ptlen <= 0 || *ctlen <= 0 || ptlen > *ctlen ||
-      keylen < AES_SECRETKEYLEN || ivlen < AES_SECRETKEYLEN) {
+      ivlen < AES_SECRETKEYLEN) {
     return;
   }
 
-  memset(my_iv, 0, sizeof(my_iv));
-  AES_set_encrypt_key(key, AES_SECRETKEYLEN * 8, &aes_key);
-  memcpy(my_iv, iv, ivlen);
-  /*
-   * encrypt the data 
-   */
-  AES_cfb128_encrypt(plaintext, ciphertext, ptlen,
-                     &aes_key, my_iv, &new_ivlen, AES_ENCRYPT);
+  if (aesni_available()) {
+    aesni_cfb128_encrypt(plaintext, ciphertext, ptlen, key, iv, AES_ENCRYPT);
+  } else {
+    memset(my_iv, 0, sizeof(my_iv));
+    memcpy(my_iv, iv, ivlen);
+    /*
+     * encrypt the data 
+     */
+    AES_cfb128_encrypt(plaintext, ciphertext, ptlen,
+                       key, my_iv, &new_ivlen, AES_ENCRYPT);
+  }
   *ctlen = ptlen;
 }
 
@@ -109,8 +111,7 @@ AES_Encrypt(const unsigned char *key, unsigned int keylen,
  * AES_Decrypt
  *
  * Parameters:
- *	*key		    Key bits for crypting.
- *	 keylen		  Length of key (buffer) in bytes.
+ *	*key		    Encryption key schedule (128, 192 or 256 bits).
  *	*iv		      IV bits for crypting.
  *	 ivlen		  Length of iv (buffer) in bytes.
  *	*ciphertext	Ciphertext to crypt.
@@ -118,34 +119,34 @@ AES_Encrypt(const unsigned char *key, unsigned int keylen,
  *	*plaintext	Plaintext to crypt.
  *	 ptlen		  Length of plaintext.
  *
- * Decrypt ciphertext into plaintext using key and iv.
+ * Decrypt ciphertext into plaintext using key and iv. CFB mode decrypts
+ * with the encryption key schedule.
  *
  * ptlen contains actual number of plaintext bytes in plaintext upon
- * successful return.
+ * successful return. ciphertext and plaintext may be the same buffer.
  */
 void
-AES_Decrypt(const unsigned char *key, unsigned int keylen,
-            const unsigned char *iv, unsigned int ivlen,
+AES_Decrypt(const AES_KEY *key, const unsigned char *iv, unsigned int ivlen,
             const unsigned char *ciphertext, unsigned int ctlen,
             unsigned char *plaintext, unsigned int *ptlen)
 {
   unsigned char   my_iv[AES_SECRETKEYLEN * 8];
   int new_ivlen = 0;
-  AES_KEY aes_key;
 
   if (!key || !iv || !plaintext || !ciphertext || !ptlen ||
       ctlen <= 0 || *ptlen <= 0 || ctlen > *ptlen ||
-      keylen < AES_SECRETKEYLEN || ivlen < AES_SECRETKEYLEN) {
+      ivlen < AES_SECRETKEYLEN) {
     return;
   }
 
-  memset(my_iv, 0, sizeof(my_iv));
-  memcpy(my_iv, iv, ivlen);
-
-  /* set key */
-  AES_set_encrypt_key(key, AES_SECRETKEYLEN * 8, &aes_key);
-  /* encrypt the data */
-  AES_cfb128_encrypt(ciphertext, plaintext, ctlen,
-                     &aes_key, my_iv, &new_ivlen, AES_DECRYPT);
+  if (aesni_available()) {
+    aesni_cfb128_encrypt(ciphertext, plaintext, ctlen, key, iv, AES_DECRYPT);
+  } else {
+    memset(my_iv, 0, sizeof(my_iv));
+    memcpy(my_iv, iv, ivlen);
+    /* encrypt the data */
+    AES_cfb128_encrypt(ciphertext, plaintext, ctlen,
+                       key, my_iv, &new_ivlen, AES_DECRYPT);
+  }
   *ptlen = ctlen;
 }
@@ -332,3 +332,69 @@ update_end:
 
   return rc;
 }
+
+/*
+ * MD5_hmac_ctx_init(ctx, secret, secretlen): hash the inner and the outer
+ * padded key into ctx[0] and ctx[1] once, MD5_hmac_ctx() then carries on
+ * from copies of them for each message.
+ */
+int
+MD5_hmac_ctx_init(MD5_CTX *ctx,                 /* OUT - inner and outer states */
+                  const unsigned char *secret,  /* IN  - pointer to usrAuthKey */
+                  size_t secretlen)             /* IN  - length of usrAuthKey */
+{
+  unsigned char          K[MD5_HASHKEYLEN];
+  size_t                 i;
+
+  if (secretlen != MD5_SECRETKEYLEN || secret == NULL || ctx == NULL) {
+      return -1;
+  }
+
+  memset(K, 0, MD5_HASHKEYLEN);
+  memcpy(K, secret, secretlen);
+  for (i = 0; i < MD5_HASHKEYLEN; i++) {
+      K[i] ^= 0x36;
+  }
+  MD5_Init(&ctx[0]);
+  MD5_Update(&ctx[0], K, MD5_HASHKEYLEN);
+
+  for (i = 0; i < MD5_HASHKEYLEN; i++) {
+      K[i] ^= 0x36 ^ 0x5c;
+  }
+  MD5_Init(&ctx[1]);
+  MD5_Update(&ctx[1], K, MD5_HASHKEYLEN);
+
+  memset(K, 0, MD5_HASHKEYLEN);
+  return 0;
+}
+
+/*
+ * MD5_hmac_ctx(ctx, data, len, mac, maclen): same as MD5_hmac() with the
+ * key already hashed by MD5_hmac_ctx_init()
+ */
+int
+MD5_hmac_ctx(const MD5_CTX *ctx,            /* IN  - inner and outer states */
+             const unsigned char *data,     /* IN  - pointer to message */
+             size_t len,                    /* IN  - length of messege */
+             unsigned char *mac,            /* OUT - pointer to caller buffer */
+             size_t maclen)                 /* IN  - length of mac */
+{
+  MD5_CTX                MD;
+  unsigned char          buf[MD5_DIGEST_LENGTH];
+
+  if (ctx == NULL || mac == NULL || data == NULL ||
+      len <= 0 || maclen <= 0 || maclen > MD5_DIGEST_LENGTH) {
+      return -1;
+  }
+
+  MD = ctx[0];
+  MD5_Update(&MD, data, len);
+  MD5_Final(buf, &MD);
+
+  MD = ctx[1];
+  MD5_Update(&MD, buf, MD5_DIGEST_LENGTH);
+  MD5_Final(buf, &MD);
+  memcpy(mac, buf, maclen);
+
+  return 0;
+}
@@ -200,3 +200,256 @@ update_end:
 
   return rc;
 }
+
+/*
+ * SHA1_hmac_ctx_init(ctx, secret, secretlen): hash the inner and the outer
+ * padded key into ctx[0] and ctx[1] once, SHA1_hmac_ctx() then carries on
+ * from copies of them for each message.
+ */
+int
+SHA1_hmac_ctx_init(SHA_CTX *ctx,                 /* OUT - inner and outer states */
+                   const unsigned char *secret,  /* IN  - pointer to usrAuthKey */
+                   size_t secretlen)             /* IN  - length of usrAuthKey */
+{
+  unsigned char   K[SHA1_HASHKEYLEN];
+  size_t          i;
+
+  if (secretlen != SHA1_SECRETKEYLEN || secret == NULL || ctx == NULL) {
+      return -1;
+  }
+
+  memset(K, 0, SHA1_HASHKEYLEN);
+  memcpy(K, secret, secretlen);
+  for (i = 0; i < SHA1_HASHKEYLEN; i++) {
+      K[i] ^= 0x36;
+  }
+  SHA1_Init(&ctx[0]);
+  SHA1_Update(&ctx[0], K, SHA1_HASHKEYLEN);
+
+  for (i = 0; i < SHA1_HASHKEYLEN; i++) {
+      K[i] ^= 0x36 ^ 0x5c;
+  }
+  SHA1_Init(&ctx[1]);
+  SHA1_Update(&ctx[1], K, SHA1_HASHKEYLEN);
+
+  memset(K, 0, SHA1_HASHKEYLEN);
+  return 0;
+}
+
+/*
+ * SHA1_hmac_ctx(ctx, data, len, mac, maclen): same as SHA1_hmac() with the
+ * key already hashed by SHA1_hmac_ctx_init()
+ */
+int
+SHA1_hmac_ctx(const SHA_CTX *ctx,            /* IN  - inner and outer states */
+              const unsigned char *data,     /* IN  - pointer to message */
+              size_t len,                    /* IN  - length of messege */
+              unsigned char *mac,            /* OUT - pointer to caller buffer */
+              size_t maclen)                 /* IN  - length of mac */
+{
+  SHA_CTX         SH;
+  unsigned char   buf[SHA_DIGEST_LENGTH];
+
+  if (ctx == NULL || mac == NULL || data == NULL ||
+      len <= 0 || maclen <= 0 || maclen > SHA_DIGEST_LENGTH) {
+      return -1;
+  }
+
+  SH = ctx[0];
+  SHA1_Update(&SH, data, len);
+  SHA1_Final(buf, &SH);
+
+  SH = ctx[1];
+  SHA1_Update(&SH, buf, SHA_DIGEST_LENGTH);
+  SHA1_Final(buf, &SH);
+  memcpy(mac, buf, maclen);
+
+  return 0;
+}
+
+/*
+ * SHA256_key() and SHA512_key(): password to key algorithm of RFC 3414
+ * with the hashes of RFC 7860, the key is as long as the digest
+ */
+void
+SHA256_key(const unsigned char *password,  /* IN */
+           unsigned int passwordlen,       /* IN */
+           const unsigned char *engineID,  /* IN  - pointer to snmpEngineID  */
+           unsigned int engineLength,      /* IN  - length of snmpEngineID */
+           unsigned char *key)             /* OUT - pointer to caller 32-octet buffer */
+{
+  SHA256_CTX      SH;
+  unsigned char   password_buf[2 * SHA256_SECRETKEYLEN + 32];
+  unsigned long   password_index = 0;
+  unsigned long   count = 0, i;
+
+  SHA256_Init(&SH);
+  while (count < 1048576) {
+      for (i = 0; i < SHA256_HASHKEYLEN; i++) {
+          password_buf[i] = password[password_index++ % passwordlen];
+      }
+      SHA256_Update(&SH, password_buf, SHA256_HASHKEYLEN);
+      count += SHA256_HASHKEYLEN;
+  }
+  SHA256_Final(key, &SH);
+
+  /* Localize with the engineID, which is at most 32 octets */
+  memcpy(password_buf, key, SHA256_SECRETKEYLEN);
+  memcpy(password_buf + SHA256_SECRETKEYLEN, engineID, engineLength);
+  memcpy(password_buf + SHA256_SECRETKEYLEN + engineLength, key, SHA256_SECRETKEYLEN);
+
+  SHA256_Init(&SH);
+  SHA256_Update(&SH, password_buf, 2 * SHA256_SECRETKEYLEN + engineLength);
+  SHA256_Final(key, &SH);
+}
+
+void
+SHA512_key(const unsigned char *password,  /* IN */
+           unsigned int passwordlen,       /* IN */
+           const unsigned char *engineID,  /* IN  - pointer to snmpEngineID  */
+           unsigned int engineLength,      /* IN  - length of snmpEngineID */
+           unsigned char *key)             /* OUT - pointer to caller 64-octet buffer */
+{
+  SHA512_CTX      SH;
+  unsigned char   password_buf[2 * SHA512_SECRETKEYLEN + 32];
+  unsigned long   password_index = 0;
+  unsigned long   count = 0, i;
+
+  SHA512_Init(&SH);
+  while (count < 1048576) {
+      for (i = 0; i < SHA512_HASHKEYLEN; i++) {
+          password_buf[i] = password[password_index++ % passwordlen];
+      }
+      SHA512_Update(&SH, password_buf, SHA512_HASHKEYLEN);
+      count += SHA512_HASHKEYLEN;
+  }
+  SHA512_Final(key, &SH);
+
+  /* Localize with the engineID, which is at most 32 octets */
+  memcpy(password_buf, key, SHA512_SECRETKEYLEN);
+  memcpy(password_buf + SHA512_SECRETKEYLEN, engineID, engineLength);
+  memcpy(password_buf + SHA512_SECRETKEYLEN + engineLength, key, SHA512_SECRETKEYLEN);
+
+  SHA512_Init(&SH);
+  SHA512_Update(&SH, password_buf, 2 * SHA512_SECRETKEYLEN + engineLength);
+  SHA512_Final(key, &SH);
+}
+
+/*
+ * SHA256_hmac_ctx_init(), SHA256_hmac_ctx(), SHA512_hmac_ctx_init() and
+ * SHA512_hmac_ctx(): the same as SHA1_hmac_ctx_init() and SHA1_hmac_ctx()
+ * for HMAC-SHA-2, SHA-512 hashes the key in 128-octet blocks
+ */
+int
+SHA256_hmac_ctx_init(SHA256_CTX *ctx,               /* OUT - inner and outer states */
+                     const unsigned char *secret,   /* IN  - pointer to usrAuthKey */
+                     size_t secretlen)              /* IN  - length of usrAuthKey */
+{
+  unsigned char   K[SHA256_HASHKEYLEN];
+  size_t          i;
+
+  if (secretlen != SHA256_SECRETKEYLEN || secret == NULL || ctx == NULL) {
+      return -1;
+  }
+
+  memset(K, 0, SHA256_HASHKEYLEN);
+  memcpy(K, secret, secretlen);
+  for (i = 0; i < SHA256_HASHKEYLEN; i++) {
+      K[i] ^= 0x36;
+  }
+  SHA256_Init(&ctx[0]);
+  SHA256_Update(&ctx[0], K, SHA256_HASHKEYLEN);
+
+  for (i = 0; i < SHA256_HASHKEYLEN; i++) {
+      K[i] ^= 0x36 ^ 0x5c;
+  }
+  SHA256_Init(&ctx[1]);
+  SHA256_Update(&ctx[1], K, SHA256_HASHKEYLEN);
+
+  memset(K, 0, SHA256_HASHKEYLEN);
+  return 0;
+}
+
+int
+SHA256_hmac_ctx(const SHA256_CTX *ctx,         /* IN  - inner and outer states */
+                const unsigned char *data,     /* IN  - pointer to message */
+                size_t len,                    /* IN  - length of messege */
+                unsigned char *mac,            /* OUT - pointer to caller buffer */
+                size_t maclen)                 /* IN  - length of mac */
+{
+  SHA256_CTX      SH;
+  unsigned char   buf[SHA256_DIGEST_LENGTH];
+
+  if (ctx == NULL || mac == NULL || data == NULL ||
+      len <= 0 || maclen <= 0 || maclen > SHA256_DIGEST_LENGTH) {
+      return -1;
+  }
+
+  SH = ctx[0];
+  SHA256_Update(&SH, data, len);
+  SHA256_Final(buf, &SH);
+
+  SH = ctx[1];
+  SHA256_Update(&SH, buf, SHA256_DIGEST_LENGTH);
+  SHA256_Final(buf, &SH);
+  memcpy(mac, buf, maclen);
+
+  return 0;
+}
+
+int
+SHA512_hmac_ctx_init(SHA512_CTX *ctx,               /* OUT - inner and outer states */
+                     const unsigned char *secret,   /* IN  - pointer to usrAuthKey */
+                     size_t secretlen)              /* IN  - length of usrAuthKey */
+{
+  unsigned char   K[SHA512_HASHKEYLEN];
+  size_t          i;
+
+  if (secretlen != SHA512_SECRETKEYLEN || secret == NULL || ctx == NULL) {
+      return -1;
+  }
+
+  memset(K, 0, SHA512_HASHKEYLEN);
+  memcpy(K, secret, secretlen);
+  for (i = 0; i < SHA512_HASHKEYLEN; i++) {
+      K[i] ^= 0x36;
+  }
+  SHA512_Init(&ctx[0]);
+  SHA512_Update(&ctx[0], K, SHA512_HASHKEYLEN);
+
+  for (i = 0; i < SHA512_HASHKEYLEN; i++) {
+      K[i] ^= 0x36 ^ 0x5c;
+  }
+  SHA512_Init(&ctx[1]);
+  SHA512_Update(&ctx[1], K, SHA512_HASHKEYLEN);
+
+  memset(K, 0, SHA512_HASHKEYLEN);
+  return 0;
+}
+
+int
+SHA512_hmac_ctx(const SHA512_CTX *ctx,         /* IN  - inner and outer states */
+                const unsigned char *data,     /* IN  - pointer to message */
+                size_t len,                    /* IN  - length of messege */
+                unsigned char *mac,            /* OUT - pointer to caller buffer */
+                size_t maclen)                 /* IN  - length of mac */
+{
+  SHA512_CTX      SH;
+  unsigned char   buf[SHA512_DIGEST_LENGTH];
+
+  if (ctx == NULL || mac == NULL || data == NULL ||
+      len <= 0 || maclen <= 0 || maclen > SHA512_DIGEST_LENGTH) {
+      return -1;
+  }
+
+  SH = ctx[0];
+  SHA512_Update(&SH, data, len);
+  SHA512_Final(buf, &SH);
+
+  SH = ctx[1];
+  SHA512_Update(&SH, buf, SHA512_DIGEST_LENGTH);
+  SHA512_Final(buf, &SH);
+  memcpy(mac, buf, maclen);
+
+  return 0;
+}
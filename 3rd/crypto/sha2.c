@@ -0,0 +1,408 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*
+ * SHA-256 and SHA-512 behind the interface of openssl_sha.h, for the
+ * HMAC-SHA-2 authentication protocols of RFC 7860. SHA-256 blocks run on
+ * the SHA extensions when the CPU has them.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "openssl_sha.h"
+
+static const uint32_t sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint64_t sha512_k[80] = {
+  0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+  0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+  0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+  0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+  0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+  0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+  0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+  0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+  0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+  0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+  0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+  0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+  0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+  0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+  0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+  0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+  0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+  0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+  0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+  0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+
+#define ROR32(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROR64(x, n)  (((x) >> (n)) | ((x) << (64 - (n))))
+
+static uint32_t
+sha2_get32(const unsigned char *p)
+{
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint64_t
+sha2_get64(const unsigned char *p)
+{
+  return (uint64_t)sha2_get32(p) << 32 | sha2_get32(p + 4);
+}
+
+static void
+sha2_put32(unsigned char *p, uint32_t v)
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static void
+sha2_put64(unsigned char *p, uint64_t v)
+{
+  sha2_put32(p, v >> 32);
+  sha2_put32(p + 4, v);
+}
+
+static void
+sha256_blocks_c(SHA_LONG *s, const unsigned char *p, size_t n)
+{
+  uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+  int i;
+
+  for (; n > 0; n--, p += SHA256_CBLOCK) {
+    for (i = 0; i < 16; i++) {
+      w[i] = sha2_get32(p + 4 * i);
+    }
+    for (; i < 64; i++) {
+      t1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      t2 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      w[i] = t1 + w[i - 7] + t2 + w[i - 16];
+    }
+
+    a = s[0]; b = s[1]; c = s[2]; d = s[3];
+    e = s[4]; f = s[5]; g = s[6]; h = s[7];
+    for (i = 0; i < 64; i++) {
+      t1 = h + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+      t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      h = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+    s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+    s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+  }
+}
+
+static void
+sha512_blocks(SHA_LONG64 *s, const unsigned char *p, size_t n)
+{
+  uint64_t w[80], a, b, c, d, e, f, g, h, t1, t2;
+  int i;
+
+  for (; n > 0; n--, p += SHA512_CBLOCK) {
+    for (i = 0; i < 16; i++) {
+      w[i] = sha2_get64(p + 8 * i);
+    }
+    for (; i < 80; i++) {
+      t1 = ROR64(w[i - 2], 19) ^ ROR64(w[i - 2], 61) ^ (w[i - 2] >> 6);
+      t2 = ROR64(w[i - 15], 1) ^ ROR64(w[i - 15], 8) ^ (w[i - 15] >> 7);
+      w[i] = t1 + w[i - 7] + t2 + w[i - 16];
+    }
+
+    a = s[0]; b = s[1]; c = s[2]; d = s[3];
+    e = s[4]; f = s[5]; g = s[6]; h = s[7];
+    for (i = 0; i < 80; i++) {
+      t1 = h + (ROR64(e, 14) ^ ROR64(e, 18) ^ ROR64(e, 41)) + ((e & f) ^ (~e & g)) + sha512_k[i] + w[i];
+      t2 = (ROR64(a, 28) ^ ROR64(a, 34) ^ ROR64(a, 39)) + ((a & b) ^ (a & c) ^ (b & c));
+      h = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+    s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+    s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+  }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define SHA_NI_TARGET  __attribute__((target("sha,sse4.1,ssse3")))
+
+#ifndef bit_SHA
+#define bit_SHA  (1 << 29)
+#endif
+
+static int
+sha_ni_available(void)
+{
+  static int avail = -1;
+  unsigned int a, b, c, d;
+
+  if (avail < 0) {
+    avail = 0;
+    if (__get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSE4_1) && (c & bit_SSSE3) && __get_cpuid_max(0, NULL) >= 7) {
+      __cpuid_count(7, 0, a, b, c, d);
+      avail = (b & bit_SHA) != 0;
+    }
+  }
+  return avail;
+}
+
+/* Four rounds on the message words of m0, m1 gets its schedule finished
+ * and m3 started for the rounds to come */
+#define SHA256_NI_QUAD(i, m0, m1, m3) do { \
+    msg = _mm_add_epi32(m0, _mm_loadu_si128((const __m128i *)&sha256_k[4 * (i)])); \
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg); \
+    if ((i) >= 3 && (i) <= 14) { \
+      m1 = _mm_sha256msg2_epu32(_mm_add_epi32(m1, _mm_alignr_epi8(m0, m3, 4)), m0); \
+    } \
+    state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e)); \
+    if ((i) >= 1 && (i) <= 12) { \
+      m3 = _mm_sha256msg1_epu32(m3, m0); \
+    } \
+  } while (0)
+
+static SHA_NI_TARGET void
+sha256_blocks_ni(SHA_LONG *h, const unsigned char *p, size_t n)
+{
+  const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i state0, state1, abef, cdgh, msg, tmp, m0, m1, m2, m3;
+
+  /* The rounds work on ABEF and CDGH */
+  tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[0]), 0xb1);
+  state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[4]), 0x1b);
+  state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+  for (; n > 0; n--, p += SHA256_CBLOCK) {
+    abef = state0;
+    cdgh = state1;
+
+    m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 0)), bswap);
+    m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 16)), bswap);
+    m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 32)), bswap);
+    m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 48)), bswap);
+
+    SHA256_NI_QUAD(0, m0, m1, m3);
+    SHA256_NI_QUAD(1, m1, m2, m0);
+    SHA256_NI_QUAD(2, m2, m3, m1);
+    SHA256_NI_QUAD(3, m3, m0, m2);
+    SHA256_NI_QUAD(4, m0, m1, m3);
+    SHA256_NI_QUAD(5, m1, m2, m0);
+    SHA256_NI_QUAD(6, m2, m3, m1);
+    SHA256_NI_QUAD(7, m3, m0, m2);
+    SHA256_NI_QUAD(8, m0, m1, m3);
+    SHA256_NI_QUAD(9, m1, m2, m0);
+    SHA256_NI_QUAD(10, m2, m3, m1);
+    SHA256_NI_QUAD(11, m3, m0, m2);
+    SHA256_NI_QUAD(12, m0, m1, m3);
+    SHA256_NI_QUAD(13, m1, m2, m0);
+    SHA256_NI_QUAD(14, m2, m3, m1);
+    SHA256_NI_QUAD(15, m3, m0, m2);
+
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+  }
+
+  /* Back to ABCD and EFGH */
+  tmp = _mm_shuffle_epi32(state0, 0x1b);
+  state1 = _mm_shuffle_epi32(state1, 0xb1);
+  _mm_storeu_si128((__m128i *)&h[0], _mm_blend_epi16(tmp, state1, 0xf0));
+  _mm_storeu_si128((__m128i *)&h[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+static void
+sha256_blocks(SHA_LONG *h, const unsigned char *p, size_t n)
+{
+  if (sha_ni_available()) {
+    sha256_blocks_ni(h, p, n);
+  } else {
+    sha256_blocks_c(h, p, n);
+  }
+}
+
+#else
+
+#define sha256_blocks  sha256_blocks_c
+
+#endif
+
+int
+SHA256_Init(SHA256_CTX *c)
+{
+  static const uint32_t iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+  };
+
+  memset(c, 0, sizeof(*c));
+  memcpy(c->h, iv, sizeof(iv));
+  c->md_len = SHA256_DIGEST_LENGTH;
+  return 1;
+}
+
+/* Nl and Nh count the bytes hashed so far, data buffers a partial block */
+int
+SHA256_Update(SHA256_CTX *c, const void *data, size_t len)
+{
+  const unsigned char *p = data;
+  unsigned char *buf = (unsigned char *)c->data;
+  uint64_t total;
+  size_t n;
+
+  total = ((uint64_t)c->Nh << 32 | c->Nl) + len;
+  c->Nl = (SHA_LONG)total;
+  c->Nh = (SHA_LONG)(total >> 32);
+
+  if (c->num) {
+    n = SHA256_CBLOCK - c->num < len ? SHA256_CBLOCK - c->num : len;
+    memcpy(buf + c->num, p, n);
+    c->num += n;
+    p += n;
+    len -= n;
+    if (c->num < SHA256_CBLOCK) {
+      return 1;
+    }
+    sha256_blocks(c->h, buf, 1);
+    c->num = 0;
+  }
+
+  if (len >= SHA256_CBLOCK) {
+    n = len / SHA256_CBLOCK;
+    sha256_blocks(c->h, p, n);
+    p += n * SHA256_CBLOCK;
+    len -= n * SHA256_CBLOCK;
+  }
+
+  memcpy(buf, p, len);
+  c->num = len;
+  return 1;
+}
+
+int
+SHA256_Final(unsigned char *md, SHA256_CTX *c)
+{
+  unsigned char *buf = (unsigned char *)c->data;
+  uint64_t bits = ((uint64_t)c->Nh << 32 | c->Nl) << 3;
+  int i;
+
+  buf[c->num++] = 0x80;
+  if (c->num > SHA256_CBLOCK - 8) {
+    memset(buf + c->num, 0, SHA256_CBLOCK - c->num);
+    sha256_blocks(c->h, buf, 1);
+    c->num = 0;
+  }
+  memset(buf + c->num, 0, SHA256_CBLOCK - 8 - c->num);
+  sha2_put64(buf + SHA256_CBLOCK - 8, bits);
+  sha256_blocks(c->h, buf, 1);
+
+  for (i = 0; i < SHA256_DIGEST_LENGTH / 4; i++) {
+    sha2_put32(md + 4 * i, c->h[i]);
+  }
+  memset(c, 0, sizeof(*c));
+  return 1;
+}
+
+int
+SHA512_Init(SHA512_CTX *c)
+{
+  static const uint64_t iv[8] = {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+  };
+
+  memset(c, 0, sizeof(*c));
+  memcpy(c->h, iv, sizeof(iv));
+  c->md_len = SHA512_DIGEST_LENGTH;
+  return 1;
+}
+
+/* Nl and Nh count the bytes hashed so far, u.p buffers a partial block */
+int
+SHA512_Update(SHA512_CTX *c, const void *data, size_t len)
+{
+  const unsigned char *p = data;
+  size_t n;
+
+  c->Nl += len;
+  if (c->Nl < len) {
+    c->Nh++;
+  }
+
+  if (c->num) {
+    n = SHA512_CBLOCK - c->num < len ? SHA512_CBLOCK - c->num : len;
+    memcpy(c->u.p + c->num, p, n);
+    c->num += n;
+    p += n;
+    len -= n;
+    if (c->num < SHA512_CBLOCK) {
+      return 1;
+    }
+    sha512_blocks(c->h, c->u.p, 1);
+    c->num = 0;
+  }
+
+  if (len >= SHA512_CBLOCK) {
+    n = len / SHA512_CBLOCK;
+    sha512_blocks(c->h, p, n);
+    p += n * SHA512_CBLOCK;
+    len -= n * SHA512_CBLOCK;
+  }
+
+  memcpy(c->u.p, p, len);
+  c->num = len;
+  return 1;
+}
+
+int
+SHA512_Final(unsigned char *md, SHA512_CTX *c)
+{
+  int i;
+
+  c->u.p[c->num++] = 0x80;
+  if (c->num > SHA512_CBLOCK - 16) {
+    memset(c->u.p + c->num, 0, SHA512_CBLOCK - c->num);
+    sha512_blocks(c->h, c->u.p, 1);
+    c->num = 0;
+  }
+  memset(c->u.p + c->num, 0, SHA512_CBLOCK - 16 - c->num);
+  sha2_put64(c->u.p + SHA512_CBLOCK - 16, c->Nh << 3 | c->Nl >> 61);
+  sha2_put64(c->u.p + SHA512_CBLOCK - 8, c->Nl << 3);
+  sha512_blocks(c->h, c->u.p, 1);
+
+  for (i = 0; i < SHA512_DIGEST_LENGTH / 8; i++) {
+    sha2_put64(md + 8 * i, c->h[i]);
+  }
+  memset(c, 0, sizeof(*c));
+  return 1;
+}
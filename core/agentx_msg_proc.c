@@ -60,7 +60,7 @@ agentx_get(struct agentx_datagram *xdg)
 
     val_len = agentx_value_enc_try(length(&ret_oid.var), tag(&ret_oid.var));
     vb_out = xmalloc(sizeof(*vb_out) + val_len);
-    vb_out->oid = ret_oid.oid;
+    vb_out->oid = oid_dup(ret_oid.oid, ret_oid.id_len);
     vb_out->oid_len = ret_oid.id_len;
     vb_out->val_type = tag(&ret_oid.var);
     vb_out->val_len = agentx_value_enc(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var), vb_out->value);
@@ -93,10 +93,6 @@ mib_getnext(struct agentx_datagram *xdg, struct x_search_range *sr_in, struct oi
   /* Search at the included start oid */
   if (sr_in->start_include) {
     mib_tree_search(&view, sr_in->start, sr_in->start_len, ret_oid);
-    if (ret_oid->err_stat || !ASN1_TAG_VALID(tag(&ret_oid->var))) {
-      /* Invalid query */
-      free(ret_oid->oid);
-    }
   }
 
   /* If start oid not included or not exist, search the next one */
@@ -138,7 +134,7 @@ agentx_getnext(struct agentx_datagram *xdg)
 
     val_len = agentx_value_enc_try(length(&ret_oid.var), tag(&ret_oid.var));
     vb_out = xmalloc(sizeof(*vb_out) + val_len);
-    vb_out->oid = ret_oid.oid;
+    vb_out->oid = oid_dup(ret_oid.oid, ret_oid.id_len);
     vb_out->oid_len = ret_oid.id_len;
     vb_out->val_type = tag(&ret_oid.var);
     vb_out->val_len = agentx_value_enc(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var), vb_out->value);
@@ -197,7 +193,7 @@ agentx_set(struct agentx_datagram *xdg)
     
     val_len = agentx_value_enc_try(length(&ret_oid.var), tag(&ret_oid.var));
     vb_out = xmalloc(sizeof(*vb_out) + val_len);
-    vb_out->oid = ret_oid.oid;
+    vb_out->oid = oid_dup(ret_oid.oid, ret_oid.id_len);
     vb_out->oid_len = ret_oid.id_len;
     vb_out->val_type = vb_in->val_type;
     vb_out->val_len = agentx_value_enc(value(&ret_oid.var), val_len, tag(&ret_oid.var), vb_out->value);
@@ -103,22 +103,12 @@ transport_send(uint8_t *buf, int len)
 static void
 transport_running(void)
 {
-  snmp_event_init();
-  snmp_event_add(agentx_entry.sock, SNMP_EV_READ, agentx_read_handler, NULL);
-  snmp_event_add(agentx_entry.sigfd, SNMP_EV_READ, agentx_signal_handler, NULL);
   snmp_event_run();
 }
 
 static int
 transport_step(long timeout)
 {
-  static int inited = 0;
-  if (inited == 0) {
-    snmp_event_init();
-    snmp_event_add(agentx_entry.sock, SNMP_EV_READ, agentx_read_handler, NULL);
-    snmp_event_add(agentx_entry.sigfd, SNMP_EV_READ, agentx_signal_handler, NULL);
-    inited = 1;
-  }
   return snmp_event_step(timeout);
 }
 
@@ -171,6 +161,13 @@ transport_init(int port)
     return -1;
   }
 
+  if (snmp_event_init() < 0) {
+    close(agentx_entry.sock);
+    return -1;
+  }
+  snmp_event_add(agentx_entry.sock, SNMP_EV_READ, agentx_read_handler, NULL);
+  snmp_event_add(agentx_entry.sigfd, SNMP_EV_READ, agentx_signal_handler, NULL);
+
   return 0;
 }
 
@@ -181,4 +178,6 @@ struct transport_operation agentx_transp_ops = {
   transport_close,
   transport_send,
   transport_step,
+  NULL,
+  NULL,
 };
@@ -0,0 +1,101 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "utils.h"
+
+static struct arena_block *
+arena_block_new(size_t size)
+{
+  struct arena_block *b = xmalloc(sizeof(*b) + size);
+  b->next = NULL;
+  b->size = size;
+  b->used = 0;
+  return b;
+}
+
+void *
+arena_alloc(struct arena *a, size_t size)
+{
+  struct arena_block *b, *prev;
+  size_t block_size;
+  void *ret;
+
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  /* Walk the retained blocks from the current one */
+  prev = NULL;
+  for (b = a->curr; b != NULL; prev = b, b = b->next) {
+    if (b->size - b->used >= size) {
+      a->curr = b;
+      ret = b->data + b->used;
+      b->used += size;
+      return ret;
+    }
+  }
+
+  /* No room left, link a new block after the last one */
+  block_size = a->block_size ? a->block_size : ARENA_BLOCK_SIZ;
+  if (size > block_size) {
+    block_size = size;
+  }
+  b = arena_block_new(block_size);
+  if (prev != NULL) {
+    prev->next = b;
+  } else {
+    a->head = b;
+  }
+  a->blocks++;
+
+  a->curr = b;
+  b->used = size;
+  return b->data;
+}
+
+/* Release everything at once, keep the blocks for reuse */
+void
+arena_reset(struct arena *a)
+{
+  struct arena_block *b;
+
+  for (b = a->head; b != NULL; b = b->next) {
+    b->used = 0;
+  }
+  a->curr = a->head;
+}
+
+void
+arena_free(struct arena *a)
+{
+  struct arena_block *b, *n;
+
+  for (b = a->head; b != NULL; b = n) {
+    n = b->next;
+    free(b);
+  }
+  a->head = NULL;
+  a->curr = NULL;
+  a->blocks = 0;
+}
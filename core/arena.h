@@ -0,0 +1,53 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_BLOCK_SIZ  (16 * 1024)
+#define ARENA_ALIGN  (8)
+
+struct arena_block {
+  struct arena_block *next;
+  size_t size;
+  size_t used;
+  uint8_t data[];
+};
+
+/* Bump allocator, all allocations are released at once by arena_reset().
+ * Blocks are kept across resets so a warmed up arena never calls malloc. */
+struct arena {
+  struct arena_block *head;
+  struct arena_block *curr;
+  /* Size of a new block, 0 means ARENA_BLOCK_SIZ */
+  size_t block_size;
+  /* Blocks ever allocated */
+  uint32_t blocks;
+};
+
+void *arena_alloc(struct arena *a, size_t size);
+void arena_reset(struct arena *a);
+void arena_free(struct arena *a);
+
+#endif /* _ARENA_H_ */
@@ -24,7 +24,7 @@
 
 struct epoll_env {
   int epfd;
-  struct epoll_event event[SNMP_MAX_EVENTS];
+  struct epoll_event event[SNMP_EV_BATCH];
 };
 
 static struct epoll_env env;
@@ -43,41 +43,51 @@ __ev_done(void)
 }
 
 static void
-__ev_add(struct snmp_event *event, unsigned char flag)
+__ev_add(int fd, struct snmp_event *event, unsigned char flag)
 {
   struct epoll_event ee;
   int op = event->flag == SNMP_EV_NONE ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
 
   ee.events = 0;
   ee.data.u64 = 0;  /* avoid valgrind warning */
-  ee.data.fd = event->fd;
+  ee.data.fd = fd;
+  /* Keep the interests already registered on this fd */
+  flag |= event->flag;
   if (flag & SNMP_EV_READ) {
     ee.events |= EPOLLIN;
   }
   if (flag & SNMP_EV_WRITE) {
     ee.events |= EPOLLOUT;
   }
-  epoll_ctl(env.epfd, op, event->fd, &ee);
+  if (flag & SNMP_EV_EDGE) {
+    ee.events |= EPOLLET;
+  }
+  epoll_ctl(env.epfd, op, fd, &ee);
 }
  
 static void
-__ev_remove(struct snmp_event *event, unsigned char flag)
+__ev_remove(int fd, struct snmp_event *event, unsigned char flag)
 {
   struct epoll_event ee;
 
-  ee.events = EPOLLIN | EPOLLOUT;
+  ee.events = 0;
   ee.data.u64 = 0;  /* avoid valgrind warning */
-  ee.data.fd = event->fd;
+  ee.data.fd = fd;
+  /* Only the interests registered and not removed are left */
+  flag = event->flag & ~flag;
   if (flag & SNMP_EV_READ) {
-    ee.events &= ~EPOLLIN;
+    ee.events |= EPOLLIN;
   }
   if (flag & SNMP_EV_WRITE) {
-    ee.events &= ~EPOLLOUT;
+    ee.events |= EPOLLOUT;
   }
   if (ee.events == 0) {
-    epoll_ctl(env.epfd, EPOLL_CTL_DEL, event->fd, &ee);
+    epoll_ctl(env.epfd, EPOLL_CTL_DEL, fd, &ee);
   } else {
-    epoll_ctl(env.epfd, EPOLL_CTL_MOD, event->fd, &ee);
+    if (flag & SNMP_EV_EDGE) {
+      ee.events |= EPOLLET;
+    }
+    epoll_ctl(env.epfd, EPOLL_CTL_MOD, fd, &ee);
   }
 }
 
@@ -85,22 +95,26 @@ static int
 __ev_poll(struct snmp_event_loop *ev_loop)
 {
   int i, nfds;
+  unsigned char flag;
 
-  if (ev_loop->timeout != -1) {
-    nfds = epoll_wait(env.epfd, env.event, SNMP_MAX_EVENTS, ev_loop->timeout);
-  } else {
-    nfds = epoll_wait(env.epfd, env.event, SNMP_MAX_EVENTS, -1);
-  }
+  nfds = epoll_wait(env.epfd, env.event, SNMP_EV_BATCH, ev_loop->wait);
 
   for (i = 0; i < nfds; i++) {
     struct epoll_event *ee = &env.event[i];
-    struct snmp_event *event = &ev_loop->event[i];
-    if (ee->events & EPOLLIN) {
-      event->read = 1;
+    int fd = ee->data.fd;
+
+    if (fd < 0 || fd >= ev_loop->size) {
+      continue;
+    }
+    /* Errors and hangups wake up the handlers to find them out */
+    flag = SNMP_EV_NONE;
+    if (ee->events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+      flag |= SNMP_EV_READ;
     }
-    if (ee->events & EPOLLOUT) {
-      event->write = 1;
+    if (ee->events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+      flag |= SNMP_EV_WRITE;
     }
+    snmp_event_ready(ev_loop, fd, flag & ev_loop->event[fd].flag);
   }
 
   return nfds;
@@ -0,0 +1,659 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*
+ * io_uring backend without liburing: the rings are set up and driven with
+ * raw system calls. Plain fds are watched with poll requests, one-shot and
+ * armed again after dispatch for level triggered fds, multishot for
+ * SNMP_EV_EDGE ones. Datagram sockets given to snmp_event_recv() keep a
+ * multishot recvmsg posted on a ring of provided buffers, and responses
+ * passed to snmp_event_send() go out as sendmsg requests, submitted in one
+ * io_uring_enter() together with the next wait.
+ */
+
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define URING_SQ_ENTRIES  (256)
+#define URING_CQ_ENTRIES  (1024)
+/* Provided buffers for received datagrams, a power of 2 */
+#define URING_RECV_BUFS  (64)
+#define URING_RECV_BUF_SIZ  (sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + 65536)
+#define URING_RECV_BGID  (0)
+/* Responses in flight */
+#define URING_SEND_SLOTS  (256)
+
+/* Request kind in the top byte of user_data, generation and fd or slot below */
+#define URING_POLL  (1ULL << 56)
+#define URING_RECV  (2ULL << 56)
+#define URING_SEND  (3ULL << 56)
+#define URING_CANCEL  (4ULL << 56)
+#define URING_KIND_MASK  (0xffULL << 56)
+
+#define uring_data(kind, gen, id)  ((kind) | (uint64_t)(gen) << 32 | (uint32_t)(id))
+#define uring_data_gen(data)  ((uint16_t)((data) >> 32))
+#define uring_data_id(data)  ((int)(uint32_t)(data))
+
+/* Backend state of an fd */
+struct uring_fd {
+  uint16_t gen;
+  /* Poll or recvmsg request is posted */
+  unsigned char armed;
+  /* To be armed before the next wait */
+  unsigned char pending;
+  datagram_handler recv;
+};
+
+/* Copy of a response until its sendmsg completes */
+struct uring_send {
+  int next;
+  int cap;
+  uint8_t *buf;
+  struct iovec iov;
+  struct msghdr msg;
+  struct sockaddr_in sin;
+  void (*done)(int res);
+};
+
+struct uring_env {
+  int fd;
+  /* Submission ring */
+  void *sq_ptr;
+  size_t sq_sz;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  struct io_uring_sqe *sqes;
+  size_t sqes_sz;
+  unsigned sq_local_tail;
+  unsigned to_submit;
+  /* Completion ring */
+  void *cq_ptr;
+  size_t cq_sz;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+  /* Per fd state and the fds to arm */
+  int size;
+  struct uring_fd *fds;
+  int pending_cnt;
+  int *pending;
+  /* Provided buffer ring */
+  struct io_uring_buf_ring *br;
+  size_t br_sz;
+  uint8_t *recv_bufs;
+  struct msghdr recv_msg;
+  /* Send slots */
+  int send_free;
+  struct uring_send send[URING_SEND_SLOTS];
+};
+
+static struct uring_env env = { .fd = -1 };
+
+static int
+uring_enter(unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz)
+{
+  return syscall(__NR_io_uring_enter, env.fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+/* Submit what is queued so far without waiting */
+static void
+uring_submit(void)
+{
+  int ret;
+
+  while (env.to_submit > 0) {
+    ret = uring_enter(env.to_submit, 0, 0, NULL, 0);
+    if (ret < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    env.to_submit -= ret;
+  }
+}
+
+static struct io_uring_sqe *
+uring_get_sqe(void)
+{
+  struct io_uring_sqe *sqe;
+  unsigned head = __atomic_load_n(env.sq_head, __ATOMIC_ACQUIRE);
+
+  if (env.sq_local_tail - head >= URING_SQ_ENTRIES) {
+    /* Ring is full, hand it over to the kernel first */
+    uring_submit();
+    head = __atomic_load_n(env.sq_head, __ATOMIC_ACQUIRE);
+    if (env.sq_local_tail - head >= URING_SQ_ENTRIES) {
+      return NULL;
+    }
+  }
+
+  sqe = &env.sqes[env.sq_local_tail & *env.sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+/* Publish the sqe taken last */
+static void
+uring_put_sqe(void)
+{
+  env.sq_array[env.sq_local_tail & *env.sq_mask] = env.sq_local_tail & *env.sq_mask;
+  env.sq_local_tail++;
+  env.to_submit++;
+  __atomic_store_n(env.sq_tail, env.sq_local_tail, __ATOMIC_RELEASE);
+}
+
+static struct uring_fd *
+uring_fd_get(int fd)
+{
+  int size = env.size ? env.size : SNMP_EV_TABLE_SIZ;
+
+  if (fd >= env.size) {
+    while (size <= fd) {
+      size *= 2;
+    }
+    env.fds = xrealloc(env.fds, size * sizeof(struct uring_fd));
+    env.pending = xrealloc(env.pending, size * sizeof(int));
+    memset(env.fds + env.size, 0, (size - env.size) * sizeof(struct uring_fd));
+    env.size = size;
+  }
+  return &env.fds[fd];
+}
+
+/* Drop the request posted on fd, its late completions are told apart by
+ * the generation */
+static void
+uring_cancel(int fd)
+{
+  struct io_uring_sqe *sqe;
+  struct uring_fd *ufd = uring_fd_get(fd);
+
+  if (ufd->armed) {
+    sqe = uring_get_sqe();
+    if (sqe != NULL) {
+      sqe->opcode = ufd->recv != NULL ? IORING_OP_ASYNC_CANCEL : IORING_OP_POLL_REMOVE;
+      sqe->fd = -1;
+      sqe->addr = uring_data(ufd->recv != NULL ? URING_RECV : URING_POLL, ufd->gen, fd);
+      sqe->user_data = URING_CANCEL;
+      uring_put_sqe();
+    }
+    ufd->armed = 0;
+  }
+  ufd->gen++;
+}
+
+static void
+uring_pending_add(int fd)
+{
+  struct uring_fd *ufd = uring_fd_get(fd);
+
+  if (!ufd->pending) {
+    ufd->pending = 1;
+    env.pending[env.pending_cnt++] = fd;
+  }
+}
+
+/* Post a poll request with the interests registered on fd */
+static void
+uring_poll_arm(int fd, unsigned char flag)
+{
+  struct io_uring_sqe *sqe;
+  struct uring_fd *ufd = uring_fd_get(fd);
+  uint32_t mask = 0;
+
+  if (flag & SNMP_EV_READ) {
+    mask |= POLLIN;
+  }
+  if (flag & SNMP_EV_WRITE) {
+    mask |= POLLOUT;
+  }
+  if (mask == 0) {
+    return;
+  }
+
+  sqe = uring_get_sqe();
+  if (sqe == NULL) {
+    uring_pending_add(fd);
+    return;
+  }
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+#ifdef LITTLE_ENDIAN
+  sqe->poll32_events = mask;
+#else
+  sqe->poll32_events = mask << 16 | mask >> 16;
+#endif
+  if (flag & SNMP_EV_EDGE) {
+    sqe->len = IORING_POLL_ADD_MULTI;
+  }
+  sqe->user_data = uring_data(URING_POLL, ufd->gen, fd);
+  uring_put_sqe();
+  ufd->armed = 1;
+}
+
+/* Post a multishot recvmsg taking buffers from the provided ring */
+static void
+uring_recv_arm(int fd)
+{
+  struct io_uring_sqe *sqe;
+  struct uring_fd *ufd = uring_fd_get(fd);
+
+  sqe = uring_get_sqe();
+  if (sqe == NULL) {
+    uring_pending_add(fd);
+    return;
+  }
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t)&env.recv_msg;
+  sqe->len = 1;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_RECV_BGID;
+  sqe->user_data = uring_data(URING_RECV, ufd->gen, fd);
+  uring_put_sqe();
+  ufd->armed = 1;
+}
+
+/* Give a buffer back to the kernel */
+static void
+uring_recv_buf_put(int bid)
+{
+  uint16_t tail = env.br->tail;
+  struct io_uring_buf *buf = &env.br->bufs[tail & (URING_RECV_BUFS - 1)];
+
+  buf->addr = (uintptr_t)(env.recv_bufs + (size_t)bid * URING_RECV_BUF_SIZ);
+  buf->len = URING_RECV_BUF_SIZ;
+  buf->bid = bid;
+  __atomic_store_n(&env.br->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static void
+__ev_done(void);
+
+static int
+__ev_init(void)
+{
+  int i;
+  struct io_uring_params p;
+  struct io_uring_buf_reg reg;
+
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_CQSIZE;
+  p.cq_entries = URING_CQ_ENTRIES;
+  env.fd = syscall(__NR_io_uring_setup, URING_SQ_ENTRIES, &p);
+  if (env.fd < 0) {
+    perror("io_uring_setup()");
+    return -1;
+  }
+  if (!(p.features & IORING_FEAT_EXT_ARG)) {
+    SMARTSNMP_LOG(L_WARNING, "io_uring: kernel lacks IORING_FEAT_EXT_ARG\n");
+    __ev_done();
+    return -1;
+  }
+
+  /* Map the rings */
+  env.sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  env.cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (env.cq_sz > env.sq_sz) {
+      env.sq_sz = env.cq_sz;
+    }
+    env.cq_sz = 0;
+  }
+  env.sq_ptr = mmap(NULL, env.sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, env.fd, IORING_OFF_SQ_RING);
+  env.cq_ptr = env.cq_sz ? mmap(NULL, env.cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, env.fd, IORING_OFF_CQ_RING) : env.sq_ptr;
+  env.sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+  env.sqes = mmap(NULL, env.sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, env.fd, IORING_OFF_SQES);
+  if (env.sq_ptr == MAP_FAILED || env.cq_ptr == MAP_FAILED || env.sqes == MAP_FAILED) {
+    perror("mmap()");
+    __ev_done();
+    return -1;
+  }
+
+  env.sq_head = (unsigned *)((char *)env.sq_ptr + p.sq_off.head);
+  env.sq_tail = (unsigned *)((char *)env.sq_ptr + p.sq_off.tail);
+  env.sq_mask = (unsigned *)((char *)env.sq_ptr + p.sq_off.ring_mask);
+  env.sq_array = (unsigned *)((char *)env.sq_ptr + p.sq_off.array);
+  env.sq_local_tail = *env.sq_tail;
+  env.to_submit = 0;
+  env.cq_head = (unsigned *)((char *)env.cq_ptr + p.cq_off.head);
+  env.cq_tail = (unsigned *)((char *)env.cq_ptr + p.cq_off.tail);
+  env.cq_mask = (unsigned *)((char *)env.cq_ptr + p.cq_off.ring_mask);
+  env.cqes = (struct io_uring_cqe *)((char *)env.cq_ptr + p.cq_off.cqes);
+
+  /* Provided buffer ring for datagrams */
+  env.br_sz = URING_RECV_BUFS * sizeof(struct io_uring_buf);
+  env.br = mmap(NULL, env.br_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (env.br == MAP_FAILED) {
+    env.br = NULL;
+    perror("mmap()");
+    __ev_done();
+    return -1;
+  }
+  env.recv_bufs = xmalloc(URING_RECV_BUFS * URING_RECV_BUF_SIZ);
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uintptr_t)env.br;
+  reg.ring_entries = URING_RECV_BUFS;
+  reg.bgid = URING_RECV_BGID;
+  if (syscall(__NR_io_uring_register, env.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    perror("io_uring_register()");
+    __ev_done();
+    return -1;
+  }
+  env.br->tail = 0;
+  for (i = 0; i < URING_RECV_BUFS; i++) {
+    uring_recv_buf_put(i);
+  }
+  memset(&env.recv_msg, 0, sizeof(env.recv_msg));
+  env.recv_msg.msg_namelen = sizeof(struct sockaddr_in);
+
+  /* Send slots */
+  for (i = 0; i < URING_SEND_SLOTS; i++) {
+    env.send[i].next = i + 1 < URING_SEND_SLOTS ? i + 1 : -1;
+  }
+  env.send_free = 0;
+
+  memset(env.fds, 0, env.size * sizeof(struct uring_fd));
+  env.pending_cnt = 0;
+  return env.fd;
+}
+
+static void
+__ev_done(void)
+{
+  int i;
+
+  if (env.fd < 0) {
+    return;
+  }
+
+  /* Closing the ring cancels every request */
+  close(env.fd);
+  env.fd = -1;
+  if (env.sqes != NULL && env.sqes != MAP_FAILED) {
+    munmap(env.sqes, env.sqes_sz);
+  }
+  if (env.cq_sz && env.cq_ptr != NULL && env.cq_ptr != MAP_FAILED) {
+    munmap(env.cq_ptr, env.cq_sz);
+  }
+  if (env.sq_ptr != NULL && env.sq_ptr != MAP_FAILED) {
+    munmap(env.sq_ptr, env.sq_sz);
+  }
+  if (env.br != NULL) {
+    munmap(env.br, env.br_sz);
+  }
+  free(env.recv_bufs);
+  for (i = 0; i < URING_SEND_SLOTS; i++) {
+    free(env.send[i].buf);
+  }
+  free(env.fds);
+  free(env.pending);
+  memset(&env, 0, sizeof(env));
+  env.fd = -1;
+}
+
+static void
+__ev_add(int fd, struct snmp_event *event, unsigned char flag)
+{
+  if (env.fd < 0) {
+    return;
+  }
+  /* Posted again with all the interests before the next wait */
+  uring_cancel(fd);
+  uring_pending_add(fd);
+}
+
+static void
+__ev_remove(int fd, struct snmp_event *event, unsigned char flag)
+{
+  if (env.fd < 0) {
+    return;
+  }
+  uring_cancel(fd);
+  if (event->flag & ~flag & (SNMP_EV_READ | SNMP_EV_WRITE)) {
+    uring_pending_add(fd);
+  }
+}
+
+/* Watch fd for datagrams, cb gets each of them with its sender */
+static int
+__ev_recv(int fd, datagram_handler cb)
+{
+  struct uring_fd *ufd;
+
+  if (env.fd < 0) {
+    return -1;
+  }
+  uring_cancel(fd);
+  ufd = uring_fd_get(fd);
+  ufd->recv = cb;
+  if (cb != NULL) {
+    uring_pending_add(fd);
+  }
+  return 0;
+}
+
+/* Queue a datagram, the buffer is copied. Return -1 if all slots are busy. */
+static int
+__ev_send(int fd, const uint8_t *buf, int len, const struct sockaddr_in *sin, void (*done)(int res))
+{
+  struct io_uring_sqe *sqe;
+  struct uring_send *s;
+  int slot = env.send_free;
+
+  if (env.fd < 0 || slot < 0) {
+    return -1;
+  }
+  sqe = uring_get_sqe();
+  if (sqe == NULL) {
+    return -1;
+  }
+
+  s = &env.send[slot];
+  env.send_free = s->next;
+  if (s->cap < len) {
+    s->buf = xrealloc(s->buf, len);
+    s->cap = len;
+  }
+  memcpy(s->buf, buf, len);
+  memcpy(&s->sin, sin, sizeof(struct sockaddr_in));
+  s->iov.iov_base = s->buf;
+  s->iov.iov_len = len;
+  memset(&s->msg, 0, sizeof(s->msg));
+  s->msg.msg_name = &s->sin;
+  s->msg.msg_namelen = sizeof(struct sockaddr_in);
+  s->msg.msg_iov = &s->iov;
+  s->msg.msg_iovlen = 1;
+  s->done = done;
+
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t)&s->msg;
+  sqe->len = 1;
+  sqe->user_data = uring_data(URING_SEND, 0, slot);
+  uring_put_sqe();
+  return 0;
+}
+
+static void
+uring_poll_complete(struct snmp_event_loop *ev_loop, struct io_uring_cqe *cqe)
+{
+  int fd = uring_data_id(cqe->user_data);
+  struct uring_fd *ufd;
+  unsigned char flag = SNMP_EV_NONE;
+
+  if (fd >= env.size || fd >= ev_loop->size) {
+    return;
+  }
+  ufd = &env.fds[fd];
+  if (uring_data_gen(cqe->user_data) != ufd->gen) {
+    return;
+  }
+  if (!(cqe->flags & IORING_CQE_F_MORE)) {
+    /* One-shot or terminated, armed again after dispatch */
+    ufd->armed = 0;
+    uring_pending_add(fd);
+  }
+  if (cqe->res < 0) {
+    return;
+  }
+
+  if (cqe->res & (POLLIN | POLLERR | POLLHUP)) {
+    flag |= SNMP_EV_READ;
+  }
+  if (cqe->res & (POLLOUT | POLLERR | POLLHUP)) {
+    flag |= SNMP_EV_WRITE;
+  }
+  flag &= ev_loop->event[fd].flag;
+  if (flag != SNMP_EV_NONE) {
+    snmp_event_ready(ev_loop, fd, flag);
+  }
+}
+
+static void
+uring_recv_complete(struct io_uring_cqe *cqe)
+{
+  int fd = uring_data_id(cqe->user_data);
+  struct uring_fd *ufd = fd < env.size ? &env.fds[fd] : NULL;
+  struct io_uring_recvmsg_out *out;
+  uint8_t *buf;
+  int bid;
+
+  if (ufd != NULL && uring_data_gen(cqe->user_data) == ufd->gen && !(cqe->flags & IORING_CQE_F_MORE)) {
+    /* Out of buffers or stopped, posted again before the next wait */
+    ufd->armed = 0;
+    if (ufd->recv != NULL) {
+      uring_pending_add(fd);
+    }
+  }
+  if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+    return;
+  }
+
+  bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+  buf = env.recv_bufs + (size_t)bid * URING_RECV_BUF_SIZ;
+  out = (struct io_uring_recvmsg_out *)buf;
+  if (cqe->res >= (int)sizeof(*out) && ufd != NULL && ufd->recv != NULL &&
+      uring_data_gen(cqe->user_data) == ufd->gen && !(out->flags & MSG_TRUNC)) {
+    ufd->recv(fd, buf + sizeof(*out) + env.recv_msg.msg_namelen, out->payloadlen,
+              (struct sockaddr_in *)(buf + sizeof(*out)));
+  }
+  if (env.fd >= 0) {
+    uring_recv_buf_put(bid);
+  }
+}
+
+static void
+uring_send_complete(struct io_uring_cqe *cqe)
+{
+  int slot = uring_data_id(cqe->user_data);
+  struct uring_send *s = &env.send[slot];
+
+  if (s->done != NULL) {
+    s->done(cqe->res);
+  }
+  s->next = env.send_free;
+  env.send_free = slot;
+}
+
+static int
+__ev_poll(struct snmp_event_loop *ev_loop)
+{
+  int i, fd, ret, nr = 0;
+  unsigned head, tail, min_complete, flags;
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  struct uring_fd *ufd;
+
+  if (env.fd < 0) {
+    return -1;
+  }
+
+  /* Post the requests of the fds dispatched or changed since last time */
+  for (i = 0; i < env.pending_cnt; i++) {
+    fd = env.pending[i];
+    ufd = &env.fds[fd];
+    ufd->pending = 0;
+    if (ufd->armed) {
+      continue;
+    }
+    if (ufd->recv != NULL) {
+      uring_recv_arm(fd);
+    } else if (fd < ev_loop->size) {
+      uring_poll_arm(fd, ev_loop->event[fd].flag);
+    }
+  }
+  env.pending_cnt = 0;
+
+  /* Submit and wait in one go */
+  flags = IORING_ENTER_GETEVENTS;
+  min_complete = 1;
+  if (ev_loop->wait == 0) {
+    min_complete = 0;
+  } else if (ev_loop->wait > 0) {
+    ts.tv_sec = ev_loop->wait / 1000;
+    ts.tv_nsec = ev_loop->wait % 1000 * 1000 * 1000;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = (uintptr_t)&ts;
+    flags |= IORING_ENTER_EXT_ARG;
+  }
+  ret = uring_enter(env.to_submit, min_complete, flags, flags & IORING_ENTER_EXT_ARG ? &arg : NULL, sizeof(arg));
+  if (ret >= 0) {
+    env.to_submit -= ret;
+  } else if (errno != EINTR && errno != ETIME && errno != EBUSY) {
+    perror("io_uring_enter()");
+  }
+
+  /* Reap completions, datagrams are handed over right here */
+  head = *env.cq_head;
+  tail = __atomic_load_n(env.cq_tail, __ATOMIC_ACQUIRE);
+  while (head != tail && env.fd >= 0) {
+    struct io_uring_cqe cqe = env.cqes[head & *env.cq_mask];
+    head++;
+    __atomic_store_n(env.cq_head, head, __ATOMIC_RELEASE);
+
+    switch (cqe.user_data & URING_KIND_MASK) {
+      case URING_POLL:
+        uring_poll_complete(ev_loop, &cqe);
+        break;
+      case URING_RECV:
+        uring_recv_complete(&cqe);
+        break;
+      case URING_SEND:
+        uring_send_complete(&cqe);
+        break;
+      default:
+        break;
+    }
+    nr++;
+
+    if (head == tail && env.fd >= 0) {
+      tail = __atomic_load_n(env.cq_tail, __ATOMIC_ACQUIRE);
+    }
+  }
+
+  return nr;
+}
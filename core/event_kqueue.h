@@ -24,7 +24,7 @@
 
 struct kqueue_env {
   int kqfd;
-  struct kevent event[SNMP_MAX_EVENTS];
+  struct kevent event[SNMP_EV_BATCH];
 };
 
 static struct kqueue_env env;
@@ -43,31 +43,35 @@ __ev_done(void)
 }
 
 static void
-__ev_add(struct snmp_event *event, unsigned char flag)
+__ev_add(int fd, struct snmp_event *event, unsigned char flag)
 {
-  struct kevent ke;
+  struct kevent ke[2];
+  int n = 0;
+  /* EV_CLEAR is the edge triggered mode of kqueue */
+  unsigned short mode = (flag | event->flag) & SNMP_EV_EDGE ? EV_ADD | EV_CLEAR : EV_ADD;
 
   if (flag & SNMP_EV_READ) {
-    EV_SET(&ke, event->fd, EVFILT_READ, EV_ADD, 0, 0, NULL);
+    EV_SET(&ke[n++], fd, EVFILT_READ, mode, 0, 0, NULL);
   }
   if (flag & SNMP_EV_WRITE) {
-    EV_SET(&ke, event->fd, EVFILT_WRITE, EV_ADD, 0, 0, NULL);
+    EV_SET(&ke[n++], fd, EVFILT_WRITE, mode, 0, 0, NULL);
   }
-  kevent(env.kqfd, &ke, 1, NULL, 0, NULL);
+  kevent(env.kqfd, ke, n, NULL, 0, NULL);
 }
  
 static void
-__ev_remove(struct snmp_event *event, unsigned char flag)
+__ev_remove(int fd, struct snmp_event *event, unsigned char flag)
 {
-  struct kevent ke;
+  struct kevent ke[2];
+  int n = 0;
 
-  if (flag & SNMP_EV_READ) {
-    EV_SET(&ke, event->fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+  if (flag & event->flag & SNMP_EV_READ) {
+    EV_SET(&ke[n++], fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
   }
-  if (flag & SNMP_EV_WRITE) {
-    EV_SET(&ke, event->fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+  if (flag & event->flag & SNMP_EV_WRITE) {
+    EV_SET(&ke[n++], fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
   } 
-  kevent(env.kqfd, &ke, 1, NULL, 0, NULL);
+  kevent(env.kqfd, ke, n, NULL, 0, NULL);
 }
 
 static int
@@ -75,23 +79,27 @@ __ev_poll(struct snmp_event_loop *ev_loop)
 {
   int i, nfds;
 
-  if (ev_loop->timeout != -1) {
+  if (ev_loop->wait != -1) {
     struct timespec tv;
-    tv.tv_sec = ev_loop->timeout / 1000;
-    tv.tv_nsec = ev_loop->timeout % 1000 * 1000 * 1000;
-    nfds = kevent(env.kqfd, NULL, 0, env.event, SNMP_MAX_EVENTS, &tv);
+    tv.tv_sec = ev_loop->wait / 1000;
+    tv.tv_nsec = ev_loop->wait % 1000 * 1000 * 1000;
+    nfds = kevent(env.kqfd, NULL, 0, env.event, SNMP_EV_BATCH, &tv);
   } else {
-    nfds = kevent(env.kqfd, NULL, 0, env.event, SNMP_MAX_EVENTS, NULL);
+    nfds = kevent(env.kqfd, NULL, 0, env.event, SNMP_EV_BATCH, NULL);
   }
 
   for (i = 0; i < nfds; i++) {
     struct kevent *ke = &env.event[i];
-    struct snmp_event *event = &ev_loop->event[i];
+    int fd = ke->ident;
+
+    if (fd < 0 || fd >= ev_loop->size) {
+      continue;
+    }
     if (ke->filter == EVFILT_READ) {
-      event->read = 1;
+      snmp_event_ready(ev_loop, fd, SNMP_EV_READ);
     }
     if (ke->filter == EVFILT_WRITE) {
-      event->write = 1;
+      snmp_event_ready(ev_loop, fd, SNMP_EV_WRITE);
     }
   }
 
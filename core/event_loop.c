@@ -19,17 +19,27 @@
  *
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
 #include "event_loop.h"
-#ifndef DISABLE_TRAP
-#include "trap.h"
-#endif
+#include "utils.h"
 
-#define SNMP_MAX_EVENTS  5
+/* Initial size of the fd table, it doubles to cover larger fds */
+#define SNMP_EV_TABLE_SIZ  16
+/* Most ready fds reported by one poll */
+#define SNMP_EV_BATCH  64
+/* Initial number of timer slots, it doubles as needed */
+#define SNMP_TIMER_SIZ  8
+/* Timer id: slot number in the low bits, a serial above them */
+#define SNMP_TIMER_SLOT_BITS  16
+#define SNMP_TIMER_SLOT_MASK  ((1 << SNMP_TIMER_SLOT_BITS) - 1)
 
+/* Slot of the fd table, indexed by fd */
 struct snmp_event {
-  int fd;
   transport_handler rcb;
   transport_handler wcb;
   void *rud;
@@ -39,55 +49,122 @@ struct snmp_event {
   unsigned char write;
 };
 
+/* Timer slot, id 0 means free */
+struct snmp_timer {
+  int id;
+  /* Position in the heap, next free slot when free */
+  int pos;
+  long long expire;
+  long interval;
+  timer_handler cb;
+  void *ud;
+};
+
+/* Binary min-heap of timer slots ordered by expiry */
+struct snmp_timer_heap {
+  int size;
+  int cnt;
+  int free;
+  int serial;
+  /* Slot of the running callback, -1 when none */
+  int firing;
+  struct snmp_timer *slot;
+  int *heap;
+};
+
 struct snmp_event_loop {
   int running;
   int max_fd;
+  /* Poll timeout given by the caller, -1 waits forever */
   long timeout;
-  struct snmp_event event[SNMP_MAX_EVENTS];
+  /* Poll timeout shortened by the next timer, used by the backends */
+  long wait;
+  /* fd table */
+  int size;
+  struct snmp_event *event;
+  /* fds marked by the last poll, each one appears once */
+  int ready_cnt;
+  int *ready;
 };
 
 static struct snmp_event_loop ev_loop;
+static struct snmp_timer_heap timers = { .free = -1, .firing = -1 };
+
+/* Mark a ready fd, called by the backends */
+static inline void
+snmp_event_ready(struct snmp_event_loop *ev_loop, int fd, unsigned char flag)
+{
+  struct snmp_event *event = &ev_loop->event[fd];
 
-#ifdef USE_EPOLL
-#include "event_epoll.h"
+  if (!event->read && !event->write) {
+    ev_loop->ready[ev_loop->ready_cnt++] = fd;
+  }
+  if (flag & SNMP_EV_READ) {
+    event->read = 1;
+  }
+  if (flag & SNMP_EV_WRITE) {
+    event->write = 1;
+  }
+}
+
+#ifdef USE_IO_URING
+#include "event_io_uring.h"
 #else
-    #ifdef USE_KQUEUE
-    #include "event_kqueue.h"
+    #ifdef USE_EPOLL
+    #include "event_epoll.h"
     #else
-    #include "event_select.h"
+        #ifdef USE_KQUEUE
+        #include "event_kqueue.h"
+        #else
+        #include "event_select.h"
+        #endif
     #endif
 #endif
 
-void
+/* Grow the fd table to cover fd */
+static void
+snmp_event_grow(int fd)
+{
+  int size = ev_loop.size ? ev_loop.size : SNMP_EV_TABLE_SIZ;
+
+  while (size <= fd) {
+    size *= 2;
+  }
+  ev_loop.event = xrealloc(ev_loop.event, size * sizeof(struct snmp_event));
+  ev_loop.ready = xrealloc(ev_loop.ready, size * sizeof(int));
+  memset(ev_loop.event + ev_loop.size, 0, (size - ev_loop.size) * sizeof(struct snmp_event));
+  ev_loop.size = size;
+}
+
+int
 snmp_event_init(void)
 {
-  int i;
-  for (i = 0; i < SNMP_MAX_EVENTS; i++) {
-    struct snmp_event *event = &ev_loop.event[i];
-    event->fd = -1;
-    event->flag = SNMP_EV_NONE;
-    event->read = 0;
-    event->write = 0;
+  if (ev_loop.event == NULL) {
+    snmp_event_grow(0);
   }
+  memset(ev_loop.event, 0, ev_loop.size * sizeof(struct snmp_event));
+  ev_loop.ready_cnt = 0;
   ev_loop.running = 1;
   ev_loop.timeout = -1;
   ev_loop.max_fd = -1;
-  __ev_init();
+  /* Without a backend the loop would poll a dead fd forever */
+  if (__ev_init() < 0) {
+    ev_loop.running = 0;
+    return -1;
+  }
+  return 0;
 }
 
 void
 snmp_event_done(void)
 {
-  int i;
-
   __ev_done();
-  for (i = 0; i < SNMP_MAX_EVENTS; i++) {
-    struct snmp_event *event = &ev_loop.event[i];
-    event->fd = -1;
-    event->flag = SNMP_EV_NONE;
-    event->read = 0;
-    event->write = 0;
-  }
+  free(ev_loop.event);
+  free(ev_loop.ready);
+  ev_loop.event = NULL;
+  ev_loop.ready = NULL;
+  ev_loop.size = 0;
+  ev_loop.ready_cnt = 0;
   ev_loop.running = 0;
   ev_loop.timeout = -1;
   ev_loop.max_fd = -1;
@@ -96,93 +173,348 @@ snmp_event_done(void)
 int
 snmp_event_add(int fd, unsigned char flag, transport_handler cb, void *ud)
 {
-  int i;
+  struct snmp_event *event;
 
-  for (i = 0; i < SNMP_MAX_EVENTS; i++) {
-    struct snmp_event *event = &ev_loop.event[i];
-    if (event->fd == fd) {
-      __ev_add(event, flag);
-      event->flag |= flag;
-    } else if (event->fd == -1) {
-      if (fd > ev_loop.max_fd) {
-        ev_loop.max_fd = fd;
-      }
-      event->fd = fd;
-      __ev_add(event, flag);
-      event->flag = flag;
-    } else {
-      continue;
-    }
+  if (fd < 0) {
+    return -1;
+  }
+  if (fd >= ev_loop.size) {
+    snmp_event_grow(fd);
+  }
+  if (fd > ev_loop.max_fd) {
+    ev_loop.max_fd = fd;
+  }
+
+  event = &ev_loop.event[fd];
+  __ev_add(fd, event, flag);
+  event->flag |= flag;
+
+  if (flag & SNMP_EV_READ) {
+    event->rcb = cb;
+    event->rud = ud;
+  }
+  if (flag & SNMP_EV_WRITE) {
+    event->wcb = cb;
+    event->wud = ud;
+  }
+  return 0;
+}
+
+void
+snmp_event_remove(int fd, unsigned char flag)
+{
+  struct snmp_event *event;
+
+  if (fd < 0 || fd >= ev_loop.size || ev_loop.event[fd].flag == SNMP_EV_NONE) {
+    return;
+  }
+
+  event = &ev_loop.event[fd];
+  __ev_remove(fd, event, flag);
+  event->flag &= ~flag;
+  if (flag & SNMP_EV_READ) {
+    event->read = 0;
+  }
+  if (flag & SNMP_EV_WRITE) {
+    event->write = 0;
+  }
+  if (!(event->flag & (SNMP_EV_READ | SNMP_EV_WRITE))) {
+    event->flag = SNMP_EV_NONE;
+  }
+
+  /* The highest fd left is only looked for when the top one goes */
+  while (ev_loop.max_fd >= 0 && ev_loop.event[ev_loop.max_fd].flag == SNMP_EV_NONE) {
+    ev_loop.max_fd--;
+  }
+}
+
+#ifdef USE_IO_URING
+/* Serve datagrams on fd through cb, NULL stops it */
+int
+snmp_event_recv(int fd, datagram_handler cb)
+{
+  if (fd < 0) {
+    return -1;
+  }
+  return __ev_recv(fd, cb);
+}
+
+/* Queue a datagram to sin, done gets the result once it is sent */
+int
+snmp_event_send(int fd, const uint8_t *buf, int len, const struct sockaddr_in *sin, void (*done)(int res))
+{
+  if (fd < 0 || len <= 0) {
+    return -1;
+  }
+  return __ev_send(fd, buf, len, sin, done);
+}
+#endif
+
+/* Milliseconds of the monotonic clock */
+long long
+snmp_timer_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline long long
+snmp_timer_expire(int pos)
+{
+  return timers.slot[timers.heap[pos]].expire;
+}
+
+static inline void
+snmp_timer_place(int pos, int slot)
+{
+  timers.heap[pos] = slot;
+  timers.slot[slot].pos = pos;
+}
+
+static void
+snmp_timer_sift_up(int pos)
+{
+  int slot = timers.heap[pos];
 
-    if (flag & SNMP_EV_READ) {
-      event->rcb = cb;
-      event->rud = ud;
+  while (pos > 0 && timers.slot[slot].expire < snmp_timer_expire((pos - 1) / 2)) {
+    snmp_timer_place(pos, timers.heap[(pos - 1) / 2]);
+    pos = (pos - 1) / 2;
+  }
+  snmp_timer_place(pos, slot);
+}
+
+static void
+snmp_timer_sift_down(int pos)
+{
+  int child, slot = timers.heap[pos];
+
+  while ((child = pos * 2 + 1) < timers.cnt) {
+    if (child + 1 < timers.cnt && snmp_timer_expire(child + 1) < snmp_timer_expire(child)) {
+      child++;
     }
-    if (flag & SNMP_EV_WRITE) {
-      event->wcb = cb;
-      event->wud = ud;
+    if (timers.slot[slot].expire <= snmp_timer_expire(child)) {
+      break;
     }
-    return 0;
+    snmp_timer_place(pos, timers.heap[child]);
+    pos = child;
   }
+  snmp_timer_place(pos, slot);
+}
 
-  return -1;
+static void
+snmp_timer_push(int slot)
+{
+  timers.heap[timers.cnt] = slot;
+  snmp_timer_sift_up(timers.cnt++);
 }
 
-void
-snmp_event_remove(int fd, unsigned char flag)
+/* Take a queued slot out of the heap */
+static void
+snmp_timer_pull(int slot)
 {
-  int i;
+  int pos = timers.slot[slot].pos;
+  int last = timers.heap[--timers.cnt];
 
-  if (fd == ev_loop.max_fd) {
-    ev_loop.max_fd = -1;
+  timers.slot[slot].pos = -1;
+  if (last == slot) {
+    return;
   }
+  snmp_timer_place(pos, last);
+  snmp_timer_sift_down(pos);
+  snmp_timer_sift_up(timers.slot[last].pos);
+}
 
-  for (i = 0; i < SNMP_MAX_EVENTS; i++) {
-    struct snmp_event *event = &ev_loop.event[i];
-    if (event->fd == fd) {
-      __ev_remove(event, flag);
-      event->flag &= ~flag;
-      if (flag & SNMP_EV_READ) {
-        event->read = 0;
-      }
-      if (flag & SNMP_EV_WRITE) {
-        event->write = 0;
-      }
-      if (event->flag == SNMP_EV_NONE) {
-        event->fd = -1;
-      }
+static void
+snmp_timer_release(int slot)
+{
+  timers.slot[slot].id = 0;
+  timers.slot[slot].cb = NULL;
+  timers.slot[slot].pos = timers.free;
+  timers.free = slot;
+}
+
+/* Schedule cb after delay milliseconds, then every interval milliseconds
+ * if interval is positive. Return the timer id, or -1 on failure. */
+int
+snmp_timer_add(long delay, long interval, timer_handler cb, void *ud)
+{
+  int i, slot, size;
+  struct snmp_timer *t;
+
+  if (cb == NULL) {
+    return -1;
+  }
+
+  if (timers.free < 0) {
+    /* No free slot, double the table */
+    size = timers.size ? timers.size * 2 : SNMP_TIMER_SIZ;
+    if (size > SNMP_TIMER_SLOT_MASK + 1) {
+      return -1;
     }
-    if (fd > ev_loop.max_fd) {
-      ev_loop.max_fd = fd;
+    timers.slot = xrealloc(timers.slot, size * sizeof(struct snmp_timer));
+    timers.heap = xrealloc(timers.heap, size * sizeof(int));
+    for (i = size - 1; i >= timers.size; i--) {
+      timers.slot[i].id = 0;
+      timers.slot[i].pos = i + 1 < size ? i + 1 : timers.free;
     }
+    timers.free = timers.size;
+    timers.size = size;
+  }
+
+  slot = timers.free;
+  t = &timers.slot[slot];
+  timers.free = t->pos;
+
+  /* Stale ids of a reused slot never match the new one */
+  timers.serial = (timers.serial + 1) & 0x7fff;
+  if (timers.serial == 0) {
+    timers.serial = 1;
   }
+  t->id = timers.serial << SNMP_TIMER_SLOT_BITS | slot;
+  t->expire = snmp_timer_now() + (delay > 0 ? delay : 0);
+  t->interval = interval > 0 ? interval : 0;
+  t->cb = cb;
+  t->ud = ud;
+  snmp_timer_push(slot);
+
+  return t->id;
 }
 
+/* Cancel a timer scheduled with cb, return its user data for the caller to
+ * release, or NULL if the id is unknown, belongs to another handler or the
+ * one-shot timer has already fired. */
+void *
+snmp_timer_remove(int id, timer_handler cb)
+{
+  int slot = id & SNMP_TIMER_SLOT_MASK;
+  void *ud;
+
+  if (id <= 0 || slot >= timers.size || timers.slot[slot].id != id ||
+      timers.slot[slot].cb != cb) {
+    return NULL;
+  }
+
+  ud = timers.slot[slot].ud;
+  if (slot == timers.firing) {
+    /* Released by snmp_timer_run() when the callback returns */
+    timers.slot[slot].id = 0;
+  } else {
+    if (timers.slot[slot].pos >= 0) {
+      snmp_timer_pull(slot);
+    }
+    snmp_timer_release(slot);
+  }
+  return ud;
+}
+
+/* Drop every scheduled timer without calling it. A forked process uses it
+ * to leave periodic jobs to its parent, user data is left to its owner. */
 void
-snmp_event_timeout(long timeout)
+snmp_timer_clear(void)
+{
+  while (timers.cnt > 0) {
+    snmp_timer_release(timers.heap[--timers.cnt]);
+  }
+}
+
+/* Milliseconds until the next timer, -1 if there is none */
+static long
+snmp_timer_wait(void)
+{
+  long long wait;
+
+  if (timers.cnt == 0) {
+    return -1;
+  }
+  wait = snmp_timer_expire(0) - snmp_timer_now();
+  return wait > 0 ? wait : 0;
+}
+
+/* Run every expired timer, periodic ones are queued again. A callback may
+ * add or cancel timers, itself included. */
+static void
+snmp_timer_run(void)
 {
-  /* 10 milliseconds as a tick */
-  ev_loop.timeout = timeout * 10;
+  int slot, id;
+  long long now;
+
+  if (timers.cnt == 0) {
+    return;
+  }
+
+  now = snmp_timer_now();
+  while (timers.cnt > 0 && snmp_timer_expire(0) <= now) {
+    slot = timers.heap[0];
+    id = timers.slot[slot].id;
+    snmp_timer_pull(slot);
+
+    timers.firing = slot;
+    timers.slot[slot].cb(timers.slot[slot].ud);
+    timers.firing = -1;
+
+    if (timers.slot[slot].id == id && timers.slot[slot].interval > 0) {
+      /* Missed periods are skipped rather than run in a burst */
+      timers.slot[slot].expire += timers.slot[slot].interval;
+      if (timers.slot[slot].expire <= now) {
+        timers.slot[slot].expire = now + timers.slot[slot].interval;
+      }
+      snmp_timer_push(slot);
+    } else {
+      snmp_timer_release(slot);
+    }
+  }
 }
 
+/* Dispatch only the fds marked by the backend, then the expired timers.
+ * Handlers may add, remove or tear down events, so the table is looked up
+ * again after every call. */
 static int
 snmp_event_poll(void)
 {
-  int i;
+  int i, fd;
   int ret;
-  
+  long next;
+  struct snmp_event *event;
+
+  /* Never sleep past the next timer */
+  ev_loop.wait = ev_loop.timeout;
+  next = snmp_timer_wait();
+  if (next >= 0 && (ev_loop.wait < 0 || next < ev_loop.wait)) {
+    ev_loop.wait = next;
+  }
+
+  ev_loop.ready_cnt = 0;
   ret = __ev_poll(&ev_loop);
-  for (i = 0; i < SNMP_MAX_EVENTS; i++) {
-    struct snmp_event *event = &ev_loop.event[i];
+  for (i = 0; i < ev_loop.ready_cnt; i++) {
+    fd = ev_loop.ready[i];
+
+    event = &ev_loop.event[fd];
     if (event->read && event->rcb != NULL) {
-      event->rcb(event->fd, SNMP_EV_READ, event->rud);
       event->read = 0;
+      event->rcb(fd, SNMP_EV_READ, event->rud);
+      if (fd >= ev_loop.size) {
+        break;
+      }
     }
+
+    event = &ev_loop.event[fd];
     if (event->write && event->wcb != NULL) {
-      event->wcb(event->fd, SNMP_EV_WRITE, event->wud);
       event->write = 0;
+      event->wcb(fd, SNMP_EV_WRITE, event->wud);
+      if (fd >= ev_loop.size) {
+        break;
+      }
     }
+
+    event = &ev_loop.event[fd];
+    event->read = 0;
+    event->write = 0;
   }
+  ev_loop.ready_cnt = 0;
+
+  snmp_timer_run();
 
   return ret;
 }
@@ -191,27 +523,13 @@ void
 snmp_event_run(void)
 {
   while (ev_loop.running) {
-    int ret = snmp_event_poll();
-    if (ret == 0) {
-#ifndef DISABLE_TRAP
-      /* Trap probing happens only when polling timeout */
-      smithsnmp_trap_ops->probe();
-#endif
-    }
+    snmp_event_poll();
   }
 }
 
 int
 snmp_event_step(long timeout)
 {
-  int ret = 0;
   ev_loop.timeout = timeout;
-  ret = snmp_event_poll();
-  if (ret == 0) {
-#ifndef DISABLE_TRAP
-    /* Trap probing happens only when polling timeout */
-    smithsnmp_trap_ops->probe();
-#endif
-  }
-  return ret;
+  return snmp_event_poll();
 }
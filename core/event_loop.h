@@ -22,18 +22,40 @@
 #ifndef _SNMP_EVENT_LOOP_H_
 #define _SNMP_EVENT_LOOP_H_
 
+#ifdef USE_IO_URING
+#include <stdint.h>
+#include <netinet/in.h>
+#endif
+
 #define SNMP_EV_NONE  0
 #define SNMP_EV_READ  1
 #define SNMP_EV_WRITE 2
+/* The handler drains the fd until EAGAIN, so the backend may report
+ * readiness only when it changes (EPOLLET) */
+#define SNMP_EV_EDGE  4
 
 typedef void (*transport_handler)(int sock, unsigned char flag, void *ud);
+typedef void (*timer_handler)(void *ud);
 
-void snmp_event_init(void);
+int snmp_event_init(void);
 void snmp_event_done(void);
 void snmp_event_run(void);
 int snmp_event_add(int fd, unsigned char flag, transport_handler cb, void *ud);
 void snmp_event_remove(int fd, unsigned char flag);
-void snmp_event_timeout(long timeout);
 int  snmp_event_step(long timeout);
 
+long long snmp_timer_now(void);
+int snmp_timer_add(long delay, long interval, timer_handler cb, void *ud);
+void *snmp_timer_remove(int id, timer_handler cb);
+void snmp_timer_clear(void);
+
+#ifdef USE_IO_URING
+/* Datagram sockets are served by the ring itself: received datagrams are
+ * handed over with their sender and responses are queued for sendmsg. */
+typedef void (*datagram_handler)(int sock, uint8_t *buf, int len, struct sockaddr_in *sin);
+
+int snmp_event_recv(int fd, datagram_handler cb);
+int snmp_event_send(int fd, const uint8_t *buf, int len, const struct sockaddr_in *sin, void (*done)(int res));
+#endif
+
 #endif /* _SNMP_EVENT_LOOP_H_ */
@@ -44,55 +44,59 @@ __ev_done(void)
 }
 
 static void
-__ev_add(struct snmp_event *event, unsigned char flag)
+__ev_add(int fd, struct snmp_event *event, unsigned char flag)
 {
   if (flag & SNMP_EV_READ) {
-    FD_SET(event->fd, &env.rfds);
+    FD_SET(fd, &env.rfds);
   }
   if (flag & SNMP_EV_WRITE) {
-    FD_SET(event->fd, &env.wfds);
+    FD_SET(fd, &env.wfds);
   }
 }
  
 static void
-__ev_remove(struct snmp_event *event, unsigned char flag)
+__ev_remove(int fd, struct snmp_event *event, unsigned char flag)
 {
   if (flag & SNMP_EV_READ) {
-    FD_CLR(event->fd, &env.rfds);
+    FD_CLR(fd, &env.rfds);
   }
   if (flag & SNMP_EV_WRITE) {
-    FD_CLR(event->fd, &env.wfds);
+    FD_CLR(fd, &env.wfds);
   } 
 }
 
 static int
 __ev_poll(struct snmp_event_loop *ev_loop)
 {
-  int i, nfds;
+  int fd, nfds;
 
   memcpy(&env.rfds_, &env.rfds, sizeof(fd_set));
   memcpy(&env.wfds_, &env.wfds, sizeof(fd_set));
 
-  if (ev_loop->timeout != -1) {
+  if (ev_loop->wait != -1) {
     struct timeval tv;
-    tv.tv_sec = ev_loop->timeout / 1000;
-    tv.tv_usec = (ev_loop->timeout % 1000) * 1000;
+    tv.tv_sec = ev_loop->wait / 1000;
+    tv.tv_usec = (ev_loop->wait % 1000) * 1000;
     nfds = select(ev_loop->max_fd + 1, &env.rfds_, &env.wfds_, NULL, &tv);
   } else {
     nfds = select(ev_loop->max_fd + 1, &env.rfds_, &env.wfds_, NULL, NULL);
   }
 
   if (nfds > 0) {
-    for (i = 0; i < SNMP_MAX_EVENTS; i++) {
-      struct snmp_event *event = &ev_loop->event[i];
+    for (fd = 0; fd <= ev_loop->max_fd; fd++) {
+      struct snmp_event *event = &ev_loop->event[fd];
+      unsigned char flag = SNMP_EV_NONE;
       if (event->flag == SNMP_EV_NONE) {
         continue;
       }
-      if (event->flag & SNMP_EV_READ && FD_ISSET(event->fd, &env.rfds_)) {
-        event->read = 1;
+      if (event->flag & SNMP_EV_READ && FD_ISSET(fd, &env.rfds_)) {
+        flag |= SNMP_EV_READ;
       }
-      if (event->flag & SNMP_EV_WRITE && FD_ISSET(event->fd, &env.wfds_)) {
-        event->write = 1;
+      if (event->flag & SNMP_EV_WRITE && FD_ISSET(fd, &env.wfds_)) {
+        flag |= SNMP_EV_WRITE;
+      }
+      if (flag != SNMP_EV_NONE) {
+        snmp_event_ready(ev_loop, fd, flag);
       }
     }
   }
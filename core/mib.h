@@ -24,6 +24,9 @@
 
 #include "asn1.h"
 #include "list.h"
+#include "../3rd/crypto/openssl_md5.h"
+#include "../3rd/crypto/openssl_sha.h"
+#include "../3rd/crypto/openssl_aes.h"
 #include "lua.h"
 #include "lualib.h"
 #include "lauxlib.h"
@@ -32,9 +35,19 @@
 #define MIB_OBJ_GROUP           1
 #define MIB_OBJ_INSTANCE        2
 
+/* Default memory budget of the value cache */
+#define MIB_CACHE_SIZ  (256 * 1024)
+/* Most requests waiting on suspended Lua handlers at once, handlers of
+ * further requests run to completion in place */
+#define MIB_ASYNC_MAX  64
+
 #define MD5_KEY_LEN   16
 #define SHA1_KEY_LEN  20
+#define SHA256_KEY_LEN  32
+#define SHA512_KEY_LEN  64
 #define AES_KEY_LEN   16
+#define AES192_KEY_LEN  24
+#define AES256_KEY_LEN  32
 
 /* Access security mode */
 enum snmp_security_mode {
@@ -49,15 +62,58 @@ typedef enum mib_aces_attr {
   MIB_ACES_WRITE
 } MIB_ACES_ATTR_E;
 
+/* Batched instance search state of a GET result */
+enum mib_batch_state {
+  /* Call the Lua handler right away */
+  MIB_BATCH_OFF = 0,
+  /* Defer the call when the instance node has a batch handler */
+  MIB_BATCH_ON,
+  /* Deferred, waiting for mib_instance_search_batch() */
+  MIB_BATCH_PENDING,
+  /* Answered by the batch handler */
+  MIB_BATCH_DONE,
+};
+
+struct oid_search_res;
+
+/* Instance search in C, the counterpart of a Lua handler. The request is
+ * ret_oid->request and the instance to look for is inst_id/inst_id_len.
+ * Fill in ret_oid->var and, for GETNEXT, put the next instance at inst_id
+ * with no more than mib_inst_room(ret_oid) sub-ids. SET passes the value
+ * in ret_oid->var. Returns the error status. */
+typedef int (*mib_native_handler)(struct oid_search_res *ret_oid, void *ctx);
+
+/* C plugins export this function, it registers the groups of the plugin
+ * through api and returns 0 on success. */
+#define MIB_PLUGIN_INIT  "smithsnmp_plugin_init"
+
+struct mib_plugin_api {
+  int (*reg)(const oid_t *grp_id, int id_len, mib_native_handler handler, void *ctx);
+  int (*unreg)(const oid_t *grp_id, int id_len);
+};
+
+typedef int (*mib_plugin_init)(const struct mib_plugin_api *api);
+
 struct oid_search_res {
-  /* Return oid */
-  oid_t *oid;
+  /* Return oid, copy it out with the real length */
+  oid_t oid[ASN1_OID_MAX_LEN];
   uint32_t id_len;
   /* Instance oid of return */
   oid_t *inst_id;
   uint32_t inst_id_len;
   /* Instance search callback in Lua */
   int callback;
+  /* Batched instance search callback in Lua */
+  int batch_callback;
+  /* Instance search handler in C and its context, NULL for Lua */
+  mib_native_handler native;
+  void *ctx;
+  /* Milliseconds a result is cached, 0 if not cached */
+  uint32_t cache_ttl;
+  /* enum mib_batch_state */
+  uint8_t batch;
+  /* The Lua handler is suspended, the result is not known yet */
+  uint8_t suspended;
   /* Request id */
   int request;
   /* Error status */
@@ -66,23 +122,81 @@ struct oid_search_res {
   Variable var;
 };
 
+/* Room left for the instance id of a search result */
+#define mib_inst_room(ret_oid)  (ASN1_OID_MAX_LEN - ((ret_oid)->inst_id - (ret_oid)->oid))
+
 struct mib_node {
   uint8_t type;
 };
 
+/* Group node of the path compressed mib-tree. The arcs of a chain of
+ * single child groups are folded into the prefix of the node below them,
+ * so a lookup matches them at once. Prefix, sorted sub-ids and child
+ * pointers follow the header in the same allocation. */
 struct mib_group_node {
   uint8_t type;
+  uint8_t prefix_len;
   uint16_t sub_id_cap;
   uint16_t sub_id_cnt;
-  oid_t *sub_id;
-  void **sub_ptr;
+  oid_t data[];
+};
+
+/* Row key of a table indexed in C */
+struct mib_row {
+  uint32_t id_len;
+  oid_t id[];
+};
+
+/* Sorted array of row keys, binary searched for GETNEXT */
+struct mib_index {
+  uint32_t row_cnt;
+  uint32_t row_cap;
+  struct mib_row **rows;
+};
+
+/* Table whose GETNEXT traversal is answered in C */
+struct mib_table {
+  struct mib_table *next;
+  oid_t table_no;
+  oid_t entry_no;
+  /* Readable columns in ascending order */
+  oid_t *columns;
+  uint32_t column_cnt;
+  struct mib_index *index;
+  /* Lua reference keeping the index userdata alive */
+  int index_ref;
 };
 
 struct mib_instance_node {
   uint8_t type;
   int callback;
+  /* Handler taking all GET requests of a PDU at once, LUA_NOREF if none */
+  int batch_callback;
+  /* Handler in C serving the node instead of Lua, NULL if none */
+  mib_native_handler native;
+  void *ctx;
+  /* Milliseconds GET and GETNEXT results are cached, 0 if not cached */
+  uint32_t cache_ttl;
+  /* Tables indexed in C, sorted by table_no */
+  struct mib_table *tables;
+};
+
+/* Request whose Lua handlers may yield. A handler waiting on a fd or a
+ * timer is parked and the request is served again once all of them are
+ * finished, their results are kept in the table referenced by results. */
+struct mib_async_req {
+  /* Suspended handler calls not finished yet */
+  int pending;
+  /* Registry reference of the finished results */
+  int results;
+  /* Serve the request again, called when pending drops to 0 */
+  void (*resume)(struct mib_async_req *req);
+  void *ud;
 };
 
+/* Push the string identifying a handler call among those of a request */
+typedef void (*mib_async_key)(lua_State *L, void *ud);
+
 struct mib_view {
   struct mib_view *next;
   const oid_t *oid;
@@ -110,10 +224,20 @@ struct mib_user {
   union {
     uint8_t md5[MD5_KEY_LEN];
     uint8_t sha1[SHA1_KEY_LEN];
+    uint8_t sha256[SHA256_KEY_LEN];
+    uint8_t sha512[SHA512_KEY_LEN];
   } auth_key;
+  /* Hash states after the inner and the outer padded auth key, HMAC of each
+   * message goes on from copies of them */
   union {
-    uint8_t aes[AES_KEY_LEN];
-  } priv_key;
+    MD5_CTX md5[2];
+    SHA_CTX sha1[2];
+    SHA256_CTX sha256[2];
+    SHA512_CTX sha512[2];
+  } auth_ctx;
+  /* Round keys expanded from the localized privacy key, which is not kept
+   * otherwise. CFB decrypts with the encryption schedule as well */
+  AES_KEY priv_sched;
   /* head of relevant read only view */
   struct list_head ro_views;
   /* head of relevant read write view */
@@ -144,11 +268,40 @@ int oid_cmp(const oid_t *src, uint32_t src_len, const oid_t *target, uint32_t ta
 int oid_cover(const oid_t *oid1, uint32_t len1, const oid_t *oid2, uint32_t len2);
 
 int mib_instance_search(struct oid_search_res *ret_oid);
+void mib_instance_search_batch(struct oid_search_res *res, uint32_t cnt, uint32_t first);
 struct mib_node *mib_tree_search(struct mib_view *view, const oid_t *oid, uint32_t id_len, struct oid_search_res *ret_oid);
 void mib_tree_search_next(struct mib_view *view, const oid_t *oid, uint32_t id_len, struct oid_search_res *ret_oid);
 
 int mib_node_reg(const oid_t *oid, uint32_t id_len, int callback);
 void mib_node_unreg(const oid_t *oid, uint32_t id_len);
+int mib_table_reg(const oid_t *oid, uint32_t id_len, struct mib_table *table);
+int mib_batch_reg(const oid_t *oid, uint32_t id_len, int callback);
+int mib_native_reg(const oid_t *oid, uint32_t id_len, mib_native_handler handler, void *ctx);
+int mib_cache_reg(const oid_t *oid, uint32_t id_len, uint32_t ttl);
+void mib_cache_init(size_t size);
+void mib_cache_setup(void);
+int mib_cache_get(struct oid_search_res *ret_oid);
+void mib_cache_put(const oid_t *key, uint32_t key_len, const struct oid_search_res *ret_oid);
+void mib_cache_flush(const oid_t *prefix, uint32_t len);
+void mib_async_init(lua_State *L);
+void mib_async_begin(struct mib_async_req *req);
+struct mib_async_req *mib_async_end(void);
+int mib_async_suspended(void);
+void mib_async_free(struct mib_async_req *req);
+int mib_async_call(lua_State *L, int nargs, int nresults, mib_async_key key, void *ud);
+int mib_async_block(lua_State *L, int idx);
+int mib_table_search_next(struct mib_instance_node *in, struct oid_search_res *ret_oid);
+int mib_row_cmp(const oid_t *id1, uint32_t len1, const oid_t *id2, uint32_t len2);
+void mib_index_init(struct mib_index *idx);
+void mib_index_free(struct mib_index *idx);
+int mib_index_insert(struct mib_index *idx, const oid_t *id, uint32_t id_len);
+int mib_index_delete(struct mib_index *idx, const oid_t *id, uint32_t id_len);
+uint32_t mib_index_upper(const struct mib_index *idx, const oid_t *id, uint32_t id_len);
+struct mib_shm;
+struct mib_shm *mib_shm_open(const oid_t *grp_id, uint32_t grp_id_len, const char *path);
+void mib_shm_close(struct mib_shm *shm);
+struct mib_shm *mib_shm_find(const oid_t *grp_id, uint32_t grp_id_len);
+int mib_shm_search(struct oid_search_res *ret_oid, void *ctx);
 void mib_community_reg(const oid_t *oid, uint32_t len, const char *community, MIB_ACES_ATTR_E attribute);
 void mib_community_unreg(const char *community, MIB_ACES_ATTR_E attribute);
 void mib_user_reg(const oid_t *oid, uint32_t len, const char *community, MIB_ACES_ATTR_E attribute);
@@ -163,6 +316,9 @@ struct mib_user *mib_user_search(const char *user);
 struct mib_view *mib_user_next_view(struct mib_user *u, MIB_ACES_ATTR_E attribute, struct mib_view *v);
 int mib_user_view_cover(struct mib_user *u, MIB_ACES_ATTR_E attribute, const oid_t *oid, uint32_t id_len);
 
+/* Main Lua state, coroutines of async handlers are never kept */
+extern lua_State *mib_lua_state;
+
 void mib_init(lua_State *L);
 
 #endif /* _MIB_H_ */
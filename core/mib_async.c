@@ -0,0 +1,364 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+
+#include "mib.h"
+#include "event_loop.h"
+#include "utils.h"
+
+/* What a yielding handler waits for: coroutine.yield(op, fd, timeout) with
+ * op "read", "write" or "sleep" and timeout in milliseconds, negative or
+ * nil for no timeout. The handler gets true back when the fd is ready or
+ * the sleep is over, false on timeout. */
+struct mib_async_wait {
+  /* -1 for a plain sleep */
+  int fd;
+  unsigned char flag;
+  long timeout;
+};
+
+/* Handler call parked until its wait is over */
+struct mib_async_call {
+  struct mib_async_req *req;
+  lua_State *co;
+  /* Registry references of the thread and of the result key */
+  int co_ref;
+  int key_ref;
+  int nresults;
+  int fd;
+  unsigned char flag;
+  int timer;
+};
+
+static lua_State *mib_async_L;
+/* Finished thread reused by the next call */
+static lua_State *mib_async_idle;
+static int mib_async_idle_ref = LUA_NOREF;
+/* Request being served, handlers may be parked only in between
+ * mib_async_begin() and mib_async_end() */
+static struct mib_async_req *mib_async_cur;
+static int mib_async_on;
+static int mib_async_req_cnt;
+
+static void mib_async_wait_add(struct mib_async_call *call, const struct mib_async_wait *w);
+static void mib_async_timer_handler(void *ud);
+
+void
+mib_async_init(lua_State *L)
+{
+  mib_async_L = L;
+}
+
+/* Serve a request, req is NULL for a new one and the request a parked
+ * handler belonged to when it is served again. */
+void
+mib_async_begin(struct mib_async_req *req)
+{
+  mib_async_cur = req;
+  mib_async_on = 1;
+}
+
+/* Return the request served since mib_async_begin(), NULL if no handler
+ * of it has ever been parked. The request is answered when its pending
+ * count is 0, otherwise the caller sets resume and waits for it. */
+struct mib_async_req *
+mib_async_end(void)
+{
+  struct mib_async_req *req = mib_async_cur;
+
+  mib_async_cur = NULL;
+  mib_async_on = 0;
+  return req;
+}
+
+/* Whether a handler of the request being served has been parked, its
+ * response is not ready then. */
+int
+mib_async_suspended(void)
+{
+  return mib_async_cur != NULL && mib_async_cur->pending > 0;
+}
+
+void
+mib_async_free(struct mib_async_req *req)
+{
+  luaL_unref(mib_async_L, LUA_REGISTRYINDEX, req->results);
+  free(req);
+  mib_async_req_cnt--;
+}
+
+/* Read the wait yielded at idx of L */
+static void
+mib_async_wait_get(lua_State *L, int idx, struct mib_async_wait *w)
+{
+  const char *op = lua_tostring(L, idx);
+
+  w->fd = -1;
+  w->flag = SNMP_EV_NONE;
+  w->timeout = lua_isnumber(L, idx + 2) ? (long)lua_tointeger(L, idx + 2) : -1;
+  if (op != NULL && lua_isnumber(L, idx + 1)) {
+    if (!strcmp(op, "read")) {
+      w->flag = SNMP_EV_READ;
+    } else if (!strcmp(op, "write")) {
+      w->flag = SNMP_EV_WRITE;
+    }
+    if (w->flag != SNMP_EV_NONE) {
+      w->fd = lua_tointeger(L, idx + 1);
+    }
+  }
+  if (w->fd < 0 && w->timeout < 0) {
+    /* Anything else just gives way to the other requests */
+    w->timeout = 0;
+  }
+}
+
+/* Wait in place, return 1 if the fd is ready or the sleep is over */
+static int
+mib_async_wait_block(const struct mib_async_wait *w)
+{
+  struct pollfd pfd;
+
+  if (w->fd < 0) {
+    poll(NULL, 0, w->timeout);
+    return 1;
+  }
+  pfd.fd = w->fd;
+  pfd.events = w->flag == SNMP_EV_READ ? POLLIN : POLLOUT;
+  pfd.revents = 0;
+  return poll(&pfd, 1, w->timeout) > 0;
+}
+
+/* Wait for (op, fd, timeout) at idx of L in place, the handler is run from
+ * the main thread of Lua or its request cannot be suspended. */
+int
+mib_async_block(lua_State *L, int idx)
+{
+  struct mib_async_wait w;
+
+  mib_async_wait_get(L, idx, &w);
+  return mib_async_wait_block(&w);
+}
+
+/* Keep what the thread of call returned as the result of its key, false
+ * if it failed, and serve the request again after its last call. */
+static void
+mib_async_finish(struct mib_async_call *call, int ret)
+{
+  lua_State *L = mib_async_L;
+  struct mib_async_req *req = call->req;
+  int i;
+
+  lua_rawgeti(L, LUA_REGISTRYINDEX, req->results);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, call->key_ref);
+  if (ret == 0) {
+    lua_createtable(L, call->nresults, 0);
+    lua_settop(call->co, call->nresults);
+    lua_xmove(call->co, L, call->nresults);
+    for (i = call->nresults; i > 0; i--) {
+      lua_rawseti(L, -(i + 1), i);
+    }
+  } else {
+    SMARTSNMP_LOG(L_ERROR, "Suspended MIB search handler fail: %s\n", lua_tostring(call->co, -1));
+    lua_pushboolean(L, 0);
+  }
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+
+  luaL_unref(L, LUA_REGISTRYINDEX, call->co_ref);
+  luaL_unref(L, LUA_REGISTRYINDEX, call->key_ref);
+  free(call);
+
+  if (--req->pending == 0) {
+    req->resume(req);
+  }
+}
+
+/* The wait of call is over, go on with its thread */
+static void
+mib_async_wake(struct mib_async_call *call, int ready)
+{
+  struct mib_async_wait w;
+  int ret;
+
+  if (call->fd >= 0) {
+    snmp_event_remove(call->fd, call->flag);
+    call->fd = -1;
+  }
+  if (call->timer > 0) {
+    snmp_timer_remove(call->timer, mib_async_timer_handler);
+    call->timer = 0;
+  }
+
+  lua_settop(call->co, 0);
+  lua_pushboolean(call->co, ready);
+  ret = lua_resume(call->co, 1);
+  if (ret == LUA_YIELD) {
+    mib_async_wait_get(call->co, 1, &w);
+    mib_async_wait_add(call, &w);
+    return;
+  }
+  mib_async_finish(call, ret);
+}
+
+static void
+mib_async_fd_handler(int fd, unsigned char flag, void *ud)
+{
+  mib_async_wake(ud, 1);
+}
+
+static void
+mib_async_timer_handler(void *ud)
+{
+  struct mib_async_call *call = ud;
+
+  /* One-shot, released by the event loop */
+  call->timer = 0;
+  /* A sleep is over or the fd has timed out */
+  mib_async_wake(call, call->fd < 0);
+}
+
+static void
+mib_async_wait_add(struct mib_async_call *call, const struct mib_async_wait *w)
+{
+  call->fd = -1;
+  call->timer = 0;
+  if (w->fd >= 0 && snmp_event_add(w->fd, w->flag, mib_async_fd_handler, call) == 0) {
+    call->fd = w->fd;
+    call->flag = w->flag;
+    if (w->timeout < 0) {
+      return;
+    }
+  }
+  call->timer = snmp_timer_add(w->timeout > 0 ? w->timeout : 0, 0, mib_async_timer_handler, call);
+}
+
+/* Park the yielded thread of the idle slot under the current request */
+static void
+mib_async_park(lua_State *L, int nresults, mib_async_key key, void *ud)
+{
+  struct mib_async_req *req = mib_async_cur;
+  struct mib_async_call *call;
+  struct mib_async_wait w;
+
+  if (req == NULL) {
+    req = xcalloc(1, sizeof(*req));
+    lua_newtable(L);
+    req->results = luaL_ref(L, LUA_REGISTRYINDEX);
+    mib_async_cur = req;
+    mib_async_req_cnt++;
+  }
+
+  call = xcalloc(1, sizeof(*call));
+  call->req = req;
+  call->co = mib_async_idle;
+  call->co_ref = mib_async_idle_ref;
+  call->nresults = nresults;
+  key(L, ud);
+  call->key_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  mib_async_idle = NULL;
+  mib_async_idle_ref = LUA_NOREF;
+  req->pending++;
+
+  mib_async_wait_get(call->co, 1, &w);
+  mib_async_wait_add(call, &w);
+}
+
+/* Push the result kept for key by an earlier serving of the request,
+ * return 0 if there is none. */
+static int
+mib_async_result(lua_State *L, mib_async_key key, void *ud)
+{
+  lua_rawgeti(L, LUA_REGISTRYINDEX, mib_async_cur->results);
+  key(L, ud);
+  lua_rawget(L, -2);
+  lua_remove(L, -2);
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    return 0;
+  }
+  return 1;
+}
+
+/* Call a Lua handler like lua_pcall(L, nargs, nresults, 0) in a thread of
+ * its own. When the handler yields, it is parked if key is not NULL and
+ * the request being served may wait, and LUA_YIELD is returned with
+ * nothing pushed. Otherwise the wait is done in place. */
+int
+mib_async_call(lua_State *L, int nargs, int nresults, mib_async_key key, void *ud)
+{
+  lua_State *co;
+  struct mib_async_wait w;
+  int i, ret;
+
+  if (key != NULL && mib_async_cur != NULL && mib_async_result(L, key, ud)) {
+    /* Finished while the request was waiting */
+    lua_replace(L, -(nargs + 2));
+    lua_pop(L, nargs);
+    if (!lua_istable(L, -1)) {
+      lua_pop(L, 1);
+      lua_pushstring(L, "suspended handler failed");
+      return LUA_ERRRUN;
+    }
+    for (i = 1; i <= nresults; i++) {
+      lua_rawgeti(L, -i, i);
+    }
+    lua_remove(L, -(nresults + 1));
+    return 0;
+  }
+
+  if (mib_async_idle == NULL) {
+    mib_async_idle = lua_newthread(L);
+    mib_async_idle_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+  co = mib_async_idle;
+
+  lua_xmove(L, co, nargs + 1);
+  ret = lua_resume(co, nargs);
+  while (ret == LUA_YIELD) {
+    if (key != NULL && mib_async_on &&
+        (mib_async_cur != NULL || mib_async_req_cnt < MIB_ASYNC_MAX)) {
+      mib_async_park(L, nresults, key, ud);
+      return LUA_YIELD;
+    }
+    mib_async_wait_get(co, 1, &w);
+    lua_settop(co, 0);
+    lua_pushboolean(co, mib_async_wait_block(&w));
+    ret = lua_resume(co, 1);
+  }
+
+  if (ret != 0) {
+    /* The thread is dead, its error message goes to L */
+    lua_xmove(co, L, 1);
+    luaL_unref(L, LUA_REGISTRYINDEX, mib_async_idle_ref);
+    mib_async_idle = NULL;
+    mib_async_idle_ref = LUA_NOREF;
+    return ret;
+  }
+
+  lua_settop(co, nresults);
+  lua_xmove(co, L, nresults);
+  return 0;
+}
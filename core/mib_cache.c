@@ -0,0 +1,250 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mib.h"
+#include "list.h"
+#include "event_loop.h"
+#include "utils.h"
+
+/* Room for the key, the returned instance and the value of an entry */
+#define MIB_CACHE_DATA_LEN  448
+
+struct mib_cache_entry {
+  /* Most recently used first */
+  struct list_head lru;
+  struct mib_cache_entry *hnext;
+  long long expire;
+  uint32_t hash;
+  int err_stat;
+  uint8_t request;
+  uint8_t tag;
+  /* Sub-ids of the key, 0 if the entry is unused */
+  uint16_t key_len;
+  /* Sub-ids of the instance returned by GETNEXT */
+  uint16_t inst_len;
+  /* length() of the value and its bytes */
+  uint16_t var_len;
+  uint16_t val_size;
+  /* Key, returned instance and value in a row */
+  oid_t data[MIB_CACHE_DATA_LEN / sizeof(oid_t)];
+};
+
+static struct {
+  /* Memory budget in bytes */
+  size_t size;
+  struct mib_cache_entry *entries;
+  uint32_t entry_cnt;
+  struct mib_cache_entry **buckets;
+  uint32_t bucket_mask;
+  /* Unused entries sit at the tail */
+  struct list_head lru;
+} cache;
+
+void
+mib_cache_init(size_t size)
+{
+  cache.size = size ? size : MIB_CACHE_SIZ;
+}
+
+/* The pool is set up when the first group asks for caching, so that the
+ * request path never allocates. */
+void
+mib_cache_setup(void)
+{
+  uint32_t i, n;
+
+  if (cache.entries != NULL) {
+    return;
+  }
+  if (cache.size == 0) {
+    cache.size = MIB_CACHE_SIZ;
+  }
+
+  cache.entry_cnt = cache.size / sizeof(struct mib_cache_entry);
+  if (cache.entry_cnt == 0) {
+    cache.entry_cnt = 1;
+  }
+  cache.entries = xcalloc(cache.entry_cnt, sizeof(struct mib_cache_entry));
+  for (n = 1; n < cache.entry_cnt; n <<= 1);
+  cache.buckets = xcalloc(n, sizeof(struct mib_cache_entry *));
+  cache.bucket_mask = n - 1;
+
+  INIT_LIST_HEAD(&cache.lru);
+  for (i = 0; i < cache.entry_cnt; i++) {
+    list_add_tail(&cache.entries[i].lru, &cache.lru);
+  }
+}
+
+/* FNV-1a of the request and the key */
+static uint32_t
+mib_cache_hash(uint8_t request, const oid_t *key, uint32_t key_len)
+{
+  uint32_t i, h = 2166136261u ^ request;
+
+  for (i = 0; i < key_len; i++) {
+    h = (h ^ key[i]) * 16777619u;
+  }
+  return h;
+}
+
+static struct mib_cache_entry *
+mib_cache_lookup(uint32_t hash, uint8_t request, const oid_t *key, uint32_t key_len)
+{
+  struct mib_cache_entry *e;
+
+  for (e = cache.buckets[hash & cache.bucket_mask]; e != NULL; e = e->hnext) {
+    if (e->hash == hash && e->request == request && e->key_len == key_len &&
+        !memcmp(e->data, key, key_len * sizeof(oid_t))) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+/* Unhash the entry and move it to the tail for reuse */
+static void
+mib_cache_drop(struct mib_cache_entry *e)
+{
+  struct mib_cache_entry **p;
+
+  for (p = &cache.buckets[e->hash & cache.bucket_mask]; *p != e; p = &(*p)->hnext);
+  *p = e->hnext;
+  e->key_len = 0;
+  list_move_tail(&e->lru, &cache.lru);
+}
+
+/* Bytes of the value kept in an entry */
+static uint32_t
+mib_cache_value_size(const Variable *var)
+{
+  switch (tag(var)) {
+  case ASN1_TAG_OCTSTR:
+  case ASN1_TAG_OPAQ:
+  case ASN1_TAG_IPADDR:
+    return length(var);
+  case ASN1_TAG_OBJID:
+    return length(var) * sizeof(oid_t);
+  default:
+    return ASN1_TAG_VALID(tag(var)) ? sizeof(count64_t) : 0;
+  }
+}
+
+/* Answer the instance search from the cache, the key is the oid up to the
+ * end of the requested instance. Returns 1 on a hit. */
+int
+mib_cache_get(struct oid_search_res *ret_oid)
+{
+  struct mib_cache_entry *e;
+  uint32_t key_len, hash;
+  Variable *var = &ret_oid->var;
+
+  if (cache.entries == NULL) {
+    return 0;
+  }
+
+  key_len = ret_oid->inst_id - ret_oid->oid + ret_oid->inst_id_len;
+  hash = mib_cache_hash(ret_oid->request, ret_oid->oid, key_len);
+  e = mib_cache_lookup(hash, ret_oid->request, ret_oid->oid, key_len);
+  if (e == NULL) {
+    return 0;
+  }
+  if (e->expire <= snmp_timer_now()) {
+    mib_cache_drop(e);
+    return 0;
+  }
+  list_move(&e->lru, &cache.lru);
+
+  ret_oid->err_stat = e->err_stat;
+  tag(var) = e->tag;
+  length(var) = e->var_len;
+  memcpy(value(var), e->data + e->key_len + e->inst_len, e->val_size);
+  if (e->request == SNMP_REQ_GETNEXT) {
+    oid_cpy(ret_oid->inst_id, e->data + e->key_len, e->inst_len);
+    ret_oid->inst_id_len = e->inst_len;
+  }
+  return 1;
+}
+
+/* Keep the result of an instance search under key for ret_oid->cache_ttl
+ * milliseconds, the least recently used entry makes room for it. */
+void
+mib_cache_put(const oid_t *key, uint32_t key_len, const struct oid_search_res *ret_oid)
+{
+  struct mib_cache_entry *e;
+  uint32_t hash, inst_len, val_size;
+  const Variable *var = &ret_oid->var;
+
+  if (cache.entries == NULL) {
+    return;
+  }
+
+  inst_len = ret_oid->request == SNMP_REQ_GETNEXT ? ret_oid->inst_id_len : 0;
+  val_size = ret_oid->err_stat ? 0 : mib_cache_value_size(var);
+  if ((key_len + inst_len) * sizeof(oid_t) + val_size > MIB_CACHE_DATA_LEN) {
+    return;
+  }
+
+  hash = mib_cache_hash(ret_oid->request, key, key_len);
+  e = mib_cache_lookup(hash, ret_oid->request, key, key_len);
+  if (e == NULL) {
+    e = list_last_entry(&cache.lru, struct mib_cache_entry, lru);
+    if (e->key_len) {
+      mib_cache_drop(e);
+    }
+    e->hash = hash;
+    e->request = ret_oid->request;
+    e->key_len = key_len;
+    oid_cpy(e->data, key, key_len);
+    e->hnext = cache.buckets[hash & cache.bucket_mask];
+    cache.buckets[hash & cache.bucket_mask] = e;
+  }
+  list_move(&e->lru, &cache.lru);
+
+  e->expire = snmp_timer_now() + ret_oid->cache_ttl;
+  e->err_stat = ret_oid->err_stat;
+  e->tag = tag(var);
+  e->var_len = length(var);
+  e->inst_len = inst_len;
+  e->val_size = val_size;
+  oid_cpy(e->data + key_len, ret_oid->inst_id, inst_len);
+  memcpy(e->data + key_len + inst_len, value(var), val_size);
+}
+
+/* Drop the entries under prefix, all of them if len is 0 */
+void
+mib_cache_flush(const oid_t *prefix, uint32_t len)
+{
+  uint32_t i;
+  struct mib_cache_entry *e;
+
+  for (i = 0; i < cache.entry_cnt; i++) {
+    e = &cache.entries[i];
+    if (e->key_len && e->key_len >= len &&
+        (len == 0 || !memcmp(e->data, prefix, len * sizeof(oid_t)))) {
+      mib_cache_drop(e);
+    }
+  }
+}
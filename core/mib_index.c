@@ -0,0 +1,251 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "mib.h"
+#include "utils.h"
+
+/* Compare row keys sub-id by sub-id, a prefix is less than the longer key */
+int
+mib_row_cmp(const oid_t *id1, uint32_t len1, const oid_t *id2, uint32_t len2)
+{
+  uint32_t i;
+
+  for (i = 0; i < len1 && i < len2; i++) {
+    if (id1[i] != id2[i]) {
+      return id1[i] < id2[i] ? -1 : 1;
+    }
+  }
+  return len1 < len2 ? -1 : len1 > len2;
+}
+
+/* Search the first row which is not less than the given key */
+static uint32_t
+mib_index_lower(const struct mib_index *idx, const oid_t *id, uint32_t id_len)
+{
+  uint32_t low = 0;
+  uint32_t high = idx->row_cnt;
+
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    const struct mib_row *row = idx->rows[mid];
+    if (mib_row_cmp(row->id, row->id_len, id, id_len) < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+/* Search the first row which is greater than the given key */
+uint32_t
+mib_index_upper(const struct mib_index *idx, const oid_t *id, uint32_t id_len)
+{
+  uint32_t low = 0;
+  uint32_t high = idx->row_cnt;
+
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    const struct mib_row *row = idx->rows[mid];
+    if (mib_row_cmp(row->id, row->id_len, id, id_len) <= 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+void
+mib_index_init(struct mib_index *idx)
+{
+  idx->row_cnt = 0;
+  idx->row_cap = 0;
+  idx->rows = NULL;
+}
+
+void
+mib_index_free(struct mib_index *idx)
+{
+  uint32_t i;
+
+  for (i = 0; i < idx->row_cnt; i++) {
+    free(idx->rows[i]);
+  }
+  free(idx->rows);
+  mib_index_init(idx);
+}
+
+/* Insert a row key, return 1 if inserted and 0 if it exists already. */
+int
+mib_index_insert(struct mib_index *idx, const oid_t *id, uint32_t id_len)
+{
+  struct mib_row *row;
+  uint32_t i = mib_index_lower(idx, id, id_len);
+
+  if (i < idx->row_cnt && !mib_row_cmp(idx->rows[i]->id, idx->rows[i]->id_len, id, id_len)) {
+    return 0;
+  }
+
+  if (idx->row_cnt == idx->row_cap) {
+    idx->row_cap = alloc_nr(idx->row_cap);
+    idx->rows = xrealloc(idx->rows, idx->row_cap * sizeof(struct mib_row *));
+  }
+
+  row = xmalloc(sizeof(*row) + id_len * sizeof(oid_t));
+  row->id_len = id_len;
+  oid_cpy(row->id, id, id_len);
+
+  memmove(idx->rows + i + 1, idx->rows + i, (idx->row_cnt - i) * sizeof(struct mib_row *));
+  idx->rows[i] = row;
+  idx->row_cnt++;
+  return 1;
+}
+
+/* Delete a row key, return 1 if deleted and 0 if not found. */
+int
+mib_index_delete(struct mib_index *idx, const oid_t *id, uint32_t id_len)
+{
+  uint32_t i = mib_index_lower(idx, id, id_len);
+
+  if (i == idx->row_cnt || mib_row_cmp(idx->rows[i]->id, idx->rows[i]->id_len, id, id_len)) {
+    return 0;
+  }
+
+  free(idx->rows[i]);
+  idx->row_cnt--;
+  memmove(idx->rows + i, idx->rows + i + 1, (idx->row_cnt - i) * sizeof(struct mib_row *));
+  return 1;
+}
+
+/* Fetch the value of column col of row pos through the Lua handler. */
+static int
+mib_table_row_get(struct mib_table *table, uint32_t col, uint32_t pos, struct oid_search_res *ret_oid)
+{
+  const struct mib_row *row = table->index->rows[pos];
+  oid_t *inst_id = ret_oid->inst_id;
+
+  /* Keep from overflow of the result oid buffer */
+  if (inst_id - ret_oid->oid + 3 + row->id_len > ASN1_OID_MAX_LEN) {
+    tag(&ret_oid->var) = ASN1_TAG_NO_SUCH_INST;
+    return 0;
+  }
+
+  inst_id[0] = table->table_no;
+  inst_id[1] = table->entry_no;
+  inst_id[2] = table->columns[col];
+  oid_cpy(inst_id + 3, row->id, row->id_len);
+  ret_oid->inst_id_len = 3 + row->id_len;
+
+  ret_oid->request = SNMP_REQ_GET;
+  ret_oid->err_stat = mib_instance_search(ret_oid);
+  ret_oid->request = SNMP_REQ_GETNEXT;
+  return ret_oid->err_stat;
+}
+
+/* Fetch the closest instance after the given sub-oid inside the table,
+ * return 1 if found and 0 if the table is exhausted. */
+static int
+mib_table_next(struct mib_table *table, const oid_t *req, uint32_t req_len, struct oid_search_res *ret_oid)
+{
+  uint32_t col = 0;
+  uint32_t pos = 0;
+
+  if (req_len > 1) {
+    if (req[1] > table->entry_no) {
+      return 0;
+    }
+    if (req[1] == table->entry_no && req_len > 2) {
+      while (col < table->column_cnt && table->columns[col] < req[2]) {
+        col++;
+      }
+      if (col < table->column_cnt && table->columns[col] == req[2]) {
+        pos = mib_index_upper(table->index, req + 3, req_len - 3);
+      }
+    }
+  }
+
+  /* Rows without value in a column are skipped */
+  for (; col < table->column_cnt; col++, pos = 0) {
+    for (; pos < table->index->row_cnt; pos++) {
+      if (mib_table_row_get(table, col, pos, ret_oid) || ASN1_TAG_VALID(tag(&ret_oid->var))) {
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/* GETNEXT in a group node with tables indexed in C. Tables are walked
+ * through their row index and the Lua handler is only asked for the value
+ * of the located row, objects indexed in Lua are left to the handler. */
+int
+mib_table_search_next(struct mib_instance_node *in, struct oid_search_res *ret_oid)
+{
+  oid_t req[ASN1_OID_MAX_LEN];
+  uint32_t req_len = ret_oid->inst_id_len;
+  struct mib_table *table;
+  int err;
+
+  oid_cpy(req, ret_oid->inst_id, req_len);
+
+  for (; ;) {
+    /* The first table not ahead of the request */
+    for (table = in->tables; table != NULL && req_len > 0 && table->table_no < req[0]; table = table->next);
+
+    if (table != NULL && req_len > 0 && table->table_no == req[0]) {
+      if (mib_table_next(table, req, req_len, ret_oid)) {
+        return ret_oid->err_stat;
+      }
+      if (table->table_no == (oid_t)-1) {
+        ret_oid->inst_id_len = 0;
+        tag(&ret_oid->var) = ASN1_TAG_NO_SUCH_OBJ;
+        return 0;
+      }
+      /* Table exhausted, go on from the next object */
+      req[0] = table->table_no + 1;
+      req_len = 1;
+      continue;
+    }
+
+    /* Objects indexed in Lua */
+    oid_cpy(ret_oid->inst_id, req, req_len);
+    ret_oid->inst_id_len = req_len;
+    err = mib_instance_search(ret_oid);
+    if (table == NULL) {
+      return err;
+    }
+    if ((err || ASN1_TAG_VALID(tag(&ret_oid->var))) && ret_oid->inst_id_len > 0 &&
+        ret_oid->inst_id[0] < table->table_no) {
+      return err;
+    }
+
+    /* The next table comes first */
+    req[0] = table->table_no;
+    req_len = 1;
+  }
+}
@@ -0,0 +1,271 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mib.h"
+#include "mib_shm.h"
+#include "snmp.h"
+#include "utils.h"
+
+/* Tries of a slot read racing with its writer */
+#define MIB_SHM_READ_TRIES  1024
+
+/* A counter segment mapped for a group node */
+struct mib_shm {
+  struct mib_shm *next;
+  oid_t grp_id[ASN1_OID_MAX_LEN];
+  uint32_t grp_id_len;
+  void *base;
+  size_t size;
+  /* Private copy of the entries, checked when loaded */
+  struct mib_shm_entry *entries;
+  uint32_t entry_cnt;
+  const struct mib_shm_slot *slots;
+};
+
+static struct mib_shm *mib_shm_list;
+
+static int
+mib_shm_tag_valid(uint32_t tag)
+{
+  switch (tag) {
+  case ASN1_TAG_INT:
+  case ASN1_TAG_CNT:
+  case ASN1_TAG_GAU:
+  case ASN1_TAG_TIMETICKS:
+  case ASN1_TAG_CNT64:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+/* Check the layout and take the entries */
+static int
+mib_shm_parse(struct mib_shm *shm, const char *path)
+{
+  const struct mib_shm_header *hdr = shm->base;
+  const struct mib_shm_entry *e;
+  uint32_t i;
+
+  if (shm->size < sizeof(*hdr) || hdr->magic != MIB_SHM_MAGIC) {
+    SMARTSNMP_LOG(L_ERROR, "%s is not a counter segment\n", path);
+    return -1;
+  }
+  if (hdr->version != MIB_SHM_VERSION) {
+    SMARTSNMP_LOG(L_ERROR, "%s has layout version %u, %u expected\n", path, hdr->version, MIB_SHM_VERSION);
+    return -1;
+  }
+  if (hdr->entry_off > shm->size ||
+      hdr->entry_cnt > (shm->size - hdr->entry_off) / sizeof(struct mib_shm_entry) ||
+      hdr->slot_off > shm->size || (hdr->slot_off & 7) ||
+      hdr->slot_cnt > (shm->size - hdr->slot_off) / sizeof(struct mib_shm_slot)) {
+    SMARTSNMP_LOG(L_ERROR, "%s tables are out of the segment\n", path);
+    return -1;
+  }
+
+  shm->entry_cnt = hdr->entry_cnt;
+  shm->entries = xmalloc((shm->entry_cnt ? shm->entry_cnt : 1) * sizeof(struct mib_shm_entry));
+  memcpy(shm->entries, (uint8_t *)shm->base + hdr->entry_off, shm->entry_cnt * sizeof(struct mib_shm_entry));
+  shm->slots = (const struct mib_shm_slot *)((uint8_t *)shm->base + hdr->slot_off);
+
+  for (i = 0; i < shm->entry_cnt; i++) {
+    e = &shm->entries[i];
+    if (e->oid_len == 0 || e->oid_len > MIB_SHM_OID_MAX ||
+        e->oid_len + shm->grp_id_len > ASN1_OID_MAX_LEN ||
+        !mib_shm_tag_valid(e->tag) || e->slot >= hdr->slot_cnt) {
+      SMARTSNMP_LOG(L_ERROR, "%s entry %u is invalid\n", path, i);
+      return -1;
+    }
+    if (i > 0 && mib_row_cmp(e[-1].oid, e[-1].oid_len, e->oid, e->oid_len) >= 0) {
+      SMARTSNMP_LOG(L_ERROR, "%s entry %u is out of order\n", path, i);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* Map the counter segment at path for the group node at grp_id */
+struct mib_shm *
+mib_shm_open(const oid_t *grp_id, uint32_t grp_id_len, const char *path)
+{
+  struct mib_shm *shm;
+  struct stat st;
+  int fd;
+
+  assert(grp_id_len <= ASN1_OID_MAX_LEN);
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    SMARTSNMP_LOG(L_ERROR, "Open counter segment %s failure\n", path);
+    return NULL;
+  }
+  if (fstat(fd, &st) < 0 || st.st_size == 0) {
+    SMARTSNMP_LOG(L_ERROR, "Counter segment %s is empty\n", path);
+    close(fd);
+    return NULL;
+  }
+
+  shm = xcalloc(1, sizeof(*shm));
+  oid_cpy(shm->grp_id, grp_id, grp_id_len);
+  shm->grp_id_len = grp_id_len;
+  shm->size = st.st_size;
+  shm->base = mmap(NULL, shm->size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (shm->base == MAP_FAILED) {
+    SMARTSNMP_LOG(L_ERROR, "Map counter segment %s failure\n", path);
+    free(shm);
+    return NULL;
+  }
+
+  if (mib_shm_parse(shm, path) < 0) {
+    munmap(shm->base, shm->size);
+    free(shm->entries);
+    free(shm);
+    return NULL;
+  }
+
+  shm->next = mib_shm_list;
+  mib_shm_list = shm;
+  return shm;
+}
+
+void
+mib_shm_close(struct mib_shm *shm)
+{
+  struct mib_shm **p;
+
+  for (p = &mib_shm_list; *p != NULL; p = &(*p)->next) {
+    if (*p == shm) {
+      *p = shm->next;
+      break;
+    }
+  }
+  munmap(shm->base, shm->size);
+  free(shm->entries);
+  free(shm);
+}
+
+/* The segment mapped for the group node at grp_id */
+struct mib_shm *
+mib_shm_find(const oid_t *grp_id, uint32_t grp_id_len)
+{
+  struct mib_shm *shm;
+
+  for (shm = mib_shm_list; shm != NULL; shm = shm->next) {
+    if (!mib_row_cmp(shm->grp_id, shm->grp_id_len, grp_id, grp_id_len)) {
+      return shm;
+    }
+  }
+  return NULL;
+}
+
+/* Index of the first entry not less than id, or greater than id if above */
+static uint32_t
+mib_shm_bound(const struct mib_shm *shm, const oid_t *id, uint32_t id_len, int above)
+{
+  uint32_t lo = 0, hi = shm->entry_cnt, mid;
+  int ret;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    ret = mib_row_cmp(shm->entries[mid].oid, shm->entries[mid].oid_len, id, id_len);
+    if (ret < 0 || (above && ret == 0)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/* Native handler of a group node served from a counter segment */
+int
+mib_shm_search(struct oid_search_res *ret_oid, void *ctx)
+{
+  struct mib_shm *shm = ctx;
+  const struct mib_shm_entry *e;
+  Variable *var = &ret_oid->var;
+  uint64_t value;
+  uint32_t i;
+
+  switch (ret_oid->request) {
+  case SNMP_REQ_GET:
+    i = mib_shm_bound(shm, ret_oid->inst_id, ret_oid->inst_id_len, 0);
+    if (i == shm->entry_cnt ||
+        mib_row_cmp(shm->entries[i].oid, shm->entries[i].oid_len, ret_oid->inst_id, ret_oid->inst_id_len)) {
+      tag(var) = ASN1_TAG_NO_SUCH_INST;
+      return 0;
+    }
+    break;
+  case SNMP_REQ_GETNEXT:
+    i = mib_shm_bound(shm, ret_oid->inst_id, ret_oid->inst_id_len, 1);
+    if (i == shm->entry_cnt) {
+      tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+      return 0;
+    }
+    /* Room was checked when loaded */
+    oid_cpy(ret_oid->inst_id, shm->entries[i].oid, shm->entries[i].oid_len);
+    ret_oid->inst_id_len = shm->entries[i].oid_len;
+    break;
+  default:
+    return SNMP_ERR_STAT_NOT_WRITABLE;
+  }
+
+  e = &shm->entries[i];
+  if (mib_shm_slot_read(&shm->slots[e->slot], &value, MIB_SHM_READ_TRIES) < 0) {
+    SMARTSNMP_LOG(L_WARNING, "Counter slot %u keeps changing\n", e->slot);
+    tag(var) = ASN1_TAG_NO_SUCH_INST;
+    /* resourceUnavailable is for SET only (RFC 3416) */
+    return SNMP_ERR_STAT_GEN_ERR;
+  }
+
+  tag(var) = e->tag;
+  length(var) = 1;
+  switch (e->tag) {
+  case ASN1_TAG_INT:
+    integer(var) = (int32_t)value;
+    break;
+  case ASN1_TAG_CNT:
+    count(var) = (uint32_t)value;
+    break;
+  case ASN1_TAG_GAU:
+    gauge(var) = (uint32_t)value;
+    break;
+  case ASN1_TAG_TIMETICKS:
+    timeticks(var) = (uint32_t)value;
+    break;
+  default:
+    count64(var) = value;
+    break;
+  }
+  return 0;
+}
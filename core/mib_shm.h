@@ -0,0 +1,108 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+
+#ifndef _MIB_SHM_H_
+#define _MIB_SHM_H_
+
+/*
+ * Layout of a shared memory counter segment. An external process owns the
+ * segment and keeps its counters up to date, the agent maps it read only
+ * and serves the counters under a registered group oid.
+ *
+ *   struct mib_shm_header   at offset 0
+ *   struct mib_shm_entry    entry_cnt entries at entry_off, sorted by oid
+ *   struct mib_shm_slot     slot_cnt slots at slot_off, 8 bytes aligned
+ *
+ * Entries map an instance oid, relative to the group oid, to a slot. They
+ * are read once when the agent loads the segment, so the writer fills them
+ * in before it publishes the magic and never changes them afterwards. A new
+ * layout means a new segment loaded again by the agent.
+ *
+ * Slots are updated at any time with mib_shm_slot_write(), readers retry
+ * while the sequence is odd or changed under them. This header only needs
+ * <stdint.h> so that writers can use it as is.
+ */
+
+#include <stdint.h>
+
+#define MIB_SHM_MAGIC    0x534d4e53  /* "SNMS" */
+#define MIB_SHM_VERSION  1
+#define MIB_SHM_OID_MAX  32
+
+struct mib_shm_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t entry_cnt;
+  uint32_t entry_off;
+  uint32_t slot_cnt;
+  uint32_t slot_off;
+};
+
+struct mib_shm_entry {
+  uint32_t oid[MIB_SHM_OID_MAX];
+  uint32_t oid_len;
+  /* ASN.1 tag of the value: Counter32, Counter64, Gauge32, Integer or TimeTicks */
+  uint32_t tag;
+  uint32_t slot;
+  uint32_t reserved;
+};
+
+struct mib_shm_slot {
+  /* Odd while the value is being written */
+  uint32_t seq;
+  uint32_t reserved;
+  uint64_t value;
+};
+
+/* Update a slot, there must be a single writer per slot */
+static inline void
+mib_shm_slot_write(struct mib_shm_slot *slot, uint64_t value)
+{
+  uint32_t seq = slot->seq;
+
+  __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  *(volatile uint64_t *)&slot->value = value;
+  __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Read a slot, returns 0 once a consistent value is got within tries */
+static inline int
+mib_shm_slot_read(const struct mib_shm_slot *slot, uint64_t *value, int tries)
+{
+  uint32_t seq;
+
+  while (tries-- > 0) {
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+      continue;
+    }
+    *value = *(const volatile uint64_t *)&slot->value;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq) {
+      return 0;
+    }
+  }
+  return -1;
+}
+
+#endif /* _MIB_SHM_H_ */
@@ -23,32 +23,32 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "mib.h"
 #include "utils.h"
 
+/* Sub-ids of a group node up to this many are scanned, not bisected */
+#define MIB_GROUP_SCAN_MAX  16
+/* GETNEXT walks resumed without a tree search, one cursor per walk */
+#define MIB_CURSOR_NUM  8
+
 /* MIB lua state */
-static lua_State *mib_lua_state;
-
-/* Dummy root node */
-static struct mib_group_node mib_dummy_node = {
-  MIB_OBJ_GROUP,
-  1,
-  0,
-  NULL,
-  NULL
-};
+lua_State *mib_lua_state;
+
+/* Root node, a group node without prefix */
+static struct mib_group_node *mib_root;
+/* Bumped on every change of the tree */
+static uint32_t mib_tree_serial = 1;
 
 oid_t *
 oid_dup(const oid_t *oid, uint32_t len)
 {
-  int i;
-  /* We need to allocate largest space so as to hold any oid */
-  oid_t *new_oid = xmalloc(ASN1_VALUE_MAX_LEN * sizeof(oid_t));
-  for (i = 0; i < len; i++) {
-    new_oid[i] = oid[i];
-  }
-  return new_oid;
+  /* Sized to the real length, never grown in place */
+  oid_t *new_oid = xmalloc((len ? len : 1) * sizeof(oid_t));
+  return oid_cpy(new_oid, oid, len);
 }
 
 int
@@ -89,7 +89,7 @@ oid_cover(const oid_t *oid1, uint32_t len1, const oid_t *oid2, uint32_t len2)
 }
 
 static int
-oid_binary_search(oid_t *array, int n, oid_t oid)
+oid_binary_search(const oid_t *array, int n, oid_t oid)
 {
   int low = -1;
   int high = n;
@@ -111,14 +111,166 @@ oid_binary_search(oid_t *array, int n, oid_t oid)
   }
 }
 
-/* Embedded code is not funny at all... */
-int
-mib_instance_search(struct oid_search_res *ret_oid)
+/* Sub-id search in a group node, same return value as oid_binary_search().
+ * Small fan-outs are scanned linearly, 4 sub-ids at a time with SSE2. */
+static inline int
+oid_search(const oid_t *array, int n, oid_t oid)
+{
+  int i = 0;
+
+  if (n > MIB_GROUP_SCAN_MAX) {
+    return oid_binary_search(array, n, oid);
+  }
+
+#ifdef __SSE2__
+  /* No unsigned compare in SSE2, flip the sign bits and compare signed */
+  const __m128i bias = _mm_set1_epi32((int)0x80000000);
+  const __m128i key = _mm_xor_si128(_mm_set1_epi32((int)oid), bias);
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(array + i)), bias);
+    int lt = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(v, key)));
+    if (lt != 0xf) {
+      /* Sub-ids are sorted, so the lanes below oid come first */
+      i += __builtin_ctz(~lt);
+      break;
+    }
+  }
+#endif
+
+  while (i < n && array[i] < oid) {
+    i++;
+  }
+  return i < n && array[i] == oid ? i : -i - 1;
+}
+
+/* Length of the common part of the prefix and oid */
+static inline uint32_t
+oid_prefix_match(const oid_t *prefix, uint32_t prefix_len, const oid_t *oid, uint32_t id_len)
+{
+  uint32_t i;
+
+  for (i = 0; i < prefix_len && i < id_len && prefix[i] == oid[i]; i++);
+  return i;
+}
+
+/* Child pointers start on a pointer boundary after prefix and sub-ids */
+#define group_ptr_off(prefix_len, cap)  (((prefix_len) + (cap) + 1) & ~1)
+
+static inline oid_t *
+group_prefix(struct mib_group_node *gn)
+{
+  return gn->data;
+}
+
+static inline oid_t *
+group_sub_id(struct mib_group_node *gn)
+{
+  return gn->data + gn->prefix_len;
+}
+
+static inline void **
+group_sub_ptr(struct mib_group_node *gn)
+{
+  return (void **)(gn->data + group_ptr_off(gn->prefix_len, gn->sub_id_cap));
+}
+
+/* Convert the value returned by a Lua handler at stack index idx */
+static void
+mib_instance_value(lua_State *L, int idx, Variable *var)
 {
   int i;
+
+  if (idx < 0) {
+    idx = lua_gettop(L) + idx + 1;
+  }
+  switch (tag(var)) {
+  case ASN1_TAG_INT:
+    length(var) = 1;
+    integer(var) = lua_tointeger(L, idx);
+    break;
+  case ASN1_TAG_OCTSTR:
+    length(var) = lua_objlen(L, idx);
+    memcpy(octstr(var), lua_tostring(L, idx), length(var));
+    break;
+  case ASN1_TAG_CNT:
+    length(var) = 1;
+    count(var) = lua_tonumber(L, idx);
+    break;
+  case ASN1_TAG_CNT64:
+    length(var) = 1;
+    count64(var) = lua_tonumber(L, idx);
+    break;
+  case ASN1_TAG_IPADDR:
+    length(var) = lua_objlen(L, idx);
+    for (i = 0; i < length(var); i++) {
+      lua_rawgeti(L, idx, i + 1);
+      ipaddr(var)[i] = lua_tointeger(L, -1);
+      lua_pop(L, 1);
+    }
+    break;
+  case ASN1_TAG_OBJID:
+    length(var) = lua_objlen(L, idx);
+    for (i = 0; i < length(var); i++) {
+      lua_rawgeti(L, idx, i + 1);
+      oid(var)[i] = lua_tointeger(L, -1);
+      lua_pop(L, 1);
+    }
+    break;
+  case ASN1_TAG_GAU:
+    length(var) = 1;
+    gauge(var) = lua_tonumber(L, idx);
+    break;
+  case ASN1_TAG_TIMETICKS:
+    length(var) = 1;
+    timeticks(var) = lua_tonumber(L, idx);
+    break;
+  default:
+    assert(0);
+  }
+}
+
+/* Instance search through a handler in C */
+static int
+mib_native_search(struct oid_search_res *ret_oid)
+{
+  Variable *var = &ret_oid->var;
+
+  ret_oid->err_stat = ret_oid->native(ret_oid, ret_oid->ctx);
+  if (!ret_oid->err_stat && ASN1_TAG_VALID(tag(var)) && ret_oid->request == SNMP_REQ_GETNEXT &&
+      ret_oid->inst_id_len > mib_inst_room(ret_oid)) {
+    SMARTSNMP_LOG(L_ERROR, "MIB native handler %p returns too long instance\n", (void *)ret_oid->native);
+    ret_oid->inst_id_len = 0;
+    tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+    return 0;
+  }
+  return ret_oid->err_stat;
+}
+
+/* Key of a handler call: handler, request and instance */
+static void
+mib_handler_key(lua_State *L, void *ud)
+{
+  struct oid_search_res *ret_oid = ud;
+
+  lua_pushlstring(L, (const char *)&ret_oid->callback, sizeof(ret_oid->callback));
+  lua_pushlstring(L, (const char *)&ret_oid->request, sizeof(ret_oid->request));
+  lua_pushlstring(L, (const char *)ret_oid->inst_id, ret_oid->inst_id_len * sizeof(oid_t));
+  lua_concat(L, 3);
+}
+
+/* Embedded code is not funny at all... */
+static int
+mib_handler_search(struct oid_search_res *ret_oid)
+{
+  int i, ret;
   Variable *var = &ret_oid->var;
   lua_State *L = mib_lua_state;
 
+  ret_oid->suspended = 0;
+  if (ret_oid->native != NULL) {
+    return mib_native_search(ret_oid);
+  }
+
   /* Empty lua stack. */
   lua_pop(L, -1);
   /* Get function. */
@@ -176,7 +328,16 @@ mib_instance_search(struct oid_search_res *ret_oid)
     lua_pushnil(L);
   }
 
-  if (lua_pcall(L, 4, 4, 0) != 0) {
+  ret = mib_async_call(L, 4, 4, mib_handler_key, ret_oid);
+  if (ret == LUA_YIELD) {
+    /* Stop here, the request is served again when the handler is done */
+    ret_oid->suspended = 1;
+    ret_oid->err_stat = 0;
+    tag(var) = ASN1_TAG_NUL;
+    length(var) = 0;
+    return 0;
+  }
+  if (ret != 0) {
     SMARTSNMP_LOG(L_ERROR, "MIB search hander %d fail: %s\n", ret_oid->callback, lua_tostring(L, -1));
     tag(var) = ASN1_TAG_NO_SUCH_OBJ;
     return 0;
@@ -188,55 +349,19 @@ mib_instance_search(struct oid_search_res *ret_oid)
   if (!ret_oid->err_stat && ASN1_TAG_VALID(tag(var))) {
     /* Return value */
     if (ret_oid->request != SNMP_REQ_SET) {
-      switch (tag(var)) {
-      case ASN1_TAG_INT:
-        length(var) = 1;
-        integer(var) = lua_tointeger(L, -2);
-        break;
-      case ASN1_TAG_OCTSTR:
-        length(var) = lua_objlen(L, -2);
-        memcpy(octstr(var), lua_tostring(L, -2), length(var));
-        break;
-      case ASN1_TAG_CNT:
-        length(var) = 1;
-        count(var) = lua_tonumber(L, -2);
-        break;
-      case ASN1_TAG_CNT64:
-        length(var) = 1;
-        count64(var) = lua_tonumber(L, -2);
-	break;
-      case ASN1_TAG_IPADDR:
-        length(var) = lua_objlen(L, -2);
-        for (i = 0; i < length(var); i++) {
-          lua_rawgeti(L, -2, i + 1);
-          ipaddr(var)[i] = lua_tointeger(L, -1);
-          lua_pop(L, 1);
-        }
-        break;
-      case ASN1_TAG_OBJID:
-        length(var) = lua_objlen(L, -2);
-        for (i = 0; i < length(var); i++) {
-          lua_rawgeti(L, -2, i + 1);
-          oid(var)[i] = lua_tointeger(L, -1);
-          lua_pop(L, 1);
-        }
-        break;
-      case ASN1_TAG_GAU:
-        length(var) = 1;
-        gauge(var) = lua_tonumber(L, -2);
-        break;
-      case ASN1_TAG_TIMETICKS:
-        length(var) = 1;
-        timeticks(var) = lua_tonumber(L, -2);
-        break;
-      default:
-        assert(0);
-      }
+      mib_instance_value(L, -2, var);
     }
 
     /* For GETNEXT request, return the new oid */
     if (ret_oid->request == SNMP_REQ_GETNEXT) {
       ret_oid->inst_id_len = lua_objlen(L, -3);
+      /* Keep from overflow of the result oid buffer */
+      if (ret_oid->inst_id - ret_oid->oid + ret_oid->inst_id_len > ASN1_OID_MAX_LEN) {
+        SMARTSNMP_LOG(L_ERROR, "MIB search hander %d returns too long instance\n", ret_oid->callback);
+        ret_oid->inst_id_len = 0;
+        tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+        return 0;
+      }
       for (i = 0; i < ret_oid->inst_id_len; i++) {
         lua_rawgeti(L, -3, i + 1);
         ret_oid->inst_id[i] = lua_tointeger(L, -1);
@@ -248,20 +373,164 @@ mib_instance_search(struct oid_search_res *ret_oid)
   return ret_oid->err_stat;
 }
 
+/* Instance search through the handler of the node, GET and GETNEXT results
+ * of a cached node are answered from the cache until they expire. */
+int
+mib_instance_search(struct oid_search_res *ret_oid)
+{
+  oid_t key[ASN1_OID_MAX_LEN];
+  uint32_t key_len;
+
+  if (ret_oid->cache_ttl == 0) {
+    return mib_handler_search(ret_oid);
+  }
+
+  if (ret_oid->request == SNMP_REQ_SET) {
+    /* Cached values of the group may change */
+    mib_cache_flush(ret_oid->oid, ret_oid->inst_id - ret_oid->oid);
+    return mib_handler_search(ret_oid);
+  }
+
+  if (mib_cache_get(ret_oid)) {
+    return ret_oid->err_stat;
+  }
+
+  /* GETNEXT overwrites the requested instance */
+  key_len = ret_oid->inst_id - ret_oid->oid + ret_oid->inst_id_len;
+  oid_cpy(key, ret_oid->oid, key_len);
+  ret_oid->err_stat = mib_handler_search(ret_oid);
+  if (!ret_oid->suspended) {
+    mib_cache_put(key, key_len, ret_oid);
+  }
+  return ret_oid->err_stat;
+}
+
+struct mib_batch_key {
+  struct oid_search_res *res;
+  uint32_t cnt;
+  uint32_t first;
+};
+
+/* Key of a batch handler call: handler and all of its instances */
+static void
+mib_batch_key(lua_State *L, void *ud)
+{
+  struct mib_batch_key *k = ud;
+  struct oid_search_res *r;
+  int n, cb = k->res[k->first].batch_callback;
+  uint32_t j;
+
+  lua_pushlstring(L, (const char *)&cb, sizeof(cb));
+  for (j = k->first; j < k->cnt; j++) {
+    r = &k->res[j];
+    if (r->batch != MIB_BATCH_PENDING || r->batch_callback != cb) {
+      continue;
+    }
+    n = r->inst_id_len;
+    lua_pushlstring(L, (const char *)&n, sizeof(n));
+    lua_pushlstring(L, (const char *)r->inst_id, r->inst_id_len * sizeof(oid_t));
+    lua_concat(L, 3);
+  }
+}
+
+/* Search all pending GET results sharing the batch handler of res[first]
+ * in one Lua call. The handler takes an array of instance oids and returns
+ * arrays of error status, value and tag in the same order. */
+void
+mib_instance_search_batch(struct oid_search_res *res, uint32_t cnt, uint32_t first)
+{
+  int i, n, ret, cb = res[first].batch_callback;
+  uint32_t j;
+  struct oid_search_res *r;
+  struct mib_batch_key key = { res, cnt, first };
+  lua_State *L = mib_lua_state;
+
+  /* Empty lua stack. */
+  lua_pop(L, -1);
+  /* Get function. */
+  lua_rawgeti(L, LUA_ENVIRONINDEX, cb);
+  /* op */
+  lua_pushinteger(L, SNMP_REQ_GET);
+  /* req_sub_oids */
+  lua_newtable(L);
+  for (n = 0, j = first; j < cnt; j++) {
+    r = &res[j];
+    if (r->batch != MIB_BATCH_PENDING || r->batch_callback != cb) {
+      continue;
+    }
+    lua_createtable(L, r->inst_id_len, 0);
+    for (i = 0; i < r->inst_id_len; i++) {
+      lua_pushinteger(L, r->inst_id[i]);
+      lua_rawseti(L, -2, i + 1);
+    }
+    lua_rawseti(L, -2, ++n);
+  }
+
+  ret = mib_async_call(L, 2, 3, mib_batch_key, &key);
+  if (ret == LUA_YIELD) {
+    /* The request is served again when the handler is done */
+    for (j = first; j < cnt; j++) {
+      r = &res[j];
+      if (r->batch == MIB_BATCH_PENDING && r->batch_callback == cb) {
+        r->batch = MIB_BATCH_DONE;
+        r->suspended = 1;
+        r->err_stat = 0;
+        tag(&r->var) = ASN1_TAG_NUL;
+        length(&r->var) = 0;
+      }
+    }
+    return;
+  }
+  if (ret != 0) {
+    SMARTSNMP_LOG(L_ERROR, "MIB batch search hander %d fail: %s\n", cb, lua_tostring(L, -1));
+    /* Ask the handlers one by one */
+    for (j = first; j < cnt; j++) {
+      r = &res[j];
+      if (r->batch == MIB_BATCH_PENDING && r->batch_callback == cb) {
+        r->batch = MIB_BATCH_OFF;
+        r->err_stat = mib_instance_search(r);
+      }
+    }
+    return;
+  }
+
+  for (n = 0, j = first; j < cnt; j++) {
+    r = &res[j];
+    if (r->batch != MIB_BATCH_PENDING || r->batch_callback != cb) {
+      continue;
+    }
+    r->batch = MIB_BATCH_DONE;
+    n++;
+    lua_rawgeti(L, -3, n);
+    r->err_stat = lua_tointeger(L, -1);
+    lua_rawgeti(L, -2, n);
+    tag(&r->var) = lua_tonumber(L, -1);
+    lua_pop(L, 2);
+    if (!r->err_stat && ASN1_TAG_VALID(tag(&r->var))) {
+      lua_rawgeti(L, -2, n);
+      mib_instance_value(L, -1, &r->var);
+      lua_pop(L, 1);
+    }
+    if (r->cache_ttl > 0) {
+      mib_cache_put(r->oid, r->inst_id - r->oid + r->inst_id_len, r);
+    }
+  }
+}
+
 /* GET request search, depth-first traversal in mib-tree, oid must match */
 struct mib_node *
 mib_tree_search(struct mib_view *view, const oid_t *orig_oid, uint32_t orig_id_len, struct oid_search_res *ret_oid)
 {
   oid_t *oid;
-  uint32_t id_len;
+  uint32_t id_len, m;
   struct mib_node *node;
   struct mib_group_node *gn;
   struct mib_instance_node *in;
 
   assert(view != NULL && orig_oid != NULL && ret_oid != NULL);
 
-  /* Duplicate OID as return value */
-  ret_oid->oid = oid_dup(orig_oid, orig_id_len);
+  /* Copy OID as return value */
+  oid_cpy(ret_oid->oid, orig_oid, orig_id_len);
   ret_oid->id_len = orig_id_len;
   ret_oid->err_stat = 0;
 
@@ -273,7 +542,7 @@ mib_tree_search(struct mib_view *view, const oid_t *orig_oid, uint32_t orig_id_l
   }
 
   /* Init something */
-  node = (struct mib_node *)&mib_dummy_node;
+  node = (struct mib_node *)mib_root;
   oid = ret_oid->oid;
   id_len = ret_oid->id_len;
 
@@ -281,20 +550,23 @@ mib_tree_search(struct mib_view *view, const oid_t *orig_oid, uint32_t orig_id_l
     switch (node->type) {
     case MIB_OBJ_GROUP:
       gn = (struct mib_group_node *)node;
-      int i = oid_binary_search(gn->sub_id, gn->sub_id_cnt, *oid);
-      if (i >= 0) {
-        /* Sub-id found, go on loop */
-        oid++;
-        id_len--;
-        node = gn->sub_ptr[i];
-        continue;
-      } else {
-        /* Sub-id not found */
-        ret_oid->inst_id = oid;
-        ret_oid->inst_id_len = id_len;
-        tag(&ret_oid->var) = ASN1_TAG_NO_SUCH_OBJ;
-        return node;
+      m = oid_prefix_match(group_prefix(gn), gn->prefix_len, oid, id_len);
+      if (m == gn->prefix_len && m < id_len) {
+        int i = oid_search(group_sub_id(gn), gn->sub_id_cnt, oid[m]);
+        if (i >= 0) {
+          /* Prefix and sub-id found, go on loop */
+          oid += m + 1;
+          id_len -= m + 1;
+          node = group_sub_ptr(gn)[i];
+          continue;
+        }
       }
+      /* Not found, a group node returned always points inst_id at its
+       * prefix so that GETNEXT can start over from there */
+      ret_oid->inst_id = oid;
+      ret_oid->inst_id_len = id_len;
+      tag(&ret_oid->var) = ASN1_TAG_NO_SUCH_OBJ;
+      return node;
 
     case MIB_OBJ_INSTANCE:
       in = (struct mib_instance_node *)node;
@@ -302,6 +574,18 @@ mib_tree_search(struct mib_view *view, const oid_t *orig_oid, uint32_t orig_id_l
       ret_oid->inst_id = oid;
       ret_oid->inst_id_len = id_len;
       ret_oid->callback = in->callback;
+      ret_oid->native = in->native;
+      ret_oid->ctx = in->ctx;
+      ret_oid->cache_ttl = in->cache_ttl;
+      if (ret_oid->batch == MIB_BATCH_ON && in->batch_callback != LUA_NOREF) {
+        if (ret_oid->cache_ttl > 0 && mib_cache_get(ret_oid)) {
+          return node;
+        }
+        /* Left to the batch handler of the node */
+        ret_oid->batch_callback = in->batch_callback;
+        ret_oid->batch = MIB_BATCH_PENDING;
+        return node;
+      }
       ret_oid->err_stat = mib_instance_search(ret_oid);
       return node;
 
@@ -326,20 +610,81 @@ struct node_backlog {
   struct mib_node *node;
   /* next sub-id index of the node */
   int n_idx;
+  /* offset of the sub-id in the return oid */
+  uint32_t pos;
+};
+
+/* Where a GETNEXT search stopped: the instance node behind the oid it
+ * returned and the traversal stack down to it. A search for that very oid
+ * in the same view resumes from there instead of descending the tree. */
+struct mib_cursor {
+  /* View key, view oids are never freed */
+  const oid_t *view_oid;
+  uint32_t view_len;
+  /* Tree serial when saved, stale once the tree changes */
+  uint32_t serial;
+  oid_t oid[ASN1_OID_MAX_LEN];
+  uint32_t id_len;
+  struct mib_instance_node *node;
+  /* Offset of the instance id in oid */
+  uint32_t inst_off;
+  uint32_t depth;
+  struct node_backlog stack[ASN1_OID_MAX_LEN];
 };
 
+static struct mib_cursor mib_cursors[MIB_CURSOR_NUM];
+static uint32_t mib_cursor_victim;
+
+static struct mib_cursor *
+mib_cursor_find(struct mib_view *view, const oid_t *oid, uint32_t id_len)
+{
+  int i;
+  struct mib_cursor *c;
+
+  for (i = 0; i < MIB_CURSOR_NUM; i++) {
+    c = &mib_cursors[i];
+    if (c->serial == mib_tree_serial && c->id_len == id_len &&
+        c->view_oid == view->oid && c->view_len == view->id_len &&
+        !memcmp(c->oid, oid, id_len * sizeof(oid_t))) {
+      return c;
+    }
+  }
+  return NULL;
+}
+
+/* Remember where the search stopped, a resumed walk keeps its cursor and
+ * a new one takes the cursors in turn. */
+static void
+mib_cursor_save(struct mib_cursor *c, struct mib_view *view, struct oid_search_res *ret_oid,
+                struct mib_instance_node *in, uint32_t inst_off, struct node_backlog *stack, uint32_t depth)
+{
+  if (c == NULL) {
+    c = &mib_cursors[mib_cursor_victim++ % MIB_CURSOR_NUM];
+  }
+  c->view_oid = view->oid;
+  c->view_len = view->id_len;
+  c->serial = mib_tree_serial;
+  oid_cpy(c->oid, ret_oid->oid, ret_oid->id_len);
+  c->id_len = ret_oid->id_len;
+  c->node = in;
+  c->inst_off = inst_off;
+  c->depth = depth;
+  memcpy(c->stack, stack, depth * sizeof(*stack));
+}
+
 /* GETNEXT request search, depth-first traversal in mib-tree, find the closest next oid. */
 void
 mib_tree_search_next(struct mib_view *view, const oid_t *orig_oid, uint32_t orig_id_len, struct oid_search_res *ret_oid)
 {
-  oid_t *oid;
-  uint32_t id_len;
+  oid_t *oid, *prefix;
+  uint32_t id_len, m;
   struct node_backlog *p_nbl;
   struct node_backlog nbl_stack[ASN1_OID_MAX_LEN];
   struct node_backlog *top;
   struct mib_node *node;
   struct mib_group_node *gn;
   struct mib_instance_node *in;
+  struct mib_cursor *cursor;
   /* 'immediate' is the search state indicator.
    * 0 is to get the matched instance according to the given oid;
    * 1 is to get the immediate first instance regardless of the given oid. */
@@ -347,8 +692,20 @@ mib_tree_search_next(struct mib_view *view, const oid_t *orig_oid, uint32_t orig
 
   assert(view != NULL && orig_oid != NULL && ret_oid != NULL);
 
-  /* Access control */
-  if (oid_cover(view->oid, view->id_len, orig_oid, orig_id_len) > 0) {
+  /* Init something */
+  p_nbl = NULL;
+  top = nbl_stack;
+
+  cursor = mib_cursor_find(view, orig_oid, orig_id_len);
+  if (cursor != NULL) {
+    /* Walking on from the last result, ask its instance node right away */
+    oid_cpy(ret_oid->oid, orig_oid, orig_id_len);
+    ret_oid->id_len = orig_id_len;
+    ret_oid->inst_id = ret_oid->oid + cursor->inst_off;
+    node = (struct mib_node *)cursor->node;
+    memcpy(nbl_stack, cursor->stack, cursor->depth * sizeof(struct node_backlog));
+    top += cursor->depth;
+  } else if (oid_cover(view->oid, view->id_len, orig_oid, orig_id_len) > 0) {
     /* In the range of view, search the root node at view oid */
     ret_oid->request = SNMP_REQ_GET;
     node = mib_tree_search(view, view->oid, view->id_len, ret_oid);
@@ -373,14 +730,11 @@ mib_tree_search_next(struct mib_view *view, const oid_t *orig_oid, uint32_t orig
     } else {
       /* END_OF_MIB_VIEW */
       node = NULL;
-      ret_oid->oid = oid_dup(view->oid, view->id_len);
+      oid_cpy(ret_oid->oid, view->oid, view->id_len);
       ret_oid->id_len = view->id_len;
     }
   }
 
-  /* Init something */
-  p_nbl = NULL;
-  top = nbl_stack;
   ret_oid->err_stat = 0;
   oid = ret_oid->inst_id;
   id_len = ret_oid->id_len - (oid - ret_oid->oid);
@@ -391,67 +745,78 @@ mib_tree_search_next(struct mib_view *view, const oid_t *orig_oid, uint32_t orig
       switch (node->type) {
       case MIB_OBJ_GROUP:
         gn = (struct mib_group_node *)node;
-        if (immediate) {
-          /* Fetch the immediate instance node. */
-          /* Fetch the sub-id of the backlogged node. */
-          int i = p_nbl != NULL ? p_nbl->n_idx : 0;
+        int i;
+        if (p_nbl != NULL) {
+          /* Backtracked here, fetch the sub-id of the backlogged node. */
+          i = p_nbl->n_idx;
           /* n_idx is not reusable */
           p_nbl = NULL;
-
-          /* Backlog the current node and move on. */
-          if (i + 1 >= gn->sub_id_cnt) {
-            top->node = NULL;
-            top->n_idx = 0;
-          } else {
-            top->node = node;
-            top->n_idx = i + 1;
-          }
-          top++;
-          *oid++ = gn->sub_id[i];
-          node = gn->sub_ptr[i];
         } else {
-          /* Search the match sub-id */
-          int index = oid_binary_search(gn->sub_id, gn->sub_id_cnt, *oid);
-          int i = index;
-          if (index < 0) {
-            /* Not found, switch to the immediate search mode */
-            immediate = 1;
-            /* Reverse the sign to locate the right position. */
-            i = -i - 1;
-            if (i == gn->sub_id_cnt) {
-              /* All sub-ids are greater than the target;
-               * Backtrack and fetch the next one. */
-              break;
-            } else if (i == 0) {
-              /* 1. All sub-ids are less than the target;
-               * 2. No sub-id in this group node;
-               * Just switch to the immediate search mode */
-              continue;
-            } /* else {
-                 Target is between the two sub-ids and [i] is the next one,
-                 switch to immediate mode and move on.
-            } */
+          /* Entering the node, match its prefix first */
+          prefix = group_prefix(gn);
+          if (!immediate) {
+            m = oid_prefix_match(prefix, gn->prefix_len, oid, id_len);
+            if (m < gn->prefix_len && m < id_len) {
+              if (oid[m] > prefix[m]) {
+                /* The whole sub-tree is ahead of the target, backtrack */
+                break;
+              }
+              /* The whole sub-tree follows the target */
+              immediate = 1;
+            } else if (id_len <= gn->prefix_len) {
+              /* Target ends within the prefix */
+              immediate = 1;
+            } else {
+              id_len -= gn->prefix_len;
+            }
           }
+          oid_cpy(oid, prefix, gn->prefix_len);
+          oid += gn->prefix_len;
 
-          /* Sub-id found is greater or just equal to the target,
-           * Anyway, record the next node and push it into stack. */
-          if (i + 1 >= gn->sub_id_cnt) {
-            top->node = NULL;
-            top->n_idx = 0;
-          } else {
-            top->node = node;
-            top->n_idx = i + 1;
+          if (gn->sub_id_cnt == 0) {
+            /* Empty tree */
+            break;
           }
-          top++;
 
-          *oid++ = gn->sub_id[i];
-          node = gn->sub_ptr[i];
-          if (--id_len == 0 && node->type == MIB_OBJ_GROUP) {
-            /* When oid length is decreased to zero, switch to the immediate mode */
-            immediate = 1;
+          if (immediate) {
+            /* Fetch the immediate instance node. */
+            i = 0;
+          } else {
+            /* Search the match sub-id */
+            i = oid_search(group_sub_id(gn), gn->sub_id_cnt, *oid);
+            if (i < 0) {
+              /* Not found, switch to the immediate search mode */
+              immediate = 1;
+              /* Reverse the sign to locate the right position. */
+              i = -i - 1;
+              if (i == gn->sub_id_cnt) {
+                /* All sub-ids are less than the target;
+                 * Backtrack and fetch the next one. */
+                break;
+              }
+              /* else [i] is the next one greater than the target, move on. */
+            }
           }
         }
 
+        /* Record the next sub-id and push the node into stack. */
+        if (i + 1 >= gn->sub_id_cnt) {
+          top->node = NULL;
+          top->n_idx = 0;
+        } else {
+          top->node = node;
+          top->n_idx = i + 1;
+        }
+        top->pos = oid - ret_oid->oid;
+        top++;
+
+        *oid++ = group_sub_id(gn)[i];
+        node = group_sub_ptr(gn)[i];
+        if (!immediate && --id_len == 0 && node->type == MIB_OBJ_GROUP) {
+          /* When oid length is decreased to zero, switch to the immediate mode */
+          immediate = 1;
+        }
+
         continue; /* Go on loop */
 
       case MIB_OBJ_INSTANCE:
@@ -462,7 +827,14 @@ mib_tree_search_next(struct mib_view *view, const oid_t *orig_oid, uint32_t orig
         /* Find instance variable through lua handler function */
         ret_oid->inst_id = oid;
         ret_oid->callback = in->callback;
-        ret_oid->err_stat = mib_instance_search(ret_oid);
+        ret_oid->native = in->native;
+        ret_oid->ctx = in->ctx;
+        ret_oid->cache_ttl = in->cache_ttl;
+        if (in->tables != NULL) {
+          ret_oid->err_stat = mib_table_search_next(in, ret_oid);
+        } else {
+          ret_oid->err_stat = mib_instance_search(ret_oid);
+        }
         if (ASN1_TAG_VALID(tag(&ret_oid->var))) {
           ret_oid->id_len = oid - ret_oid->oid + ret_oid->inst_id_len;
           assert(ret_oid->id_len <= ASN1_OID_MAX_LEN);
@@ -470,6 +842,7 @@ mib_tree_search_next(struct mib_view *view, const oid_t *orig_oid, uint32_t orig
             /* End of mib view */
             break;
           }
+          mib_cursor_save(cursor, view, ret_oid, in, oid - ret_oid->oid, nbl_stack, top - nbl_stack);
           return;
         } else {
           /* Instance not found */
@@ -498,7 +871,7 @@ mib_tree_search_next(struct mib_view *view, const oid_t *orig_oid, uint32_t orig
       return;
     }
     /* OID length is ignored once backtracking. */
-    oid--;
+    oid = ret_oid->oid + p_nbl->pos;
     node = p_nbl->node;
     /* Switch to the immediate search mode. */
     immediate = 1;
@@ -509,97 +882,101 @@ mib_tree_search_next(struct mib_view *view, const oid_t *orig_oid, uint32_t orig
 static inline void
 mib_tree_init_check(void)
 {
-  if (mib_dummy_node.sub_id == NULL || mib_dummy_node.sub_ptr == NULL) {
+  if (mib_root == NULL) {
     die("MIB tree not init yet!");
   }
 }
 
-/* Test a newly allocated node. */
-static inline int
-is_raw_group(struct mib_group_node *gn)
+static struct mib_group_node *
+mib_group_node_new(const oid_t *prefix, uint32_t prefix_len, uint16_t cap)
 {
-  assert(gn->sub_id != NULL);
-  return gn->sub_id[0] == 0 && gn->sub_id_cnt == 0;
+  struct mib_group_node *gn;
+
+  gn = xmalloc(sizeof(*gn) + group_ptr_off(prefix_len, cap) * sizeof(oid_t) + cap * sizeof(void *));
+  gn->type = MIB_OBJ_GROUP;
+  gn->prefix_len = prefix_len;
+  gn->sub_id_cap = cap;
+  gn->sub_id_cnt = 0;
+  oid_cpy(group_prefix(gn), prefix, prefix_len);
+  return gn;
 }
 
-/* Resize group node's sub-id array */
 static void
-group_node_expand(struct mib_group_node *gn, int index)
+mib_group_node_delete(struct mib_group_node *gn)
 {
-  int i;
+  free(gn);
+}
 
-  assert(!is_raw_group(gn));
+/* Copy of gn with another prefix and room for cap sub-ids, leaving a hole
+ * at index if hole is set. The old node is freed. */
+static struct mib_group_node *
+group_node_rebuild(struct mib_group_node *gn, const oid_t *prefix, uint32_t prefix_len, uint16_t cap, int index, int hole)
+{
+  struct mib_group_node *new_gn = mib_group_node_new(prefix, prefix_len, cap);
+  int cnt = gn->sub_id_cnt;
 
-  if (gn->sub_id_cnt + 1 > gn->sub_id_cap) {
-    /* resize new sub-id array */
-    oid_t *sub_id = xcalloc(alloc_nr(gn->sub_id_cap), sizeof(oid_t));
-    void **sub_ptr = xcalloc(alloc_nr(gn->sub_id_cap), sizeof(void *));
+  memcpy(group_sub_id(new_gn), group_sub_id(gn), index * sizeof(oid_t));
+  memcpy(group_sub_ptr(new_gn), group_sub_ptr(gn), index * sizeof(void *));
+  memcpy(group_sub_id(new_gn) + index + hole, group_sub_id(gn) + index, (cnt - index) * sizeof(oid_t));
+  memcpy(group_sub_ptr(new_gn) + index + hole, group_sub_ptr(gn) + index, (cnt - index) * sizeof(void *));
+  new_gn->sub_id_cnt = cnt;
 
-    gn->sub_id_cap = alloc_nr(gn->sub_id_cap);
+  mib_group_node_delete(gn);
+  return new_gn;
+}
 
-    /* duplicate and insert */
-    for (i = 0; i < gn->sub_id_cnt; i++) {
-      if (i < index) {
-        sub_id[i] = gn->sub_id[i];
-        sub_ptr[i] = gn->sub_ptr[i];
-      } else {
-        sub_id[i + 1] = gn->sub_id[i];
-        sub_ptr[i + 1] = gn->sub_ptr[i];
-      }
-    }
+/* Insert a sub-node at index, the group node linked at slot may move when
+ * it has to grow. */
+static void
+group_node_insert(struct mib_group_node **slot, int index, oid_t sub_id, void *sub_ptr)
+{
+  int i;
+  struct mib_group_node *gn = *slot;
 
-    /* abandon old ones */
-    free(gn->sub_id);
-    free(gn->sub_ptr);
-    gn->sub_id = sub_id;
-    gn->sub_ptr = sub_ptr;
+  if (gn->sub_id_cnt + 1 > gn->sub_id_cap) {
+    gn = *slot = group_node_rebuild(gn, group_prefix(gn), gn->prefix_len, alloc_nr(gn->sub_id_cap), index, 1);
   } else {
-    /* Insert new sub-node(s) without expanding */
     for (i = gn->sub_id_cnt - 1; i >= index; i--) {
-      gn->sub_id[i + 1] = gn->sub_id[i];
-      gn->sub_ptr[i + 1] = gn->sub_ptr[i];
+      group_sub_id(gn)[i + 1] = group_sub_id(gn)[i];
+      group_sub_ptr(gn)[i + 1] = group_sub_ptr(gn)[i];
     }
   }
+
+  group_sub_id(gn)[index] = sub_id;
+  group_sub_ptr(gn)[index] = sub_ptr;
+  gn->sub_id_cnt++;
 }
 
-/* Shrink group node's sub-id array when removing sub-node(s) */
+/* Remove the sub-node at index */
 static void
 group_node_shrink(struct mib_group_node *gn, int index)
 {
   int i;
-  if (gn->sub_id_cnt > 1) {
-    for (i = index; i < gn->sub_id_cnt - 1; i++) {
-      gn->sub_id[i] = gn->sub_id[i + 1];
-      gn->sub_ptr[i] = gn->sub_ptr[i + 1];
-    }
-    gn->sub_id_cnt--;
-  } else {
-    gn->sub_id[0] = 0;
-    gn->sub_ptr[0] = NULL;
-    gn->sub_id_cnt = 0;
-  }
-}
 
-static struct mib_group_node *
-mib_group_node_new(void)
-{
-  struct mib_group_node *gn = xmalloc(sizeof(*gn));
-  gn->type = MIB_OBJ_GROUP;
-  gn->sub_id_cap = 1;
-  gn->sub_id_cnt = 0;
-  gn->sub_id = xcalloc(1, sizeof(oid_t));
-  gn->sub_ptr = xcalloc(1, sizeof(void *));
-  return gn;
+  for (i = index; i < gn->sub_id_cnt - 1; i++) {
+    group_sub_id(gn)[i] = group_sub_id(gn)[i + 1];
+    group_sub_ptr(gn)[i] = group_sub_ptr(gn)[i + 1];
+  }
+  gn->sub_id_cnt--;
 }
 
+/* Fold the only child group into the group node linked at slot */
 static void
-mib_group_node_delete(struct mib_group_node *gn)
+group_node_merge(struct mib_group_node **slot)
 {
-  if (gn != NULL) {
-    free(gn->sub_id);
-    free(gn->sub_ptr);
-    free(gn);
-  }
+  oid_t prefix[ASN1_OID_MAX_LEN];
+  uint32_t prefix_len;
+  struct mib_group_node *gn = *slot;
+  struct mib_group_node *child = group_sub_ptr(gn)[0];
+
+  prefix_len = gn->prefix_len;
+  oid_cpy(prefix, group_prefix(gn), prefix_len);
+  prefix[prefix_len++] = group_sub_id(gn)[0];
+  oid_cpy(prefix + prefix_len, group_prefix(child), child->prefix_len);
+  prefix_len += child->prefix_len;
+
+  *slot = group_node_rebuild(child, prefix, prefix_len, child->sub_id_cap, child->sub_id_cnt, 0);
+  mib_group_node_delete(gn);
 }
 
 static struct mib_instance_node *
@@ -608,9 +985,24 @@ mib_instance_node_new(int callback)
   struct mib_instance_node *in = xmalloc(sizeof(*in));
   in->type = MIB_OBJ_INSTANCE;
   in->callback = callback;
+  in->batch_callback = LUA_NOREF;
+  in->native = NULL;
+  in->ctx = NULL;
+  in->cache_ttl = 0;
+  in->tables = NULL;
   return in;
 }
 
+static void
+mib_table_delete(struct mib_table *table)
+{
+  /* Unrefer row index */
+  lua_State *L = mib_lua_state;
+  luaL_unref(L, LUA_ENVIRONINDEX, table->index_ref);
+  free(table->columns);
+  free(table);
+}
+
 static void
 mib_instance_node_delete(struct mib_instance_node *in)
 {
@@ -618,131 +1010,135 @@ mib_instance_node_delete(struct mib_instance_node *in)
     /* Unrefer mib search handler */
     lua_State *L = mib_lua_state;
     luaL_unref(L, LUA_ENVIRONINDEX, in->callback);
+    luaL_unref(L, LUA_ENVIRONINDEX, in->batch_callback);
+    while (in->tables != NULL) {
+      struct mib_table *table = in->tables;
+      in->tables = table->next;
+      mib_table_delete(table);
+    }
     free(in);
   }
 }
 
-/* parent-child relationship */
+/* Node with its parent and grandparent, and the slots they are linked at */
 struct node_pair {
-  struct mib_node *parent;
+  struct mib_group_node **gslot;
+  struct mib_group_node **pslot;
   struct mib_node *child;
+  int gsub_idx;
   int sub_idx;
 };
 
-/* Find node as well as its parent according to given oid. */
+/* Find node as well as its parent according to given oid. An oid ending
+ * within the prefix of a group node finds the group node. */
 static struct mib_node *
 mib_tree_node_search(const oid_t *oid, uint32_t id_len, struct node_pair *pair)
 {
+  uint32_t m;
   struct mib_group_node *gn;
-  struct mib_node *parent = pair->parent = (struct mib_node *)&mib_dummy_node;
-  struct mib_node *node = pair->child = parent;
-  int sub_idx = 0;
+  struct mib_group_node **slot = &mib_root;
+  struct mib_node *node = (struct mib_node *)mib_root;
+
+  pair->gslot = pair->pslot = NULL;
+  pair->gsub_idx = pair->sub_idx = 0;
+
+  for (; ;) {
+    pair->child = node;
 
-  while (node != NULL && id_len > 0) {
     switch (node->type) {
     case MIB_OBJ_GROUP:
       gn = (struct mib_group_node *)node;
-      int i = oid_binary_search(gn->sub_id, gn->sub_id_cnt, *oid);
-      if (i >= 0) {
-        /* Sub-id found, go on loop */
-        oid++;
-        id_len--;
-        sub_idx = i;
-        parent = node;
-        node = gn->sub_ptr[i];
-        continue;
-      } else {
+      m = oid_prefix_match(group_prefix(gn), gn->prefix_len, oid, id_len);
+      if (m == id_len) {
+        return node;
+      } else if (m < gn->prefix_len) {
+        return NULL;
+      }
+      int i = oid_search(group_sub_id(gn), gn->sub_id_cnt, oid[m]);
+      if (i < 0) {
         /* Sub-id not found */
-        pair->parent = parent;
-        pair->child = node;
-        pair->sub_idx = sub_idx;
         return NULL;
       }
+      /* Sub-id found, go on loop */
+      oid += m + 1;
+      id_len -= m + 1;
+      pair->gslot = pair->pslot;
+      pair->gsub_idx = pair->sub_idx;
+      pair->pslot = slot;
+      pair->sub_idx = i;
+      slot = (struct mib_group_node **)&group_sub_ptr(gn)[i];
+      node = *(struct mib_node **)slot;
+      continue;
 
     case MIB_OBJ_INSTANCE:
-      pair->parent = parent;
-      pair->child = node;
-      pair->sub_idx = sub_idx;
-      return id_len == 1 ? node : NULL;
+      return id_len <= 1 ? node : NULL;
 
     default:
       assert(0);
     }
   }
-
-  /* node == NULL || id_len == 0 */
-  /* Note: If target oid is the dummy root node, then
-   * pair->parent == pair->child and pair->sub_idx == 0 */
-  pair->parent = parent;
-  pair->child = node;
-  pair->sub_idx = sub_idx;
-  return node;
 }
 
-/* Remove sub-node(s) in mib-tree. */
+/* Release a sub-tree */
 static void
-__mib_tree_delete(struct node_pair *pair)
+mib_tree_free(struct mib_node *node)
 {
-  struct node_backlog *p_nbl;
-  struct node_backlog nbl_stack[ASN1_OID_MAX_LEN];
-  struct node_backlog *top;
-
-  struct mib_node *node = pair->child;
+  int i;
   struct mib_group_node *gn;
-  struct mib_instance_node *in;
-
-  if (node == (struct mib_node *)&mib_dummy_node) {
-    SMARTSNMP_LOG(L_WARNING, "MIB dummy root node cannot be deleted!\n");
-    return;
-  }
-
-  /* Init something */
-  p_nbl = NULL;
-  top = nbl_stack;
 
-  for (; ;) {
+  switch (node->type) {
+  case MIB_OBJ_GROUP:
+    gn = (struct mib_group_node *)node;
+    for (i = 0; i < gn->sub_id_cnt; i++) {
+      mib_tree_free(group_sub_ptr(gn)[i]);
+    }
+    mib_group_node_delete(gn);
+    break;
 
-    if (node != NULL)
-    switch (node->type) {
-    case MIB_OBJ_GROUP:
-      gn = (struct mib_group_node *)node;
+  case MIB_OBJ_INSTANCE:
+    mib_instance_node_delete((struct mib_instance_node *)node);
+    break;
 
-      /* Fetch the sub-id of the backlogged node. */
-      int i = p_nbl != NULL ? p_nbl->n_idx : 0;
-      /* n_idx is not reusable */
-      p_nbl = NULL;
+  default:
+    assert(0);
+  }
+}
 
-      if (i == -1) {
-        /* Sub-tree is empty, delete this node and go on backtracking */
-        mib_group_node_delete(gn);
-        break;
-      }
+/* Keep the group node linked at slot compressed after losing a sub-node,
+ * the root keeps no prefix */
+static void
+group_node_fix(struct mib_group_node **slot)
+{
+  struct mib_group_node *gn = *slot;
 
-      /* If last sub-id, mark n_idx = -1. */
-      top->n_idx = i + 1 >= gn->sub_id_cnt ? -1 : i + 1;
-      top->node = node;
-      top++;
+  if (slot != &mib_root && gn->sub_id_cnt == 1 &&
+      ((struct mib_node *)group_sub_ptr(gn)[0])->type == MIB_OBJ_GROUP) {
+    group_node_merge(slot);
+  }
+}
 
-      node = gn->sub_ptr[i++];
-      continue;
+/* Remove sub-node(s) in mib-tree. */
+static void
+__mib_tree_delete(struct node_pair *pair)
+{
+  struct mib_group_node *parent;
 
-    case MIB_OBJ_INSTANCE:
-      in = (struct mib_instance_node *)node;
-      mib_instance_node_delete(in);
-      break;
+  if (pair->pslot == NULL) {
+    SMARTSNMP_LOG(L_WARNING, "MIB dummy root node cannot be deleted!\n");
+    return;
+  }
 
-    default :
-      assert(0);
-    }
+  mib_tree_free(pair->child);
+  parent = *pair->pslot;
+  group_node_shrink(parent, pair->sub_idx);
 
-    /* Backtracking */
-    p_nbl = top == nbl_stack ? NULL : --top;
-    if (p_nbl == NULL) {
-      /* End of traversal. */
-      group_node_shrink((struct mib_group_node *)pair->parent, pair->sub_idx);
-      return;
-    }
-    node = p_nbl->node;
+  if (parent->sub_id_cnt == 0 && pair->gslot != NULL) {
+    /* Drop the empty group as well */
+    group_node_shrink(*pair->gslot, pair->gsub_idx);
+    mib_group_node_delete(parent);
+    group_node_fix(pair->gslot);
+  } else {
+    group_node_fix(pair->pslot);
   }
 }
 
@@ -755,7 +1151,28 @@ mib_tree_delete(const oid_t *oid, uint32_t id_len)
   node = mib_tree_node_search(oid, id_len, &pair);
   if (node != NULL) {
     __mib_tree_delete(&pair);
+    mib_tree_serial++;
+    mib_cache_flush(NULL, 0);
+  }
+}
+
+/* Sub-tree below a new sub-id for the rest of oid: the instance node alone,
+ * or a group node holding all arcs but the last one as prefix. */
+static struct mib_node *
+mib_tree_branch_new(const oid_t *oid, uint32_t id_len, int callback, struct mib_instance_node **in)
+{
+  struct mib_group_node *gn;
+
+  *in = mib_instance_node_new(callback);
+  if (id_len == 0) {
+    return (struct mib_node *)*in;
   }
+
+  gn = mib_group_node_new(oid, id_len - 1, 1);
+  group_sub_id(gn)[0] = oid[id_len - 1];
+  group_sub_ptr(gn)[0] = *in;
+  gn->sub_id_cnt = 1;
+  return (struct mib_node *)gn;
 }
 
 /* This function will create an instance node in mib-tree according to oid given
@@ -765,49 +1182,61 @@ mib_tree_delete(const oid_t *oid, uint32_t id_len)
 static struct mib_instance_node *
 mib_tree_instance_insert(const oid_t *oid, uint32_t id_len, int callback)
 {
-  struct mib_node *node = (struct mib_node *)&mib_dummy_node;
-  struct mib_group_node *gn;
+  uint32_t m;
+  struct mib_group_node **slot = &mib_root;
+  struct mib_node *node = (struct mib_node *)mib_root;
+  struct mib_group_node *gn, *split;
+  struct mib_instance_node *in;
+  void *branch;
+  oid_t sub_id;
 
-  while (id_len > 0) {
+  for (; ;) {
     switch (node->type) {
     case MIB_OBJ_GROUP:
       gn = (struct mib_group_node *)node;
+      m = oid_prefix_match(group_prefix(gn), gn->prefix_len, oid, id_len);
+      if (m == id_len) {
+        /* oid ends at or within this group, overlapped */
+        return NULL;
+      }
 
-      if (is_raw_group(gn)) {
-        gn->sub_id_cnt++;
-        gn->sub_id[0] = *oid++;
-        if (--id_len == 0) {
-          /* Allocate new instance node */
-          node = gn->sub_ptr[0] = mib_instance_node_new(callback);
-          return (struct mib_instance_node *)node;
+      if (m < gn->prefix_len) {
+        /* oid leaves the prefix at m, split the group node there */
+        branch = mib_tree_branch_new(oid + m + 1, id_len - m - 1, callback, &in);
+        split = mib_group_node_new(group_prefix(gn), m, 2);
+        sub_id = group_prefix(gn)[m];
+        gn = group_node_rebuild(gn, group_prefix(gn) + m + 1, gn->prefix_len - m - 1, gn->sub_id_cap, gn->sub_id_cnt, 0);
+        if (oid[m] < sub_id) {
+          group_sub_id(split)[0] = oid[m];
+          group_sub_ptr(split)[0] = branch;
+          group_sub_id(split)[1] = sub_id;
+          group_sub_ptr(split)[1] = gn;
         } else {
-          /* Allocate new group node */
-          node = gn->sub_ptr[0] = mib_group_node_new();
+          group_sub_id(split)[0] = sub_id;
+          group_sub_ptr(split)[0] = gn;
+          group_sub_id(split)[1] = oid[m];
+          group_sub_ptr(split)[1] = branch;
         }
+        split->sub_id_cnt = 2;
+        *slot = split;
+        return in;
+      }
+
+      /* Search in exist sub-ids */
+      oid += m;
+      id_len -= m;
+      int i = oid_search(group_sub_id(gn), gn->sub_id_cnt, *oid);
+      if (i >= 0) {
+        /* Sub-id found, go on traversing */
+        oid++;
+        id_len--;
+        slot = (struct mib_group_node **)&group_sub_ptr(gn)[i];
+        node = *(struct mib_node **)slot;
       } else {
-        /* Search in exist sub-ids */
-        int i = oid_binary_search(gn->sub_id, gn->sub_id_cnt, *oid);
-        if (i >= 0) {
-          /* Sub-id found, go on traversing */
-          oid++;
-          id_len--;
-          node = gn->sub_ptr[i];
-        } else {
-          /* Sub-id not found, that's it. */
-          i = -i - 1;
-          /* resize sub_id[] */
-          group_node_expand(gn, i);
-          gn->sub_id_cnt++;
-          gn->sub_id[i] = *oid++;
-          if (--id_len == 0) {
-            /* Allocate new instance node */
-            node = gn->sub_ptr[i] = mib_instance_node_new(callback);
-            return (struct mib_instance_node *)node;
-          } else {
-            /* Allocate new group node */
-            node = gn->sub_ptr[i] = mib_group_node_new();
-          }
-        }
+        /* Sub-id not found, that's it. */
+        branch = mib_tree_branch_new(oid + 1, id_len - 1, callback, &in);
+        group_node_insert(slot, -i - 1, *oid, branch);
+        return in;
       }
       continue;
 
@@ -819,9 +1248,6 @@ mib_tree_instance_insert(const oid_t *oid, uint32_t id_len, int callback)
       assert(0);
     }
   }
-
-  /* Bad traversal */
-  return NULL;
 }
 
 /* Register one instance node in mib-tree according to given oid with lua callback. */
@@ -855,6 +1281,128 @@ mib_node_reg(const oid_t *oid, uint32_t len, int callback)
     SMARTSNMP_LOG(L_WARNING, "fail, node already exists or oid overlaps.\n");
     return -1;
   }
+  mib_tree_serial++;
+  mib_cache_flush(NULL, 0);
+
+  return 0;
+}
+
+/* Attach a table indexed in C to the registered group node, the table
+ * is owned by the group node from now on. */
+int
+mib_table_reg(const oid_t *oid, uint32_t len, struct mib_table *table)
+{
+  struct node_pair pair;
+  struct mib_node *node;
+  struct mib_instance_node *in;
+  struct mib_table **pt;
+
+  assert(oid != NULL && table != NULL);
+
+  mib_tree_init_check();
+
+  node = mib_tree_node_search(oid, len, &pair);
+  if (node == NULL || node->type != MIB_OBJ_INSTANCE) {
+    SMARTSNMP_LOG(L_WARNING, "Table %d is not in a registered group node\n", table->table_no);
+    mib_table_delete(table);
+    return -1;
+  }
+
+  /* Keep tables sorted by table_no, a table registered again replaces the old one */
+  in = (struct mib_instance_node *)node;
+  for (pt = &in->tables; *pt != NULL && (*pt)->table_no < table->table_no; pt = &(*pt)->next);
+  if (*pt != NULL && (*pt)->table_no == table->table_no) {
+    struct mib_table *old = *pt;
+    table->next = old->next;
+    mib_table_delete(old);
+  } else {
+    table->next = *pt;
+  }
+  *pt = table;
+  mib_tree_serial++;
+  mib_cache_flush(NULL, 0);
+
+  return 0;
+}
+
+/* Attach a batch handler to the registered group node, see
+ * mib_instance_search_batch(). */
+int
+mib_batch_reg(const oid_t *oid, uint32_t len, int callback)
+{
+  struct node_pair pair;
+  struct mib_node *node;
+  struct mib_instance_node *in;
+  lua_State *L = mib_lua_state;
+
+  assert(oid != NULL);
+
+  mib_tree_init_check();
+
+  node = mib_tree_node_search(oid, len, &pair);
+  if (node == NULL || node->type != MIB_OBJ_INSTANCE) {
+    SMARTSNMP_LOG(L_WARNING, "Batch handler is not in a registered group node\n");
+    luaL_unref(L, LUA_ENVIRONINDEX, callback);
+    return -1;
+  }
+
+  in = (struct mib_instance_node *)node;
+  luaL_unref(L, LUA_ENVIRONINDEX, in->batch_callback);
+  in->batch_callback = callback;
+
+  return 0;
+}
+
+/* Serve the registered group node by a handler in C instead of Lua */
+int
+mib_native_reg(const oid_t *oid, uint32_t len, mib_native_handler handler, void *ctx)
+{
+  struct node_pair pair;
+  struct mib_node *node;
+  struct mib_instance_node *in;
+
+  assert(oid != NULL && handler != NULL);
+
+  mib_tree_init_check();
+
+  node = mib_tree_node_search(oid, len, &pair);
+  if (node == NULL || node->type != MIB_OBJ_INSTANCE) {
+    SMARTSNMP_LOG(L_WARNING, "Native handler is not in a registered group node\n");
+    return -1;
+  }
+
+  in = (struct mib_instance_node *)node;
+  in->native = handler;
+  in->ctx = ctx;
+
+  return 0;
+}
+
+/* Cache GET and GETNEXT results of the registered group node for ttl
+ * milliseconds, 0 stops caching. */
+int
+mib_cache_reg(const oid_t *oid, uint32_t len, uint32_t ttl)
+{
+  struct node_pair pair;
+  struct mib_node *node;
+  struct mib_instance_node *in;
+
+  assert(oid != NULL);
+
+  mib_tree_init_check();
+
+  node = mib_tree_node_search(oid, len, &pair);
+  if (node == NULL || node->type != MIB_OBJ_INSTANCE) {
+    SMARTSNMP_LOG(L_WARNING, "Cached group is not a registered group node\n");
+    return -1;
+  }
+
+  if (ttl > 0) {
+    mib_cache_setup();
+  }
+  in = (struct mib_instance_node *)node;
+  in->cache_ttl = ttl;
+  mib_cache_flush(oid, len);
 
   return 0;
 }
@@ -868,22 +1416,12 @@ mib_node_unreg(const oid_t *oid, uint32_t len)
   mib_tree_delete(oid, len);
 }
 
-/* Init dummy root node */
-static void
-mib_dummy_node_init(void)
-{
-  mib_dummy_node.type = MIB_OBJ_GROUP;
-  mib_dummy_node.sub_id_cap = 1;
-  mib_dummy_node.sub_id_cnt = 0;
-  mib_dummy_node.sub_id = xmalloc(sizeof(oid_t));
-  mib_dummy_node.sub_id[0] = 0;
-  mib_dummy_node.sub_ptr = xmalloc(sizeof(void *));
-  mib_dummy_node.sub_ptr[0] = NULL;
-}
-
 void
 mib_init(lua_State *L)
 {
   mib_lua_state = L;
-  mib_dummy_node_init();
+  mib_async_init(L);
+  if (mib_root == NULL) {
+    mib_root = mib_group_node_new(NULL, 0, 1);
+  }
 }
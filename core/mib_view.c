@@ -310,32 +310,76 @@ mib_user_create(const char *user, uint8_t auth_mode, const char *auth_phrase, ui
     if (auth_mode == SNMP_USER_AUTH_MD5) {
 #ifndef DISABLE_MD5
       MD5_key(password, strlen(auth_phrase), engine_id, sizeof(snmpv3_engine_id), u->auth_key.md5);
+      MD5_hmac_ctx_init(u->auth_ctx.md5, u->auth_key.md5, sizeof(u->auth_key.md5));
 #endif
     } else if (auth_mode == SNMP_USER_AUTH_SHA1) {
 #ifndef DISABLE_SHA
       SHA1_key(password, strlen(auth_phrase), engine_id, sizeof(snmpv3_engine_id), u->auth_key.sha1);
+      SHA1_hmac_ctx_init(u->auth_ctx.sha1, u->auth_key.sha1, sizeof(u->auth_key.sha1));
+#endif
+    } else if (auth_mode == SNMP_USER_AUTH_SHA256) {
+#ifndef DISABLE_SHA
+      SHA256_key(password, strlen(auth_phrase), engine_id, sizeof(snmpv3_engine_id), u->auth_key.sha256);
+      SHA256_hmac_ctx_init(u->auth_ctx.sha256, u->auth_key.sha256, sizeof(u->auth_key.sha256));
+#endif
+    } else if (auth_mode == SNMP_USER_AUTH_SHA512) {
+#ifndef DISABLE_SHA
+      SHA512_key(password, strlen(auth_phrase), engine_id, sizeof(snmpv3_engine_id), u->auth_key.sha512);
+      SHA512_hmac_ctx_init(u->auth_ctx.sha512, u->auth_key.sha512, sizeof(u->auth_key.sha512));
 #endif
     }
 
     /* Generate and localize privacy key for encryption */
     if (strlen(priv_phrase)) {
-      uint8_t secret_key[SHA1_SECRETKEYLEN];
+      uint8_t secret_key[SHA512_SECRETKEYLEN];
+      uint32_t key_len, len;
       password = (const uint8_t *)priv_phrase;
       engine_id = (const uint8_t *)snmpv3_engine_id;
 
+      if (priv_mode == SNMP_USER_ENCRYPT_AES256) {
+        key_len = AES256_SECRETKEYLEN;
+      } else if (priv_mode == SNMP_USER_ENCRYPT_AES192) {
+        key_len = AES192_SECRETKEYLEN;
+      } else {
+        key_len = AES_SECRETKEYLEN;
+      }
+
+      /* Localized keys of MD5 and SHA-1 are too short for AES-192/256 and
+       * get extended as Kul = Kul || H(Kul) (draft-blumenthal-aes-usm-04) */
       if (auth_mode == SNMP_USER_AUTH_MD5) {
 #ifndef DISABLE_MD5
+        MD5_CTX ctx;
         MD5_key(password, strlen(priv_phrase), engine_id, sizeof(snmpv3_engine_id), secret_key);
+        for (len = MD5_SECRETKEYLEN; len < key_len; len += MD5_SECRETKEYLEN) {
+          MD5_Init(&ctx);
+          MD5_Update(&ctx, secret_key, len);
+          MD5_Final(secret_key + len, &ctx);
+        }
 #endif
       } else if (auth_mode == SNMP_USER_AUTH_SHA1) {
 #ifndef DISABLE_SHA
+        SHA_CTX ctx;
         SHA1_key(password, strlen(priv_phrase), engine_id, sizeof(snmpv3_engine_id), secret_key);
+        for (len = SHA1_SECRETKEYLEN; len < key_len; len += SHA1_SECRETKEYLEN) {
+          SHA1_Init(&ctx);
+          SHA1_Update(&ctx, secret_key, len);
+          SHA1_Final(secret_key + len, &ctx);
+        }
+#endif
+      } else if (auth_mode == SNMP_USER_AUTH_SHA256) {
+#ifndef DISABLE_SHA
+        SHA256_key(password, strlen(priv_phrase), engine_id, sizeof(snmpv3_engine_id), secret_key);
+#endif
+      } else if (auth_mode == SNMP_USER_AUTH_SHA512) {
+#ifndef DISABLE_SHA
+        SHA512_key(password, strlen(priv_phrase), engine_id, sizeof(snmpv3_engine_id), secret_key);
 #endif
       }
 
       u->priv_mode = priv_mode;
 #ifndef DISABLE_AES
-      memcpy(u->priv_key.aes, secret_key, AES_SECRETKEYLEN);
+      /* Round keys are expanded once here rather than for every message */
+      AES_set_encrypt_key(secret_key, key_len * 8, &u->priv_sched);
 #endif
     }
   }
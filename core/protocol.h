@@ -24,10 +24,21 @@
 
 #include <stdint.h>
 #include "asn1.h" 
+#include "mib.h"
 #include "lua.h"
 #include "lualib.h"
 #include "lauxlib.h"
 
+#define PROT_MAX_REPETITIONS  (128)
+
+/* Protocol tunables, filled in before init */
+struct protocol_config {
+  /* Cap of GETBULK max-repetitions, 0 means PROT_MAX_REPETITIONS */
+  int max_repetitions;
+  /* Response size limit, 0 means SNMP_MSG_MAX_SIZ */
+  int max_msg_size;
+};
+
 struct protocol_operation {
   const char *name;
   int (*init)(int port);
@@ -44,5 +55,10 @@ struct protocol_operation {
 extern struct protocol_operation snmp_prot_ops;
 extern struct protocol_operation agentx_prot_ops;
 extern struct protocol_operation *smithsnmp_prot_ops;
+extern struct protocol_config prot_config;
+
+/* Group nodes served in C, registered through the running protocol */
+int smithsnmp_native_reg(const oid_t *grp_id, int id_len, mib_native_handler handler, void *ctx);
+int smithsnmp_native_unreg(const oid_t *grp_id, int id_len);
 
 #endif /* _PROTOCOL_H_ */
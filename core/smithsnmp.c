@@ -23,16 +23,22 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <dlfcn.h>
 
 #include "mib.h"
 #include "protocol.h"
+#include "transport.h"
+#include "event_loop.h"
 #ifndef DISABLE_TRAP
 #include "trap.h"
 #endif
 #include "utils.h"
 
 struct protocol_operation *smithsnmp_prot_ops;
+struct protocol_config prot_config;
 struct trap_operation *smithsnmp_trap_ops;
+struct transport_config transp_config;
+struct transport_stats transp_stats;
 
 int
 smithsnmp_init(lua_State *L)
@@ -41,6 +47,37 @@ smithsnmp_init(lua_State *L)
   const char *protocol = luaL_checkstring(L, 1);
   int port = luaL_checkint(L, 2);
 
+  /* Transport and protocol options */
+  memset(&transp_config, 0, sizeof(transp_config));
+  memset(&prot_config, 0, sizeof(prot_config));
+  if (lua_istable(L, 3)) {
+    lua_getfield(L, 3, "batch");
+    transp_config.batch = luaL_optint(L, -1, 0);
+    lua_pop(L, 1);
+    lua_getfield(L, 3, "queue");
+    transp_config.queue_depth = luaL_optint(L, -1, 0);
+    lua_pop(L, 1);
+    lua_getfield(L, 3, "queue_policy");
+    if (!strcmp(luaL_optstring(L, -1, "drop-oldest"), "backpressure")) {
+      transp_config.queue_policy = TRANSP_QUEUE_BACKPRESSURE;
+    } else {
+      transp_config.queue_policy = TRANSP_QUEUE_DROP_OLDEST;
+    }
+    lua_pop(L, 1);
+    lua_getfield(L, 3, "workers");
+    transp_config.workers = luaL_optint(L, -1, 0);
+    lua_pop(L, 1);
+    lua_getfield(L, 3, "max_repetitions");
+    prot_config.max_repetitions = luaL_optint(L, -1, 0);
+    lua_pop(L, 1);
+    lua_getfield(L, 3, "max_msg_size");
+    prot_config.max_msg_size = luaL_optint(L, -1, 0);
+    lua_pop(L, 1);
+    lua_getfield(L, 3, "cache_size");
+    mib_cache_init(luaL_optint(L, -1, 0));
+    lua_pop(L, 1);
+  }
+
   /* Init mib tree */
   mib_init(L);
 
@@ -108,6 +145,124 @@ smithsnmp_exit(lua_State *L)
   return 0;
 }
 
+/* Outbound queue counters as a table */
+int
+smithsnmp_transport_stats(lua_State *L)
+{
+  lua_newtable(L);
+  lua_pushnumber(L, transp_stats.enqueued);
+  lua_setfield(L, -2, "enqueued");
+  lua_pushnumber(L, transp_stats.sent);
+  lua_setfield(L, -2, "sent");
+  lua_pushnumber(L, transp_stats.dropped);
+  lua_setfield(L, -2, "dropped");
+  lua_pushnumber(L, transp_stats.send_errors);
+  lua_setfield(L, -2, "send_errors");
+  lua_pushnumber(L, transp_stats.max_depth);
+  lua_setfield(L, -2, "max_depth");
+  lua_pushnumber(L, transp_stats.paused);
+  lua_setfield(L, -2, "paused");
+  return 1;
+}
+
+/* Lua function scheduled in the event loop */
+struct smithsnmp_timer {
+  lua_State *L;
+  int id;
+  int ref;
+  long interval;
+};
+
+static void
+smithsnmp_timer_handler(void *ud)
+{
+  struct smithsnmp_timer *t = ud;
+  lua_State *L = t->L;
+
+  lua_rawgeti(L, LUA_ENVIRONINDEX, t->ref);
+  if (t->interval == 0) {
+    /* One-shot, released before the call so that it cannot be cancelled
+     * again from inside */
+    snmp_timer_remove(t->id, smithsnmp_timer_handler);
+    luaL_unref(L, LUA_ENVIRONINDEX, t->ref);
+    free(t);
+  }
+  if (lua_pcall(L, 0, 0, 0) != 0) {
+    SMARTSNMP_LOG(L_ERROR, "Timer handler fail: %s\n", lua_tostring(L, -1));
+    lua_pop(L, 1);
+  }
+}
+
+/* Schedule a Lua function after delay milliseconds, repeated every
+ * interval milliseconds if interval is positive. Return the timer id. */
+int
+smithsnmp_timer_add(lua_State *L)
+{
+  struct smithsnmp_timer *t;
+  long delay = luaL_checkinteger(L, 1);
+  long interval = luaL_optinteger(L, 2, 0);
+
+  luaL_checktype(L, 3, LUA_TFUNCTION);
+  lua_settop(L, 3);
+
+  t = xmalloc(sizeof(*t));
+  /* L may be the thread of a parked request, which is gone when this fires */
+  t->L = mib_lua_state;
+  t->interval = interval > 0 ? interval : 0;
+  t->ref = luaL_ref(L, LUA_ENVIRONINDEX);
+  t->id = snmp_timer_add(delay, t->interval, smithsnmp_timer_handler, t);
+  if (t->id < 0) {
+    luaL_unref(L, LUA_ENVIRONINDEX, t->ref);
+    free(t);
+    lua_pushnil(L);
+  } else {
+    lua_pushinteger(L, t->id);
+  }
+
+  return 1;
+}
+
+/* Cancel a timer by id, only timers scheduled from Lua are touched */
+int
+smithsnmp_timer_del(lua_State *L)
+{
+  struct smithsnmp_timer *t = snmp_timer_remove(luaL_checkint(L, 1), smithsnmp_timer_handler);
+
+  if (t != NULL) {
+    luaL_unref(L, LUA_ENVIRONINDEX, t->ref);
+    free(t);
+  }
+
+  return 0;
+}
+
+/* Descriptor of a file opened by io.open or io.popen, numbers are passed
+ * through: fileno(file) */
+int
+smithsnmp_fileno(lua_State *L)
+{
+  FILE **f;
+
+  if (lua_isnumber(L, 1)) {
+    lua_pushinteger(L, lua_tointeger(L, 1));
+    return 1;
+  }
+  f = luaL_checkudata(L, 1, LUA_FILEHANDLE);
+  luaL_argcheck(L, *f != NULL, 1, "closed file");
+  lua_pushinteger(L, fileno(*f));
+  return 1;
+}
+
+/* Wait in place until fd is ready or timeout milliseconds pass, for code
+ * running outside of a handler: wait(op, fd, timeout) */
+int
+smithsnmp_wait(lua_State *L)
+{
+  luaL_checkstring(L, 1);
+  lua_pushboolean(L, mib_async_block(L, 1));
+  return 1;
+}
+
 /* Register mib nodes from Lua */
 int
 smithsnmp_mib_node_reg(lua_State *L)
@@ -170,6 +325,314 @@ smithsnmp_mib_node_unreg(lua_State *L)
   return 1;
 }
 
+/* Register a group node served by a handler in C */
+int
+smithsnmp_native_reg(const oid_t *grp_id, int id_len, mib_native_handler handler, void *ctx)
+{
+  if (smithsnmp_prot_ops->reg(grp_id, id_len, LUA_NOREF) < 0) {
+    return -1;
+  }
+  if (mib_native_reg(grp_id, id_len, handler, ctx) < 0) {
+    /* Do not leave a group without a handler behind */
+    smithsnmp_prot_ops->unreg(grp_id, id_len);
+    return -1;
+  }
+  return 0;
+}
+
+/* Unregister a group node served by a handler in C */
+int
+smithsnmp_native_unreg(const oid_t *grp_id, int id_len)
+{
+  return smithsnmp_prot_ops->unreg(grp_id, id_len);
+}
+
+static const struct mib_plugin_api smithsnmp_plugin_api = {
+  smithsnmp_native_reg,
+  smithsnmp_native_unreg,
+};
+
+/* Load a C plugin from Lua: plugin_load(path). The plugin is never
+ * unloaded since the tree keeps pointers to its handlers. */
+int
+smithsnmp_plugin_load(lua_State *L)
+{
+  const char *path = luaL_checkstring(L, 1);
+  void *handle;
+  mib_plugin_init init;
+  int ret = -1;
+
+  handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (handle == NULL) {
+    SMARTSNMP_LOG(L_ERROR, "Load plugin %s failure: %s\n", path, dlerror());
+  } else {
+    init = (mib_plugin_init)dlsym(handle, MIB_PLUGIN_INIT);
+    if (init == NULL) {
+      SMARTSNMP_LOG(L_ERROR, "Plugin %s has no %s()\n", path, MIB_PLUGIN_INIT);
+      dlclose(handle);
+    } else {
+      ret = init(&smithsnmp_plugin_api);
+    }
+  }
+
+  /* Return value */
+  lua_pushnumber(L, ret);
+  return 1;
+}
+
+/* Serve a group node from a shared memory counter segment from Lua:
+ * mib_shm_reg(group_oid, path). Loading a segment again replaces the old one. */
+int
+smithsnmp_mib_shm_reg(lua_State *L)
+{
+  oid_t grp_id[ASN1_OID_MAX_LEN];
+  int i, grp_id_len;
+  const char *path;
+  struct mib_shm *shm;
+
+  luaL_checktype(L, 1, LUA_TTABLE);
+  path = luaL_checkstring(L, 2);
+  grp_id_len = lua_objlen(L, 1);
+  luaL_argcheck(L, grp_id_len > 0 && grp_id_len <= ASN1_OID_MAX_LEN, 1, "invalid oid length");
+  for (i = 0; i < grp_id_len; i++) {
+    lua_rawgeti(L, 1, i + 1);
+    grp_id[i] = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+  }
+
+  shm = mib_shm_find(grp_id, grp_id_len);
+  if (shm != NULL) {
+    smithsnmp_native_unreg(grp_id, grp_id_len);
+    mib_shm_close(shm);
+  }
+
+  i = -1;
+  shm = mib_shm_open(grp_id, grp_id_len, path);
+  if (shm != NULL) {
+    i = smithsnmp_native_reg(grp_id, grp_id_len, mib_shm_search, shm);
+    if (i < 0) {
+      mib_shm_close(shm);
+    }
+  }
+
+  /* Return value */
+  lua_pushnumber(L, i);
+  return 1;
+}
+
+/* Unregister a group node served from a counter segment from Lua */
+int
+smithsnmp_mib_shm_unreg(lua_State *L)
+{
+  oid_t grp_id[ASN1_OID_MAX_LEN];
+  int i, grp_id_len;
+  struct mib_shm *shm;
+
+  luaL_checktype(L, 1, LUA_TTABLE);
+  grp_id_len = lua_objlen(L, 1);
+  luaL_argcheck(L, grp_id_len > 0 && grp_id_len <= ASN1_OID_MAX_LEN, 1, "invalid oid length");
+  for (i = 0; i < grp_id_len; i++) {
+    lua_rawgeti(L, 1, i + 1);
+    grp_id[i] = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+  }
+
+  i = -1;
+  shm = mib_shm_find(grp_id, grp_id_len);
+  if (shm != NULL) {
+    i = smithsnmp_native_unreg(grp_id, grp_id_len);
+    mib_shm_close(shm);
+  }
+
+  /* Return value */
+  lua_pushnumber(L, i);
+  return 1;
+}
+
+#define MIB_INDEX_META  "smithsnmp.mib_index"
+
+/* Row key from Lua, either an id number or an oid array */
+static uint32_t
+smithsnmp_row_key(lua_State *L, int narg, oid_t *id)
+{
+  uint32_t i, id_len;
+
+  if (lua_type(L, narg) == LUA_TNUMBER) {
+    id[0] = lua_tointeger(L, narg);
+    return 1;
+  }
+
+  luaL_checktype(L, narg, LUA_TTABLE);
+  id_len = lua_objlen(L, narg);
+  luaL_argcheck(L, id_len > 0 && id_len <= ASN1_OID_MAX_LEN, narg, "invalid row key length");
+  for (i = 0; i < id_len; i++) {
+    lua_rawgeti(L, narg, i + 1);
+    id[i] = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+  }
+  return id_len;
+}
+
+/* Create a row index for a table from Lua */
+int
+smithsnmp_mib_index_new(lua_State *L)
+{
+  struct mib_index *idx = lua_newuserdata(L, sizeof(*idx));
+  mib_index_init(idx);
+  luaL_getmetatable(L, MIB_INDEX_META);
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+/* Insert a row into the index, return false if it exists already */
+static int
+smithsnmp_mib_index_insert(lua_State *L)
+{
+  oid_t id[ASN1_OID_MAX_LEN];
+  struct mib_index *idx = luaL_checkudata(L, 1, MIB_INDEX_META);
+  uint32_t id_len = smithsnmp_row_key(L, 2, id);
+
+  lua_pushboolean(L, mib_index_insert(idx, id, id_len));
+  return 1;
+}
+
+/* Delete a row from the index, return false if not found */
+static int
+smithsnmp_mib_index_delete(lua_State *L)
+{
+  oid_t id[ASN1_OID_MAX_LEN];
+  struct mib_index *idx = luaL_checkudata(L, 1, MIB_INDEX_META);
+  uint32_t id_len = smithsnmp_row_key(L, 2, id);
+
+  lua_pushboolean(L, mib_index_delete(idx, id, id_len));
+  return 1;
+}
+
+static int
+smithsnmp_mib_index_len(lua_State *L)
+{
+  struct mib_index *idx = luaL_checkudata(L, 1, MIB_INDEX_META);
+  lua_pushinteger(L, idx->row_cnt);
+  return 1;
+}
+
+static int
+smithsnmp_mib_index_gc(lua_State *L)
+{
+  struct mib_index *idx = luaL_checkudata(L, 1, MIB_INDEX_META);
+  mib_index_free(idx);
+  return 0;
+}
+
+static const luaL_Reg smithsnmp_mib_index_meta[] = {
+  { "insert", smithsnmp_mib_index_insert },
+  { "delete", smithsnmp_mib_index_delete },
+  { "__len", smithsnmp_mib_index_len },
+  { "__gc", smithsnmp_mib_index_gc },
+  { NULL, NULL }
+};
+
+/* Attach a table indexed in C to a registered group node from Lua:
+ * mib_table_reg(group_oid, table_no, entry_no, columns, index) */
+int
+smithsnmp_mib_table_reg(lua_State *L)
+{
+  oid_t *grp_id;
+  int i, grp_id_len;
+  struct mib_table *table;
+
+  luaL_checktype(L, 1, LUA_TTABLE);
+  luaL_checktype(L, 4, LUA_TTABLE);
+  luaL_checkudata(L, 5, MIB_INDEX_META);
+
+  table = xmalloc(sizeof(*table));
+  table->next = NULL;
+  table->table_no = luaL_checkint(L, 2);
+  table->entry_no = luaL_checkint(L, 3);
+  table->column_cnt = lua_objlen(L, 4);
+  table->columns = xmalloc((table->column_cnt ? table->column_cnt : 1) * sizeof(oid_t));
+  for (i = 0; i < table->column_cnt; i++) {
+    lua_rawgeti(L, 4, i + 1);
+    table->columns[i] = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+  }
+  table->index = lua_touserdata(L, 5);
+  lua_pushvalue(L, 5);
+  table->index_ref = luaL_ref(L, LUA_ENVIRONINDEX);
+
+  /* Get oid */
+  grp_id_len = lua_objlen(L, 1);
+  grp_id = xmalloc((grp_id_len ? grp_id_len : 1) * sizeof(oid_t));
+  for (i = 0; i < grp_id_len; i++) {
+    lua_rawgeti(L, 1, i + 1);
+    grp_id[i] = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+  }
+
+  i = mib_table_reg(grp_id, grp_id_len, table);
+  free(grp_id);
+
+  /* Return value */
+  lua_pushnumber(L, i);
+  return 1;
+}
+
+/* Attach a batch handler to a registered group node from Lua:
+ * mib_batch_reg(group_oid, handler) */
+int
+smithsnmp_mib_batch_reg(lua_State *L)
+{
+  oid_t *grp_id;
+  int i, grp_id_len, batch_cb;
+
+  luaL_checktype(L, 1, LUA_TTABLE);
+  luaL_checktype(L, 2, LUA_TFUNCTION);
+  lua_settop(L, 2);
+  batch_cb = luaL_ref(L, LUA_ENVIRONINDEX);
+
+  /* Get oid */
+  grp_id_len = lua_objlen(L, 1);
+  grp_id = xmalloc((grp_id_len ? grp_id_len : 1) * sizeof(oid_t));
+  for (i = 0; i < grp_id_len; i++) {
+    lua_rawgeti(L, 1, i + 1);
+    grp_id[i] = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+  }
+
+  i = mib_batch_reg(grp_id, grp_id_len, batch_cb);
+  free(grp_id);
+
+  /* Return value */
+  lua_pushnumber(L, i);
+  return 1;
+}
+
+/* Cache the results of a registered group node from Lua:
+ * mib_cache_reg(group_oid, ttl) */
+int
+smithsnmp_mib_cache_reg(lua_State *L)
+{
+  oid_t grp_id[ASN1_OID_MAX_LEN];
+  int i, grp_id_len, ttl;
+
+  luaL_checktype(L, 1, LUA_TTABLE);
+  ttl = luaL_checkint(L, 2);
+  luaL_argcheck(L, ttl >= 0, 2, "negative ttl");
+  grp_id_len = lua_objlen(L, 1);
+  luaL_argcheck(L, grp_id_len > 0 && grp_id_len <= ASN1_OID_MAX_LEN, 1, "invalid oid length");
+  for (i = 0; i < grp_id_len; i++) {
+    lua_rawgeti(L, 1, i + 1);
+    grp_id[i] = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+  }
+
+  i = mib_cache_reg(grp_id, grp_id_len, ttl);
+
+  /* Return value */
+  lua_pushnumber(L, i);
+  return 1;
+}
+
 /* Register community string from Lua */
 int
 smithsnmp_mib_community_reg(lua_State *L)
@@ -449,8 +912,20 @@ static const luaL_Reg smithsnmp_func[] = {
   { "run", smithsnmp_run },
   { "step", smithsnmp_step },
   { "exit", smithsnmp_exit },
+  { "transport_stats", smithsnmp_transport_stats },
+  { "timer_add", smithsnmp_timer_add },
+  { "timer_del", smithsnmp_timer_del },
+  { "fileno", smithsnmp_fileno },
+  { "wait", smithsnmp_wait },
   { "mib_node_reg", smithsnmp_mib_node_reg },
   { "mib_node_unreg", smithsnmp_mib_node_unreg },
+  { "mib_index_new", smithsnmp_mib_index_new },
+  { "mib_table_reg", smithsnmp_mib_table_reg },
+  { "mib_batch_reg", smithsnmp_mib_batch_reg },
+  { "mib_cache_reg", smithsnmp_mib_cache_reg },
+  { "plugin_load", smithsnmp_plugin_load },
+  { "mib_shm_reg", smithsnmp_mib_shm_reg },
+  { "mib_shm_unreg", smithsnmp_mib_shm_unreg },
   { "mib_community_reg", smithsnmp_mib_community_reg },
   { "mib_community_unreg", smithsnmp_mib_community_unreg },
   { "mib_user_create", smithsnmp_mib_user_create },
@@ -474,6 +949,13 @@ luaopen_smithsnmp_core(lua_State *L)
   lua_newtable(L);
   lua_replace(L, LUA_ENVIRONINDEX);
 
+  /* Metatable of row index userdata, methods are looked up in itself */
+  luaL_newmetatable(L, MIB_INDEX_META);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  luaL_register(L, NULL, smithsnmp_mib_index_meta);
+  lua_pop(L, 1);
+
   /* Register smithsnmp_func into lua */
   luaL_register(L, "smithsnmp_lib", smithsnmp_func);
 
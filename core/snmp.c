@@ -70,7 +70,6 @@ static int
 snmpd_init(int port)
 {
   INIT_LIST_HEAD(&snmp_datagram.vb_in_list);
-  INIT_LIST_HEAD(&snmp_datagram.vb_out_list);
   return snmp_transp_ops.init(port);
 }
 
@@ -85,6 +84,7 @@ static int
 snmpd_close(void)
 {
   snmp_transp_ops.close();
+  arena_free(&snmp_datagram.arena);
   return 0;
 }
 
@@ -22,17 +22,39 @@
 #ifndef _SNMP_H_
 #define _SNMP_H_
 
+#include "arena.h"
 #include "asn1.h"
 #include "list.h"
 #include "utils.h"
+#include "../3rd/crypto/openssl_md5.h"
+#include "../3rd/crypto/openssl_sha.h"
+#include "../3rd/crypto/openssl_aes.h"
 
 #define MD5_HASHKEYLEN     64
 #define MD5_SECRETKEYLEN   16
 #define SHA1_HASHKEYLEN    64
 #define SHA1_SECRETKEYLEN  20
+#define SHA256_HASHKEYLEN    64
+#define SHA256_SECRETKEYLEN  32
+#define SHA512_HASHKEYLEN    128
+#define SHA512_SECRETKEYLEN  64
 #define AES_SECRETKEYLEN   16
-
-#define SNMP_MSG_AUTH_PARA_LEN     12
+#define AES192_SECRETKEYLEN  24
+#define AES256_SECRETKEYLEN  32
+
+/* Largest UDP payload over IPv4 */
+#define SNMP_MSG_MAX_SIZ  (65507)
+/* Room in front of the varbind list for the message header */
+#define SNMP_MSG_HEAD_ROOM  (512)
+/* Widest varbind: headers, the longest oid and the longest value */
+#define SNMP_VB_MAX_SIZ  (16 + ASN1_OID_MAX_LEN * 5 + ASN1_VALUE_MAX_LEN)
+
+/* MAC lengths of HMAC-96 (MD5, SHA-1), HMAC-192-SHA-256 and
+ * HMAC-384-SHA-512 */
+#define SNMP_MSG_AUTH_PARA_LEN         12
+#define SNMP_MSG_AUTH_PARA_SHA256_LEN  24
+#define SNMP_MSG_AUTH_PARA_SHA512_LEN  48
+#define SNMP_MSG_AUTH_PARA_MAX_LEN     SNMP_MSG_AUTH_PARA_SHA512_LEN
 #define SNMP_MSG_ENCRYPT_PARA_LEN  8
 
 #define SNMP_SECUR_FLAG_AUTH     0x1
@@ -42,11 +64,15 @@
 typedef enum snmp_user_auth_mode {
   SNMP_USER_AUTH_MD5,
   SNMP_USER_AUTH_SHA1 = 1,
+  SNMP_USER_AUTH_SHA256 = 2,
+  SNMP_USER_AUTH_SHA512 = 3,
 } SNMP_USER_AUTH_MODE_E;
 
 /* User encryption mode */
 typedef enum snmp_user_encrypt_mode {
   SNMP_USER_ENCRYPT_AES = 1,
+  SNMP_USER_ENCRYPT_AES192 = 2,
+  SNMP_USER_ENCRYPT_AES256 = 3,
 } SNMP_USER_ENCRYPT_MODE_E;
 
 /* Error status */
@@ -187,7 +213,7 @@ struct snmp_datagram {
   uint32_t user_name_len;
   struct mib_user *user;
   uint8_t auth_err;
-  uint8_t auth_para[SNMP_MSG_AUTH_PARA_LEN];
+  uint8_t auth_para[SNMP_MSG_AUTH_PARA_MAX_LEN];
   uint32_t auth_para_len;
   uint8_t priv_para[SNMP_MSG_ENCRYPT_PARA_LEN];
   uint32_t priv_para_len;
@@ -205,7 +231,13 @@ struct snmp_datagram {
   uint32_t vb_in_cnt;
   uint32_t vb_out_cnt;
   struct list_head vb_in_list;
-  struct list_head vb_out_list;
+  /* Encoded response varbinds in [vb_list, vb_end), see snmp_response_init() */
+  uint8_t *vb_list;
+  uint8_t *vb_end;
+  uint8_t *rsp_end;
+  uint32_t vb_list_max;
+  /* Varbinds, oids and buffers of the current datagram */
+  struct arena arena;
 };
 
 extern struct snmp_datagram snmp_datagram;
@@ -219,6 +251,15 @@ vb_new(uint32_t oid_len, uint32_t val_len)
   return vb;
 }
 
+/* Varbind living in the datagram arena, released at the next datagram */
+static inline struct var_bind *
+vb_arena_new(struct arena *arena, uint32_t oid_len, uint32_t val_len)
+{
+  struct var_bind *vb = arena_alloc(arena, sizeof(*vb) + val_len);
+  vb->oid = arena_alloc(arena, oid_len * sizeof(oid_t));
+  return vb;
+}
+
 static inline void
 vb_delete(struct var_bind *vb)
 {
@@ -242,6 +283,10 @@ uint32_t ber_value_enc_try(const void *value, uint32_t len, uint8_t type);
 uint32_t ber_value_enc(const void *value, uint32_t len, uint8_t type, uint8_t *buf);
 uint32_t ber_length_enc_try(uint32_t value);
 uint32_t ber_length_enc(uint32_t value, uint8_t *buf);
+uint8_t *ber_value_enc_rev(const void *value, uint32_t len, uint8_t type, uint8_t *buf);
+uint8_t *ber_length_enc_rev(uint32_t value, uint8_t *buf);
+uint8_t *ber_tlv_enc_rev(uint8_t type, const void *value, uint32_t len, uint8_t *buf);
+uint8_t *ber_head_enc_rev(uint8_t type, uint32_t len, uint8_t *buf);
 
 uint32_t ber_value_dec_try(const uint8_t *buf, uint32_t len, uint8_t type);
 uint32_t ber_value_dec(const uint8_t *buf, uint32_t len, uint8_t type, void *value);
@@ -252,8 +297,18 @@ void MD5_key(const unsigned char *password, unsigned int passwordlen, const unsi
 void SHA1_key(const unsigned char *password, unsigned int passwordlen, const unsigned char *engineID, unsigned int engineLength, unsigned char *key);
 int MD5_hmac(const unsigned char *data, size_t len, unsigned char *mac, size_t maclen, const unsigned char *secret, size_t secretlen);
 int SHA1_hmac(const unsigned char *data, size_t len, unsigned char *mac, size_t maclen, const unsigned char *secret, size_t secretlen);
-void AES_Encrypt(const unsigned char *key, unsigned int keylen, const unsigned char *iv, unsigned int ivlen, const unsigned char *plaintext, unsigned int ptlen, unsigned char *ciphertext, unsigned int *ctlen);
-void AES_Decrypt(const unsigned char *key, unsigned int keylen, const unsigned char *iv, unsigned int ivlen, const unsigned char *ciphertext, unsigned int ctlen, unsigned char *plaintext, unsigned int *ptlen);
+int MD5_hmac_ctx_init(MD5_CTX *ctx, const unsigned char *secret, size_t secretlen);
+int MD5_hmac_ctx(const MD5_CTX *ctx, const unsigned char *data, size_t len, unsigned char *mac, size_t maclen);
+int SHA1_hmac_ctx_init(SHA_CTX *ctx, const unsigned char *secret, size_t secretlen);
+int SHA1_hmac_ctx(const SHA_CTX *ctx, const unsigned char *data, size_t len, unsigned char *mac, size_t maclen);
+void SHA256_key(const unsigned char *password, unsigned int passwordlen, const unsigned char *engineID, unsigned int engineLength, unsigned char *key);
+void SHA512_key(const unsigned char *password, unsigned int passwordlen, const unsigned char *engineID, unsigned int engineLength, unsigned char *key);
+int SHA256_hmac_ctx_init(SHA256_CTX *ctx, const unsigned char *secret, size_t secretlen);
+int SHA256_hmac_ctx(const SHA256_CTX *ctx, const unsigned char *data, size_t len, unsigned char *mac, size_t maclen);
+int SHA512_hmac_ctx_init(SHA512_CTX *ctx, const unsigned char *secret, size_t secretlen);
+int SHA512_hmac_ctx(const SHA512_CTX *ctx, const unsigned char *data, size_t len, unsigned char *mac, size_t maclen);
+void AES_Encrypt(const AES_KEY *key, const unsigned char *iv, unsigned int ivlen, const unsigned char *plaintext, unsigned int ptlen, unsigned char *ciphertext, unsigned int *ctlen);
+void AES_Decrypt(const AES_KEY *key, const unsigned char *iv, unsigned int ivlen, const unsigned char *ciphertext, unsigned int ctlen, unsigned char *plaintext, unsigned int *ptlen);
 
 void snmp_recv(uint8_t *buf, int len);
 void snmp_get(struct snmp_datagram *sdg);
@@ -261,5 +316,7 @@ void snmp_getnext(struct snmp_datagram *sdg);
 void snmp_set(struct snmp_datagram *sdg);
 void snmp_bulkget(struct snmp_datagram *sdg);
 void snmp_response(struct snmp_datagram *sdg);
+void snmp_response_init(struct snmp_datagram *sdg);
+int snmp_response_vb_add(struct snmp_datagram *sdg, const oid_t *oid, uint32_t oid_len, uint8_t type, const Variable *var);
 
 #endif /* _SNMP_H_ */
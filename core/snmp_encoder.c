@@ -491,3 +491,159 @@ ber_length_enc(uint32_t value, uint8_t *buf)
 
   return j;
 }
+
+/*
+ * Reverse encoders fill a buffer from the end toward the start, so the
+ * length of every element is known as soon as it is closed.
+ */
+
+/* Input:  integer value, end of output
+ * Output: buffer in front of end
+ * Return: start of the encoding.
+ */
+static uint8_t *
+ber_int_enc_rev(int value, uint8_t *buf)
+{
+  uint32_t u = value;
+  const uint32_t sign = value < 0 ? 0xff000000 : 0;
+
+  for (; ;) {
+    *--buf = u & 0xff;
+    u = (u >> 8) | sign;
+    /* Stop once the rest is sign extension of the last byte */
+    if ((!sign && !u && !(*buf & 0x80)) || (sign && u == 0xffffffff && (*buf & 0x80))) {
+      break;
+    }
+  }
+
+  return buf;
+}
+
+/* Input:  unsigned integer value, end of output
+ * Output: buffer in front of end
+ * Return: start of the encoding.
+ */
+static uint8_t *
+ber_uint_enc_rev(unsigned long long value, uint8_t *buf)
+{
+  do {
+    *--buf = value & 0xff;
+    value >>= 8;
+  } while (value);
+
+  if (*buf & 0x80) {
+    *--buf = 0x0;
+  }
+
+  return buf;
+}
+
+/* Input:  oid pointer, number of elements, end of output
+ * Output: buffer in front of end
+ * Return: start of the encoding.
+ */
+static uint8_t *
+ber_oid_enc_rev(const oid_t *oid, uint32_t len, uint8_t *buf)
+{
+  uint32_t i;
+
+  if (len == 0) {
+    return buf;
+  } else if (len == 1) {
+    *--buf = oid[0];
+    return buf;
+  }
+
+  for (i = len - 1; i >= 2; i--) {
+    oid_t id = oid[i];
+    *--buf = id & 0x7f;
+    while (id >>= 7) {
+      *--buf = (id & 0x7f) | 0x80;
+    }
+  }
+  *--buf = oid[0] * 40 + oid[1];
+
+  return buf;
+}
+
+/* Input:  value pointer, number of elements, value type, end of output
+ * Output: buffer in front of end
+ * Return: start of the encoding.
+ */
+uint8_t *
+ber_value_enc_rev(const void *value, uint32_t len, uint8_t type, uint8_t *buf)
+{
+  switch (type) {
+    case ASN1_TAG_INT:
+      return ber_int_enc_rev(*(const int *)value, buf);
+    case ASN1_TAG_CNT:
+    case ASN1_TAG_GAU:
+    case ASN1_TAG_TIMETICKS:
+      return ber_uint_enc_rev(*(const unsigned int *)value, buf);
+    case ASN1_TAG_CNT64:
+      return ber_uint_enc_rev(*(const unsigned long long *)value, buf);
+    case ASN1_TAG_OBJID:
+      return ber_oid_enc_rev((const oid_t *)value, len, buf);
+    case ASN1_TAG_OCTSTR:
+    case ASN1_TAG_IPADDR:
+      buf -= len;
+      memcpy(buf, value, len);
+      return buf;
+    case ASN1_TAG_SEQ:
+    case ASN1_TAG_NUL:
+    default:
+      return buf;
+  }
+}
+
+/* Input:  length value, end of output
+ * Output: buffer in front of end
+ * Return: start of the encoding.
+ */
+uint8_t *
+ber_length_enc_rev(uint32_t value, uint8_t *buf)
+{
+  uint8_t n = 0;
+
+  if (value <= 127) {
+    *--buf = value;
+    return buf;
+  }
+
+  do {
+    *--buf = value & 0xff;
+    value >>= 8;
+    n++;
+  } while (value);
+  *--buf = 0x80 | n;
+
+  return buf;
+}
+
+/* Input:  tag, value pointer, number of elements, end of output
+ * Output: the whole TLV in front of end
+ * Return: start of the encoding.
+ */
+uint8_t *
+ber_tlv_enc_rev(uint8_t type, const void *value, uint32_t len, uint8_t *buf)
+{
+  uint8_t *end = buf;
+
+  buf = ber_value_enc_rev(value, len, type, buf);
+  buf = ber_length_enc_rev(end - buf, buf);
+  *--buf = type;
+
+  return buf;
+}
+
+/* Input:  tag, length of the contents already in front of buf
+ * Output: tag and length in front of buf
+ * Return: start of the encoding.
+ */
+uint8_t *
+ber_head_enc_rev(uint8_t type, uint32_t len, uint8_t *buf)
+{
+  buf = ber_length_enc_rev(len, buf);
+  *--buf = type;
+  return buf;
+}
@@ -26,6 +26,28 @@
 
 #include "mib.h"
 #include "snmp.h"
+#include "transport.h"
+
+/* Request waiting on suspended Lua handlers, kept as it was received */
+struct snmp_suspended {
+  struct sockaddr_in peer;
+  int len;
+  uint8_t buf[];
+};
+
+/* Parts of the datagram being served that decoding overwrites in place,
+ * put back only when the request has to be kept aside */
+struct snmp_recv_patch {
+  /* Blanked MAC, its value is kept in the datagram */
+  uint32_t mac_off;
+  uint32_t mac_len;
+  /* Cipher text decrypted in place, saved in snmp_recv_cipher */
+  uint32_t cipher_off;
+  uint32_t cipher_len;
+};
+
+static struct snmp_recv_patch snmp_recv_patch;
+static uint8_t snmp_recv_cipher[TRANSP_BUF_SIZ];
 
 static struct err_msg_map snmp_err_msg[] = {
   { SNMP_ERR_OK, "Every thing is OK!" },
@@ -80,16 +102,18 @@ static struct err_msg_map snmp_err_msg[] = {
 static void
 snmp_datagram_clear(struct snmp_datagram *sdg)
 {
-  vb_list_free(&sdg->vb_in_list);
-  vb_list_free(&sdg->vb_out_list);
+  struct arena arena = sdg->arena;
+
+  /* Everything of the last datagram is released at once */
+  arena_reset(&arena);
   memset(sdg, 0, sizeof(*sdg));
+  sdg->arena = arena;
   INIT_LIST_HEAD(&sdg->vb_in_list);
-  INIT_LIST_HEAD(&sdg->vb_out_list);
 }
 
 /* Alloc buffer for var bind decoding */
 static struct var_bind *
-var_bind_alloc(uint8_t *buf, enum snmp_err_code *err)
+var_bind_alloc(struct snmp_datagram *sdg, uint8_t *buf, enum snmp_err_code *err)
 {
   struct var_bind *vb;
   uint8_t oid_type, val_type;
@@ -122,7 +146,7 @@ var_bind_alloc(uint8_t *buf, enum snmp_err_code *err)
   }
 
   /* Varbind allocation */
-  vb = vb_new(oid_dec_len, val_len);
+  vb = vb_arena_new(&sdg->arena, oid_dec_len, val_len);
   if (vb == NULL) {
     *err = SNMP_ERR_VB_VAR;
     return NULL;
@@ -216,7 +240,7 @@ var_bind_parse(struct snmp_datagram *sdg, uint8_t **buffer)
     buf += len_len;
 
     /* Alloc a new var_bind and add into var_bind list. */
-    vb = var_bind_alloc(buf, &err);
+    vb = var_bind_alloc(sdg, buf, &err);
     if (vb == NULL) {
       break;
     }
@@ -355,12 +379,14 @@ security_parameter_decode(struct snmp_datagram *sdg, uint8_t **buffer)
     return err;
   }
   buf += ber_length_dec(buf, &sdg->auth_para_len);
-  if (sdg->auth_para_len && sdg->auth_para_len != SNMP_MSG_AUTH_PARA_LEN) {
+  if (sdg->auth_para_len > SNMP_MSG_AUTH_PARA_MAX_LEN) {
     err = SNMP_ERR_SECURITY_AUTH_PARA_LEN;
     return err;
   }
   ber_value_dec(buf, sdg->auth_para_len, ASN1_TAG_OCTSTR, &sdg->auth_para);
   /* Blanking for authencitation step later */
+  snmp_recv_patch.mac_off = buf - (uint8_t *)sdg->recv_buf;
+  snmp_recv_patch.mac_len = sdg->auth_para_len;
   memset(buf, 0, sdg->auth_para_len);
   buf += sdg->auth_para_len;
 
@@ -387,25 +413,38 @@ static void
 snmp_msg_authen(struct snmp_datagram *sdg)
 {
   int ret = 1;
-  uint8_t mac[SHA1_SECRETKEYLEN] = { 0 };
+  uint32_t mac_len = 0;
+  uint8_t mac[SNMP_MSG_AUTH_PARA_MAX_LEN] = { 0 };
   const uint8_t *whole_msg = sdg->recv_buf;
   struct mib_user *user = sdg->user;
-  const uint8_t *secret = user->auth_key.md5;
 
   if (user->auth_mode == SNMP_USER_AUTH_MD5) {
 #ifndef DISABLE_MD5
-    ret = MD5_hmac(whole_msg, sdg->recv_len, mac, MD5_SECRETKEYLEN, secret, sizeof(user->auth_key.md5));
+    mac_len = SNMP_MSG_AUTH_PARA_LEN;
+    ret = MD5_hmac_ctx(user->auth_ctx.md5, whole_msg, sdg->recv_len, mac, mac_len);
 #endif
   } else if (user->auth_mode == SNMP_USER_AUTH_SHA1) {
 #ifndef DISABLE_SHA
-    ret = SHA1_hmac(whole_msg, sdg->recv_len, mac, SHA1_SECRETKEYLEN, secret, sizeof(user->auth_key.sha1));
+    mac_len = SNMP_MSG_AUTH_PARA_LEN;
+    ret = SHA1_hmac_ctx(user->auth_ctx.sha1, whole_msg, sdg->recv_len, mac, mac_len);
+#endif
+  } else if (user->auth_mode == SNMP_USER_AUTH_SHA256) {
+#ifndef DISABLE_SHA
+    mac_len = SNMP_MSG_AUTH_PARA_SHA256_LEN;
+    ret = SHA256_hmac_ctx(user->auth_ctx.sha256, whole_msg, sdg->recv_len, mac, mac_len);
+#endif
+  } else if (user->auth_mode == SNMP_USER_AUTH_SHA512) {
+#ifndef DISABLE_SHA
+    mac_len = SNMP_MSG_AUTH_PARA_SHA512_LEN;
+    ret = SHA512_hmac_ctx(user->auth_ctx.sha512, whole_msg, sdg->recv_len, mac, mac_len);
 #endif
   }
 
   if (ret) {
     sdg->auth_err = SNMP_ERR_STAT_GEN_ERR;
   } else {
-    if (memcmp(mac, sdg->auth_para, sdg->auth_para_len)) {
+    /* The MAC must be as long as the protocol of the user makes it */
+    if (sdg->auth_para_len != mac_len || memcmp(mac, sdg->auth_para, mac_len)) {
       sdg->auth_err = SNMP_ERR_STAT_AUTHORIZATION;
     }
   }
@@ -429,12 +468,14 @@ snmp_msg_decrypt(struct snmp_datagram *sdg, uint8_t *cipher, uint32_t clen, uint
     time = sdg->engine_time;
 #endif
   /* Initialize vector */
-  if (user->priv_mode == SNMP_USER_ENCRYPT_AES) {
+  if (user->priv_mode == SNMP_USER_ENCRYPT_AES ||
+      user->priv_mode == SNMP_USER_ENCRYPT_AES192 ||
+      user->priv_mode == SNMP_USER_ENCRYPT_AES256) {
     iv_len = sizeof(iv);
     memcpy(iv, &boots, sizeof(uint32_t));
     memcpy(iv + sizeof(uint32_t), &time, sizeof(uint32_t));
     memcpy(iv + 2 * sizeof(uint32_t), salt, sdg->priv_para_len);
-    AES_Decrypt(user->priv_key.aes, sizeof(user->priv_key.aes), iv, iv_len, cipher, clen, plain, plen);
+    AES_Decrypt(&user->priv_sched, iv, iv_len, cipher, clen, plain, plen);
   }
 #endif
 }
@@ -508,10 +549,17 @@ snmp_decode(struct snmp_datagram *sdg)
               goto DECODE_FINISH;
             }
             cipher += ber_length_dec(cipher, &sdg->scope_len);
-            uint8_t *cipher1 = malloc(sdg->scope_len);
-            memcpy(cipher1, cipher, sdg->scope_len);
-            snmp_msg_decrypt(sdg, cipher1, sdg->scope_len, buf, &sdg->scope_len);
-            free(cipher1);
+            if (sdg->scope_len > sdg->recv_len - (cipher - (uint8_t *)sdg->recv_buf)) {
+              SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", SNMP_ERR_ENCRYPT_PDU_TAG, error_message(snmp_err_msg, elem_num(snmp_err_msg), SNMP_ERR_ENCRYPT_PDU_TAG));
+              dec_fail = 1;
+              goto DECODE_FINISH;
+            }
+            /* Decrypt in place, the scoped PDU follows */
+            snmp_recv_patch.cipher_off = cipher - (uint8_t *)sdg->recv_buf;
+            snmp_recv_patch.cipher_len = sdg->scope_len;
+            memcpy(snmp_recv_cipher, cipher, sdg->scope_len);
+            snmp_msg_decrypt(sdg, cipher, sdg->scope_len, cipher, &sdg->scope_len);
+            buf = cipher;
           }
         }
       } else {
@@ -581,8 +629,8 @@ snmp_decode(struct snmp_datagram *sdg)
   }
 
 DECODE_FINISH:
-  /* We should free received buffer here */
-  free(snmp_datagram.recv_buf);
+  /* Received buffer is owned by transport, it is not referred any more */
+  snmp_datagram.recv_buf = NULL;
 
   /* If fail, do some clear things */
   if (dec_fail) {
@@ -626,6 +674,74 @@ snmp_request_dispatch(struct snmp_datagram *sdg)
   }
 }
 
+static void snmp_serve(uint8_t *buffer, int len, struct mib_async_req *req);
+
+/* All suspended handlers of the request are done, serve it again with
+ * their results for the sender it came from. */
+static void
+snmp_resume(struct mib_async_req *req)
+{
+  struct snmp_suspended *s = req->ud;
+
+  snmp_transp_ops.peer_set(&s->peer);
+  snmp_serve(s->buf, s->len, req);
+}
+
+/* Decode and dispatch a datagram, req is the request it stands for when
+ * it is served again. Handlers of GET, GETNEXT and GETBULK may be
+ * suspended, the request is then kept aside and the response is left to
+ * the last of them. */
+static void
+snmp_serve(uint8_t *buffer, int len, struct mib_async_req *req)
+{
+  struct snmp_suspended *s = req != NULL ? req->ud : NULL;
+  uint8_t pdu_type;
+  int async;
+
+  /* Reset datagram */
+  snmp_datagram_clear(&snmp_datagram);
+  snmp_datagram.recv_buf = buffer;
+  snmp_datagram.recv_len = len;
+  memset(&snmp_recv_patch, 0, sizeof(snmp_recv_patch));
+
+  /* Decode snmp datagram */
+  snmp_decode(&snmp_datagram);
+
+  /* Dispatch request */
+  pdu_type = snmp_datagram.pdu_hdr.pdu_type;
+  async = pdu_type == SNMP_REQ_GET || pdu_type == SNMP_REQ_GETNEXT || pdu_type == SNMP_REQ_BULKGET;
+  if (async) {
+    mib_async_begin(req);
+  }
+  snmp_request_dispatch(&snmp_datagram);
+  if (async) {
+    req = mib_async_end();
+  }
+
+  if (req == NULL) {
+    return;
+  }
+  if (req->pending == 0) {
+    /* Answered */
+    free(s);
+    mib_async_free(req);
+    return;
+  }
+  if (s == NULL) {
+    s = xmalloc(sizeof(*s) + len);
+    snmp_transp_ops.peer_get(&s->peer);
+    s->len = len;
+    req->ud = s;
+    req->resume = snmp_resume;
+  }
+  /* Keep the request as it was received */
+  if (s->buf != buffer) {
+    memcpy(s->buf, buffer, len);
+  }
+  memcpy(s->buf + snmp_recv_patch.mac_off, snmp_datagram.auth_para, snmp_recv_patch.mac_len);
+  memcpy(s->buf + snmp_recv_patch.cipher_off, snmp_recv_cipher, snmp_recv_patch.cipher_len);
+}
+
 /* Receive snmp datagram from transport module */
 void
 snmp_recv(uint8_t *buffer, int len)
@@ -638,7 +754,6 @@ snmp_recv(uint8_t *buffer, int len)
   /* Check PDU tag */
   if (buffer[0] != ASN1_TAG_SEQ) {
     SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", SNMP_ERR_PDU_TYPE, error_message(snmp_err_msg, elem_num(snmp_err_msg), SNMP_ERR_PDU_TYPE));
-    free(buffer);
     return;
   }
 
@@ -646,18 +761,8 @@ snmp_recv(uint8_t *buffer, int len)
   len_len = ber_length_dec(buffer + tag_len, &snmp_datagram.data_len);
   if (tag_len + len_len + snmp_datagram.data_len != len) {
     SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", SNMP_ERR_PDU_LEN, error_message(snmp_err_msg, elem_num(snmp_err_msg), SNMP_ERR_PDU_LEN));
-    free(buffer);
     return;
   }
 
-  /* Reset datagram */
-  snmp_datagram_clear(&snmp_datagram);
-  snmp_datagram.recv_buf = buffer;
-  snmp_datagram.recv_len = len;
-
-  /* Decode snmp datagram */
-  snmp_decode(&snmp_datagram);
-
-  /* Dispatch request */
-  snmp_request_dispatch(&snmp_datagram);
+  snmp_serve(buffer, len, NULL);
 }
@@ -28,273 +28,17 @@
 #include "protocol.h"
 
 static uint8_t *snmp_msg_auth_para;
-static uint8_t *snmp_msg_priv_para;
-static uint32_t snmp_scope_pdu_len;
-
-static uint32_t
-global_data_encode_try(struct snmp_datagram *sdg)
-{
-  const uint32_t tag_len = 1;
-  uint32_t len_len, msg_len;
- 
-  len_len = ber_length_enc_try(sdg->msg_id_len);
-  msg_len = tag_len + len_len + sdg->msg_id_len;
-
-  len_len = ber_length_enc_try(sdg->msg_size_len);
-  msg_len += tag_len + len_len + sdg->msg_size_len;
- 
-  len_len = ber_length_enc_try(sdg->msg_flags_len);
-  msg_len += tag_len + len_len + sdg->msg_flags_len;
- 
-  len_len = ber_length_enc_try(sdg->msg_model_len);
-  msg_len += tag_len + len_len + sdg->msg_model_len;
-
-  return msg_len;
-}
-
-static uint8_t *
-global_data_encode(struct snmp_datagram *sdg, uint8_t *buf)
-{
-  /* Global data sequence */
-  *buf++ = ASN1_TAG_SEQ;
-  buf += ber_length_enc(sdg->msg_len, buf);
-
-  /* Messege ID */
-  *buf++ = ASN1_TAG_INT;
-  buf += ber_length_enc(sdg->msg_id_len, buf);
-  buf += ber_value_enc(&sdg->msg_id, 1, ASN1_TAG_INT, buf);
-
-  /* Messege max size */
-  *buf++ = ASN1_TAG_INT;
-  buf += ber_length_enc(sdg->msg_size_len, buf);
-  buf += ber_value_enc(&sdg->msg_max_size, 1, ASN1_TAG_INT, buf);
-
-  /* Messege flags */
-  *buf++ = ASN1_TAG_OCTSTR;
-  buf += ber_length_enc(sdg->msg_flags_len, buf);
-  buf += ber_value_enc(&sdg->msg_flags, sdg->msg_flags_len, ASN1_TAG_OCTSTR, buf);
-
-  /* Messege security model */
-  *buf++ = ASN1_TAG_INT;
-  buf += ber_length_enc(sdg->msg_model_len, buf);
-  buf += ber_value_enc(&sdg->msg_security_model, 1, ASN1_TAG_INT, buf);
-
-  return buf;
-}
-
-static uint32_t
-security_parameter_encode_try(struct snmp_datagram *sdg)
-{
-  const uint32_t tag_len = 1;
-  uint32_t len_len, secur_para_len;
-
-  sdg->engine_id_len = sizeof(snmpv3_engine_id);
-  len_len = ber_length_enc_try(sdg->engine_id_len);
-  secur_para_len = tag_len + len_len + sdg->engine_id_len;
-
-  len_len = ber_length_enc_try(sdg->engine_boots_len);
-  secur_para_len += tag_len + len_len + sdg->engine_boots_len;
-
-  len_len = ber_length_enc_try(sdg->engine_time_len);
-  secur_para_len += tag_len + len_len + sdg->engine_time_len;
-
-  len_len = ber_length_enc_try(sdg->user_name_len);
-  secur_para_len += tag_len + len_len + sdg->user_name_len;
-
-  len_len = ber_length_enc_try(sdg->auth_para_len);
-  secur_para_len += tag_len + len_len + sdg->auth_para_len;
-
-  len_len = ber_length_enc_try(sdg->priv_para_len);
-  secur_para_len += tag_len + len_len + sdg->priv_para_len;
-
-  return secur_para_len;
-}
-
-static uint8_t *
-security_parameter_encode(struct snmp_datagram *sdg, uint8_t *buf)
-{
-  /* Security parameter sequence */
-  *buf++ = ASN1_TAG_SEQ;
-  buf += ber_length_enc(sdg->secur_para_len, buf);
-
-  /* Engine ID */
-  *buf++ = ASN1_TAG_OCTSTR;
-  buf += ber_length_enc(sdg->engine_id_len, buf);
-  buf += ber_value_enc(snmpv3_engine_id, sdg->engine_id_len, ASN1_TAG_OCTSTR, buf);
-
-  /* Engine boots */
-  *buf++ = ASN1_TAG_INT;
-  buf += ber_length_enc(sdg->engine_boots_len, buf);
-  buf += ber_value_enc(&sdg->engine_boots, 1, ASN1_TAG_INT, buf);
-
-  /* Engine time */
-  *buf++ = ASN1_TAG_INT;
-  buf += ber_length_enc(sdg->engine_time_len, buf);
-  buf += ber_value_enc(&sdg->engine_time, 1, ASN1_TAG_INT, buf);
-
-  /* User name */
-  *buf++ = ASN1_TAG_OCTSTR;
-  buf += ber_length_enc(sdg->user_name_len, buf);
-  buf += ber_value_enc(&sdg->user_name, sdg->user_name_len, ASN1_TAG_OCTSTR, buf);
-
-  /* Authentication parameter */
-  *buf++ = ASN1_TAG_OCTSTR;
-  buf += ber_length_enc(sdg->auth_para_len, buf);
-  snmp_msg_auth_para = buf;
-  buf += ber_value_enc(&sdg->auth_para, sdg->auth_para_len, ASN1_TAG_OCTSTR, buf);
-
-  /* Privative parameter */
-  *buf++ = ASN1_TAG_OCTSTR;
-  buf += ber_length_enc(sdg->priv_para_len, buf);
-  snmp_msg_priv_para = buf;
-  buf += ber_value_enc(&sdg->priv_para, sdg->priv_para_len, ASN1_TAG_OCTSTR, buf);
-
-  return buf; 
-}
-
-static uint8_t *
-asn1_encode(struct snmp_datagram *sdg)
-{
-  struct pdu_hdr *ph;
-  uint8_t *buf;
-  const uint32_t tag_len = 1;
-  uint32_t len_len;
-
-  ph = &sdg->pdu_hdr;
-  sdg->data_len = 0;
-
-  len_len = ber_length_enc_try(sdg->vb_list_len);
-  ph->pdu_len = tag_len + len_len + sdg->vb_list_len;
-
-  len_len = ber_length_enc_try(ph->req_id_len);
-  ph->pdu_len += tag_len + len_len + ph->req_id_len;
-
-  len_len = ber_length_enc_try(ph->err_stat_len);
-  ph->pdu_len += tag_len + len_len + ph->err_stat_len;
-
-  len_len = ber_length_enc_try(ph->err_idx_len);
-  ph->pdu_len += tag_len + len_len + ph->err_idx_len;
-
-  len_len = ber_length_enc_try(ph->pdu_len);
-  sdg->scope_len = tag_len + len_len + ph->pdu_len;
-
-  len_len = ber_length_enc_try(sdg->context_name_len);
-  sdg->scope_len += tag_len + len_len + sdg->context_name_len;
-
-  if (sdg->version >= 3) {
-    /* SNMPv3 */
-    sdg->context_id_len = sizeof(snmpv3_engine_id);
-    len_len = ber_length_enc_try(sdg->context_id_len);
-    sdg->scope_len += tag_len + len_len + sdg->context_id_len;
-
-    sdg->secur_para_len = security_parameter_encode_try(sdg);
-
-    len_len = ber_length_enc_try(sdg->secur_para_len);
-    sdg->secur_str_len = tag_len + len_len + sdg->secur_para_len;
-
-    sdg->msg_len = global_data_encode_try(sdg);
-
-    len_len = ber_length_enc_try(sdg->msg_len);
-    sdg->data_len += tag_len + len_len + sdg->msg_len;
-
-    len_len = ber_length_enc_try(sdg->secur_str_len);
-    sdg->data_len += tag_len + len_len + sdg->secur_str_len;
-
-    len_len = ber_length_enc_try(sdg->scope_len);
-    sdg->data_len += tag_len + len_len;
-    snmp_scope_pdu_len = tag_len + len_len + sdg->scope_len;
-
-    if (sdg->msg_flags & SNMP_SECUR_FLAG_ENCRYPT) {
-      len_len = ber_length_enc_try(snmp_scope_pdu_len);
-      sdg->data_len += tag_len + len_len;
-    }
-  }
-
-  sdg->data_len += sdg->scope_len;
-
-  len_len = ber_length_enc_try(sdg->ver_len);
-  sdg->data_len += tag_len + len_len + sdg->ver_len;
-
-  len_len = ber_length_enc_try(sdg->data_len);
-  sdg->send_buf = xmalloc(tag_len + len_len + sdg->data_len);
-
-  buf = sdg->send_buf;
-
-  /* Datagram sequence */
-  *buf++ = ASN1_TAG_SEQ;
-  buf += ber_length_enc(sdg->data_len, buf);
-
-  /* Version */
-  *buf++ = ASN1_TAG_INT;
-  buf += ber_length_enc(sdg->ver_len, buf);
-  buf += ber_value_enc(&sdg->version, 1, ASN1_TAG_INT, buf);
-
-  if (sdg->version >= 3) {
-    /* Global data */
-    buf = global_data_encode(sdg, buf);
-
-    /* Security string */
-    *buf++ = ASN1_TAG_OCTSTR;
-    buf += ber_length_enc(sdg->secur_str_len, buf);
-
-    /* Security parameter */
-    buf = security_parameter_encode(sdg, buf);
-
-    /* Context sequence */
-    *buf++ = ASN1_TAG_SEQ;
-    buf += ber_length_enc(sdg->scope_len, buf);
-
-    /* Context ID */
-    *buf++ = ASN1_TAG_OCTSTR;
-    buf += ber_length_enc(sizeof(snmpv3_engine_id), buf);
-    buf += ber_value_enc(snmpv3_engine_id, sizeof(snmpv3_engine_id), ASN1_TAG_OCTSTR, buf);
-  }
-
-  /* Context_name */
-  *buf++ = ASN1_TAG_OCTSTR;
-  buf += ber_length_enc(sdg->context_name_len, buf);
-  buf += ber_value_enc(sdg->context_name, sdg->context_name_len, ASN1_TAG_OCTSTR, buf);
-
-  /* PDU header */
-  *buf++ = ph->pdu_type;
-  buf += ber_length_enc(ph->pdu_len, buf);
-
-  /* Request ID */
-  *buf++ = ASN1_TAG_INT;
-  buf += ber_length_enc(ph->req_id_len, buf);
-  buf += ber_value_enc(&ph->req_id, 1, ASN1_TAG_INT, buf);
-
-  /* Error status */
-  *buf++ = ASN1_TAG_INT;
-  buf += ber_length_enc(ph->err_stat_len, buf);
-  buf += ber_value_enc(&ph->err_stat, 1, ASN1_TAG_INT, buf);
-
-  /* Error index */
-  *buf++ = ASN1_TAG_INT;
-  buf += ber_length_enc(ph->err_idx_len, buf);
-  buf += ber_value_enc(&ph->err_idx, 1, ASN1_TAG_INT, buf);
-
-  /* Varbind list */
-  *buf++ = ASN1_TAG_SEQ;
-  buf += ber_length_enc(sdg->vb_list_len, buf);
-
-  return buf;
-}
 
 #ifndef DISABLE_CRYPTO
-/* Message encryption */
+/* Encrypt the scoped PDU in place, cipher text keeps the length in CFB mode */
 static void
-snmp_msg_encrypt(struct snmp_datagram *sdg)
+snmp_msg_encrypt(struct snmp_datagram *sdg, uint8_t *scope, uint32_t len)
 {
 #ifndef DISABLE_AES
   int i1, i2;
   uint32_t boots, time;
   uint8_t iv[AES_SECRETKEYLEN], iv_len;
-  uint8_t *salt = snmp_msg_priv_para;
-  uint8_t *plain = snmp_msg_priv_para + sdg->priv_para_len;
-  uint32_t plen = snmp_scope_pdu_len;
-  uint8_t *cipher = NULL;
-  uint32_t clen = plen;
+  uint32_t clen = len;
   struct mib_user *user = sdg->user;
 
 #ifdef LITTLE_ENDIAN
@@ -309,24 +53,17 @@ snmp_msg_encrypt(struct snmp_datagram *sdg)
   time = sdg->engine_time;
 #endif
 
-  if (user->priv_mode == SNMP_USER_ENCRYPT_AES) {
+  if (user->priv_mode == SNMP_USER_ENCRYPT_AES ||
+      user->priv_mode == SNMP_USER_ENCRYPT_AES192 ||
+      user->priv_mode == SNMP_USER_ENCRYPT_AES256) {
     iv_len = sizeof(iv);
     memcpy(iv, &boots, sizeof(uint32_t));
     memcpy(iv + sizeof(uint32_t), &time, sizeof(uint32_t));
     memcpy(iv + 2 * sizeof(int), &i1, sizeof(int));
     memcpy(iv + 3 * sizeof(int), &i2, sizeof(int));
-    cipher = malloc(snmp_scope_pdu_len);
-    AES_Encrypt(user->priv_key.aes, sizeof(user->priv_key.aes), iv, iv_len, plain, plen, cipher, &clen);
-    memcpy(salt, iv + 2 * sizeof(int), sdg->priv_para_len);
-  }
-
-  /* Build cipher text tag */
-  *plain++ = ASN1_TAG_OCTSTR;
-  plain += ber_length_enc(clen, plain);
-  plain += ber_value_enc(cipher, clen, ASN1_TAG_OCTSTR, plain);
-
-  if (cipher != NULL) {
-    free(cipher);
+    AES_Encrypt(&user->priv_sched, iv, iv_len, scope, len, scope, &clen);
+    /* Salt goes into the privacy parameter encoded afterwards */
+    memcpy(sdg->priv_para, iv + 2 * sizeof(int), sdg->priv_para_len);
   }
 #endif
 }
@@ -335,79 +72,193 @@ snmp_msg_encrypt(struct snmp_datagram *sdg)
 static void
 snmp_msg_signature(struct snmp_datagram *sdg)
 {
-  uint8_t mac[SHA1_SECRETKEYLEN];
+  uint8_t mac[SNMP_MSG_AUTH_PARA_MAX_LEN];
+  uint32_t mac_len = sdg->auth_para_len;
   const uint8_t *whole_msg;
-  const uint8_t *secret;
   struct mib_user *user = sdg->user;
 
   whole_msg = sdg->send_buf;
-  secret = user->auth_key.md5;
 
   /* Blanking for authencitation */
   memset(snmp_msg_auth_para, 0, sdg->auth_para_len);
+  memset(mac, 0, sizeof(mac));
   if (user->auth_mode == SNMP_USER_AUTH_MD5) {
 #ifndef DISABLE_MD5
-    MD5_hmac(whole_msg, sdg->send_len, mac, MD5_SECRETKEYLEN, secret, sizeof(user->auth_key.md5));
+    MD5_hmac_ctx(user->auth_ctx.md5, whole_msg, sdg->send_len, mac, mac_len);
 #endif
   } else if (user->auth_mode == SNMP_USER_AUTH_SHA1) {
 #ifndef DISABLE_SHA
-    SHA1_hmac(whole_msg, sdg->send_len, mac, SHA1_SECRETKEYLEN, secret, sizeof(user->auth_key.sha1));
+    SHA1_hmac_ctx(user->auth_ctx.sha1, whole_msg, sdg->send_len, mac, mac_len);
+#endif
+  } else if (user->auth_mode == SNMP_USER_AUTH_SHA256) {
+#ifndef DISABLE_SHA
+    SHA256_hmac_ctx(user->auth_ctx.sha256, whole_msg, sdg->send_len, mac, mac_len);
+#endif
+  } else if (user->auth_mode == SNMP_USER_AUTH_SHA512) {
+#ifndef DISABLE_SHA
+    SHA512_hmac_ctx(user->auth_ctx.sha512, whole_msg, sdg->send_len, mac, mac_len);
 #endif
-  } else {
-    memset(mac, 0, sizeof(mac));
   }
-  memcpy(snmp_msg_auth_para, mac, sdg->auth_para_len);
+  memcpy(snmp_msg_auth_para, mac, mac_len);
 }
 #endif
 
+/* Size limit of the response: the smallest of msgMaxSize of the requester,
+ * the configured one and the largest UDP payload. */
+static uint32_t
+snmp_msg_max_size(struct snmp_datagram *sdg)
+{
+  uint32_t max = SNMP_MSG_MAX_SIZ;
+
+  if (prot_config.max_msg_size > 0 && prot_config.max_msg_size < max) {
+    max = prot_config.max_msg_size;
+  }
+  if (sdg->version >= 3 && sdg->msg_max_size > 0 && sdg->msg_max_size < max) {
+    max = sdg->msg_max_size;
+  }
+  return max;
+}
+
+/* Encode everything in front of the varbind list backward, from the list
+ * header up to the outer sequence. A dry run only measures the header and
+ * leaves the varbinds untouched. Return the start of the message. */
+static uint8_t *
+snmp_msg_head_encode(struct snmp_datagram *sdg, uint8_t *list, uint8_t *end, int dry)
+{
+  struct pdu_hdr *ph = &sdg->pdu_hdr;
+  uint8_t *buf = list, *scope_end;
+
+  /* Varbind list */
+  buf = ber_head_enc_rev(ASN1_TAG_SEQ, end - buf, buf);
+
+  /* Error index, error status and request ID */
+  buf = ber_tlv_enc_rev(ASN1_TAG_INT, &ph->err_idx, 1, buf);
+  buf = ber_tlv_enc_rev(ASN1_TAG_INT, &ph->err_stat, 1, buf);
+  buf = ber_tlv_enc_rev(ASN1_TAG_INT, &ph->req_id, 1, buf);
+
+  /* PDU header */
+  buf = ber_head_enc_rev(ph->pdu_type, end - buf, buf);
+
+  /* Context name */
+  buf = ber_tlv_enc_rev(ASN1_TAG_OCTSTR, sdg->context_name, sdg->context_name_len, buf);
+
+  if (sdg->version >= 3) {
+    /* Context ID and context sequence */
+    buf = ber_tlv_enc_rev(ASN1_TAG_OCTSTR, snmpv3_engine_id, sizeof(snmpv3_engine_id), buf);
+    buf = ber_head_enc_rev(ASN1_TAG_SEQ, end - buf, buf);
+
+    if (sdg->msg_flags & SNMP_SECUR_FLAG_ENCRYPT) {
+#ifndef DISABLE_CRYPTO
+      if (!dry && sdg->user != NULL && (sdg->msg_flags & SNMP_SECUR_FLAG_AUTH)) {
+        snmp_msg_encrypt(sdg, buf, end - buf);
+      }
+#endif
+      buf = ber_head_enc_rev(ASN1_TAG_OCTSTR, end - buf, buf);
+    }
+    scope_end = buf;
+
+    /* Security parameter */
+    buf = ber_tlv_enc_rev(ASN1_TAG_OCTSTR, sdg->priv_para, sdg->priv_para_len, buf);
+    snmp_msg_auth_para = buf - sdg->auth_para_len;
+    buf = ber_tlv_enc_rev(ASN1_TAG_OCTSTR, sdg->auth_para, sdg->auth_para_len, buf);
+    buf = ber_tlv_enc_rev(ASN1_TAG_OCTSTR, sdg->user_name, sdg->user_name_len, buf);
+    buf = ber_tlv_enc_rev(ASN1_TAG_INT, &sdg->engine_time, 1, buf);
+    buf = ber_tlv_enc_rev(ASN1_TAG_INT, &sdg->engine_boots, 1, buf);
+    buf = ber_tlv_enc_rev(ASN1_TAG_OCTSTR, snmpv3_engine_id, sizeof(snmpv3_engine_id), buf);
+    buf = ber_head_enc_rev(ASN1_TAG_SEQ, scope_end - buf, buf);
+    buf = ber_head_enc_rev(ASN1_TAG_OCTSTR, scope_end - buf, buf);
+    scope_end = buf;
+
+    /* Global data */
+    buf = ber_tlv_enc_rev(ASN1_TAG_INT, &sdg->msg_security_model, 1, buf);
+    buf = ber_tlv_enc_rev(ASN1_TAG_OCTSTR, &sdg->msg_flags, sdg->msg_flags_len, buf);
+    buf = ber_tlv_enc_rev(ASN1_TAG_INT, &sdg->msg_max_size, 1, buf);
+    buf = ber_tlv_enc_rev(ASN1_TAG_INT, &sdg->msg_id, 1, buf);
+    buf = ber_head_enc_rev(ASN1_TAG_SEQ, scope_end - buf, buf);
+  }
+
+  /* Version and datagram sequence */
+  buf = ber_tlv_enc_rev(ASN1_TAG_INT, &sdg->version, 1, buf);
+  buf = ber_head_enc_rev(ASN1_TAG_SEQ, end - buf, buf);
+
+  return buf;
+}
+
+/* Set up the response buffer of the datagram:
+ *
+ *   | head room | varbind list ... vb_list_max | scratch for one varbind |
+ *
+ * The header is encoded backward into the head room once the list is done,
+ * every varbind is encoded backward into the scratch then moved in place. */
 void
-snmp_response(struct snmp_datagram *sdg)
+snmp_response_init(struct snmp_datagram *sdg)
 {
-  struct var_bind *vb_out;
-  struct list_head *curr;
+  struct pdu_hdr *ph = &sdg->pdu_hdr;
+  uint32_t max_size, head_len;
+  integer_t err_stat, err_idx;
   uint8_t *buf;
-  uint32_t oid_len, len_len;
-  const uint32_t tag_len = 1;
 
-  buf = asn1_encode(sdg);
+  max_size = snmp_msg_max_size(sdg);
+  buf = arena_alloc(&sdg->arena, SNMP_MSG_HEAD_ROOM + max_size + SNMP_VB_MAX_SIZ);
+  sdg->vb_list = sdg->vb_end = buf + SNMP_MSG_HEAD_ROOM;
+  sdg->rsp_end = sdg->vb_list + max_size + SNMP_VB_MAX_SIZ;
+  sdg->vb_out_cnt = 0;
+
+  /* Measure the header with the widest lengths and error fields it may get */
+  err_stat = ph->err_stat;
+  err_idx = ph->err_idx;
+  ph->err_stat = ph->err_idx = SNMP_MSG_MAX_SIZ;
+  head_len = sdg->vb_list - snmp_msg_head_encode(sdg, sdg->vb_list, sdg->vb_list + max_size, 1);
+  ph->err_stat = err_stat;
+  ph->err_idx = err_idx;
+
+  sdg->vb_list_max = max_size > head_len ? max_size - head_len : 0;
+}
 
-  list_for_each(curr, &sdg->vb_out_list) {
-    vb_out = list_entry(curr, struct var_bind, link);
+/* Append a varbind to the response, return 0 if it would make the response
+ * exceed the size limit. */
+int
+snmp_response_vb_add(struct snmp_datagram *sdg, const oid_t *oid, uint32_t oid_len, uint8_t type, const Variable *var)
+{
+  uint8_t *buf = sdg->rsp_end;
+  uint32_t vb_len;
 
-    *buf++ = ASN1_TAG_SEQ;
-    buf += ber_length_enc(vb_out->vb_len, buf);
+  buf = ber_tlv_enc_rev(type, value(var), length(var), buf);
+  buf = ber_tlv_enc_rev(ASN1_TAG_OBJID, oid, oid_len, buf);
+  buf = ber_head_enc_rev(ASN1_TAG_SEQ, sdg->rsp_end - buf, buf);
+  vb_len = sdg->rsp_end - buf;
 
-    /* oid */
-    *buf++ = ASN1_TAG_OBJID;
-    oid_len = ber_value_enc_try(vb_out->oid, vb_out->oid_len, ASN1_TAG_OBJID);
-    buf += ber_length_enc(oid_len, buf);
-    buf += ber_value_enc(vb_out->oid, vb_out->oid_len, ASN1_TAG_OBJID, buf);
+  if (sdg->vb_end - sdg->vb_list + vb_len > sdg->vb_list_max) {
+    return 0;
+  }
+  memcpy(sdg->vb_end, buf, vb_len);
+  sdg->vb_end += vb_len;
+  sdg->vb_out_cnt++;
+  return 1;
+}
 
-    /* value */
-    *buf++ = vb_out->value_type;
-    buf += ber_length_enc(vb_out->value_len, buf);
-    memcpy(buf, vb_out->value, vb_out->value_len);
-    buf += vb_out->value_len;
+void
+snmp_response(struct snmp_datagram *sdg)
+{
+  if (mib_async_suspended()) {
+    /* Answered when the suspended handlers are done */
+    return;
   }
 
-  len_len = ber_length_enc_try(sdg->data_len);
-  sdg->send_len = tag_len + len_len + sdg->data_len;
+  sdg->send_buf = snmp_msg_head_encode(sdg, sdg->vb_list, sdg->vb_end, 0);
+  sdg->send_len = sdg->vb_end - (uint8_t *)sdg->send_buf;
 
 #ifndef DISABLE_CRYPTO
   if (sdg->version >= 3) {
     if (sdg->user != NULL) {
       /* Message authentication */
       if (sdg->msg_flags & SNMP_SECUR_FLAG_AUTH) { 
-        /* Message encryption */
-        if (sdg->msg_flags & SNMP_SECUR_FLAG_ENCRYPT) {
-          snmp_msg_encrypt(sdg);
-        }
         snmp_msg_signature(sdg);
       }
     }
   }
 #endif
 
-  /* This callback will free send_buf */
+  /* send_buf lives in the datagram arena, transport copies what it keeps */
   snmp_prot_ops.send(sdg->send_buf, sdg->send_len);
 }
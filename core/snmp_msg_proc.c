@@ -25,6 +25,7 @@
 
 #include "mib.h"
 #include "snmp.h"
+#include "protocol.h"
 
 #define ACC_CHECK_RD 0
 #define ACC_CHECK_WR 1
@@ -82,8 +83,8 @@ mib_get(struct snmp_datagram *sdg, struct var_bind *vb_in, struct oid_search_res
 
   ret = mib_access_check(sdg, vb_in->oid, vb_in->oid_len, ACC_CHECK_RD);
   if (ret != SNMP_ERR_STAT_NO_ERR) {
-    /* Duplicate original oid */
-    ret_oid->oid = oid_dup(vb_in->oid, vb_in->oid_len);
+    /* Copy original oid */
+    oid_cpy(ret_oid->oid, vb_in->oid, vb_in->oid_len);
     ret_oid->id_len = vb_in->oid_len;
     ret_oid->err_stat = ret;
     return;
@@ -99,78 +100,96 @@ mib_get(struct snmp_datagram *sdg, struct var_bind *vb_in, struct oid_search_res
 
     /* End of mib view */
     if (view == NULL) {
-      /* Duplicate original oid when result not found */
-      ret_oid->oid = oid_dup(vb_in->oid, vb_in->oid_len);
+      /* Copy original oid when result not found */
+      oid_cpy(ret_oid->oid, vb_in->oid, vb_in->oid_len);
       ret_oid->id_len = vb_in->oid_len;
       return;
     }
 
     mib_tree_search(view, vb_in->oid, vb_in->oid_len, ret_oid);
+    if (ret_oid->batch == MIB_BATCH_PENDING) {
+      /* Answered later by the batch handler */
+      return;
+    }
     if ((!ret_oid->err_stat && ASN1_TAG_VALID(tag(&ret_oid->var))) || oid_cmp(vb_in->oid, vb_in->oid_len, view->oid, view->id_len) < 0) {
       /* Gotcha or given oid ahead of all views */
       return;
     }
-    /* Free temporary result */
-    free(ret_oid->oid);
   }
 }
 
+/* The response does not fit in the size limit, answer tooBig without varbinds */
+static void
+snmp_too_big(struct snmp_datagram *sdg)
+{
+  sdg->vb_end = sdg->vb_list;
+  sdg->vb_out_cnt = 0;
+  sdg->pdu_hdr.err_stat = SNMP_ERR_STAT_TOO_BIG;
+  sdg->pdu_hdr.err_idx = 0;
+  snmp_response(sdg);
+}
+
+/* Varbinds landing in a group node with a batch handler are answered by
+ * one Lua call per group, the others are searched as they come. */
 void
 snmp_get(struct snmp_datagram *sdg)
 {
   struct list_head *curr;
-  struct var_bind *vb_in, *vb_out;
-  struct oid_search_res ret_oid;
-  uint32_t oid_len, len_len, val_len;
-  uint32_t vb_in_cnt = 0;
-  const uint32_t tag_len = 1;
+  struct var_bind *vb_in;
+  struct oid_search_res *res, *ret_oid;
+  uint32_t i, vb_in_cnt = 0;
 
-  memset(&ret_oid, 0, sizeof(ret_oid));
-  ret_oid.request = SNMP_REQ_GET;
+  snmp_response_init(sdg);
+  res = arena_alloc(&sdg->arena, sdg->vb_in_cnt * sizeof(*res));
 
   list_for_each(curr, &sdg->vb_in_list) {
     vb_in = list_entry(curr, struct var_bind, link);
-    vb_in_cnt++;
+    ret_oid = &res[vb_in_cnt++];
+    ret_oid->request = SNMP_REQ_GET;
+    ret_oid->err_stat = 0;
+    ret_oid->batch = MIB_BATCH_ON;
+    ret_oid->suspended = 0;
 
     /* Decode vb_in value first */
-    tag(&ret_oid.var) = vb_in->value_type;
-    length(&ret_oid.var) = ber_value_dec(vb_in->value, vb_in->value_len, tag(&ret_oid.var), value(&ret_oid.var));
+    tag(&ret_oid->var) = vb_in->value_type;
+    length(&ret_oid->var) = ber_value_dec(vb_in->value, vb_in->value_len, tag(&ret_oid->var), value(&ret_oid->var));
 
     /* Search the mib node at the input oid */
-    mib_get(sdg, vb_in, &ret_oid);
+    mib_get(sdg, vb_in, ret_oid);
+  }
 
-    val_len = ber_value_enc_try(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var));
-    vb_out = xmalloc(sizeof(*vb_out) + val_len);
-    vb_out->oid = ret_oid.oid;
-    vb_out->oid_len = ret_oid.id_len;
-    vb_out->value_type = tag(&ret_oid.var);
-    vb_out->value_len = ber_value_enc(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var), vb_out->value);
+  /* One call for each batch handler */
+  for (i = 0; i < vb_in_cnt; i++) {
+    if (res[i].batch == MIB_BATCH_PENDING) {
+      mib_instance_search_batch(res, vb_in_cnt, i);
+    }
+  }
+
+  vb_in_cnt = 0;
+  list_for_each(curr, &sdg->vb_in_list) {
+    vb_in = list_entry(curr, struct var_bind, link);
+    ret_oid = &res[vb_in_cnt++];
+
+    if (ret_oid->batch == MIB_BATCH_DONE &&
+        (ret_oid->err_stat || !ASN1_TAG_VALID(tag(&ret_oid->var)))) {
+      /* Not found, let the other views have their say */
+      ret_oid->batch = MIB_BATCH_OFF;
+      mib_get(sdg, vb_in, ret_oid);
+    }
 
     /* Error status */
-    if (ret_oid.err_stat) {
+    if (ret_oid->err_stat) {
       if (!sdg->pdu_hdr.err_stat) {
         /* Mark the first error varbind */
-        sdg->pdu_hdr.err_stat = ret_oid.err_stat;
+        sdg->pdu_hdr.err_stat = ret_oid->err_stat;
         sdg->pdu_hdr.err_idx = vb_in_cnt;
       }
     }
 
-    /* OID length encoding */
-    oid_len = ber_value_enc_try(vb_out->oid, vb_out->oid_len, ASN1_TAG_OBJID);
-    len_len = ber_length_enc_try(oid_len);
-    vb_out->vb_len = tag_len + len_len + oid_len;
-
-    /* Value length encoding */
-    len_len = ber_length_enc_try(vb_out->value_len);
-    vb_out->vb_len += tag_len + len_len + vb_out->value_len;
-
-    /* Varbind length encoding */
-    len_len = ber_length_enc_try(vb_out->vb_len);
-    sdg->vb_list_len += tag_len + len_len + vb_out->vb_len;
-
-    /* Add into list. */
-    list_add_tail(&vb_out->link, &sdg->vb_out_list);
-    sdg->vb_out_cnt++;
+    if (!snmp_response_vb_add(sdg, ret_oid->oid, ret_oid->id_len, tag(&ret_oid->var), &ret_oid->var)) {
+      snmp_too_big(sdg);
+      return;
+    }
   }
 
   snmp_response(sdg);
@@ -184,8 +203,8 @@ mib_getnext(struct snmp_datagram *sdg, struct var_bind *vb_in, struct oid_search
 
   ret = mib_access_check(sdg, vb_in->oid, vb_in->oid_len, ACC_CHECK_RD);
   if (ret != SNMP_ERR_STAT_NO_ERR) {
-    /* Duplicate original oid */
-    ret_oid->oid = oid_dup(vb_in->oid, vb_in->oid_len);
+    /* Copy original oid */
+    oid_cpy(ret_oid->oid, vb_in->oid, vb_in->oid_len);
     ret_oid->id_len = vb_in->oid_len;
     ret_oid->err_stat = ret;
     return;
@@ -201,8 +220,8 @@ mib_getnext(struct snmp_datagram *sdg, struct var_bind *vb_in, struct oid_search
 
     /* End of mib view */
     if (view == NULL) {
-      /* Duplicate original oid when result not found */
-      ret_oid->oid = oid_dup(vb_in->oid, vb_in->oid_len);
+      /* Copy original oid when result not found */
+      oid_cpy(ret_oid->oid, vb_in->oid, vb_in->oid_len);
       ret_oid->id_len = vb_in->oid_len;
       return;
     }
@@ -212,8 +231,6 @@ mib_getnext(struct snmp_datagram *sdg, struct var_bind *vb_in, struct oid_search
       /* Gotcha */
       break;
     }
-    /* Free temporary result */
-    free(ret_oid->oid);
   }
 }
 
@@ -221,12 +238,11 @@ void
 snmp_getnext(struct snmp_datagram *sdg)
 {
   struct list_head *curr;
-  struct var_bind *vb_in, *vb_out;
+  struct var_bind *vb_in;
   struct oid_search_res ret_oid;
-  uint32_t oid_len, len_len, val_len;
   uint32_t vb_in_cnt = 0;
-  const uint32_t tag_len = 1;
 
+  snmp_response_init(sdg);
   memset(&ret_oid, 0, sizeof(ret_oid));
   ret_oid.request = SNMP_REQ_GETNEXT;
 
@@ -241,13 +257,6 @@ snmp_getnext(struct snmp_datagram *sdg)
     /* Search the mib node at the next input oid */
     mib_getnext(sdg, vb_in, &ret_oid);
 
-    val_len = ber_value_enc_try(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var));
-    vb_out = xmalloc(sizeof(*vb_out) + val_len);
-    vb_out->oid = ret_oid.oid;
-    vb_out->oid_len = ret_oid.id_len;
-    vb_out->value_type = tag(&ret_oid.var);
-    vb_out->value_len = ber_value_enc(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var), vb_out->value);
-
     /* Error status */
     if (ret_oid.err_stat) {
       if (!sdg->pdu_hdr.err_stat) {
@@ -257,22 +266,10 @@ snmp_getnext(struct snmp_datagram *sdg)
       }
     }
 
-    /* OID length encoding */
-    oid_len = ber_value_enc_try(vb_out->oid, vb_out->oid_len, ASN1_TAG_OBJID);
-    len_len = ber_length_enc_try(oid_len);
-    vb_out->vb_len = tag_len + len_len + oid_len;
-
-    /* Value length encoding */
-    len_len = ber_length_enc_try(vb_out->value_len);
-    vb_out->vb_len += tag_len + len_len + vb_out->value_len;
-
-    /* Varbind length encoding */
-    len_len = ber_length_enc_try(vb_out->vb_len);
-    sdg->vb_list_len += tag_len + len_len + vb_out->vb_len;
-
-    /* Add into list. */
-    list_add_tail(&vb_out->link, &sdg->vb_out_list);
-    sdg->vb_out_cnt++;
+    if (!snmp_response_vb_add(sdg, ret_oid.oid, ret_oid.id_len, tag(&ret_oid.var), &ret_oid.var)) {
+      snmp_too_big(sdg);
+      return;
+    }
   }
 
   snmp_response(sdg);
@@ -286,8 +283,8 @@ mib_set(struct snmp_datagram *sdg, struct var_bind *vb_in, struct oid_search_res
 
   ret = mib_access_check(sdg, vb_in->oid, vb_in->oid_len, ACC_CHECK_WR);
   if (ret != SNMP_ERR_STAT_NO_ERR) {
-    /* Duplicate original oid */
-    ret_oid->oid = oid_dup(vb_in->oid, vb_in->oid_len);
+    /* Copy original oid */
+    oid_cpy(ret_oid->oid, vb_in->oid, vb_in->oid_len);
     ret_oid->id_len = vb_in->oid_len;
     ret_oid->err_stat = ret;
     return;
@@ -303,19 +300,21 @@ mib_set(struct snmp_datagram *sdg, struct var_bind *vb_in, struct oid_search_res
 
     /* End of mib view */
     if (view == NULL) {
-      /* Duplicate original oid when result not found */
-      ret_oid->oid = oid_dup(vb_in->oid, vb_in->oid_len);
+      /* Copy original oid when result not found */
+      oid_cpy(ret_oid->oid, vb_in->oid, vb_in->oid_len);
       ret_oid->id_len = vb_in->oid_len;
       return;
     }
 
     mib_tree_search(view, vb_in->oid, vb_in->oid_len, ret_oid);
+    if (ret_oid->batch == MIB_BATCH_PENDING) {
+      /* Answered later by the batch handler */
+      return;
+    }
     if ((!ret_oid->err_stat && ASN1_TAG_VALID(tag(&ret_oid->var))) || oid_cmp(vb_in->oid, vb_in->oid_len, view->oid, view->id_len) < 0) {
       /* Gotcha or given oid ahead of all views */
       return;
     }
-    /* Free temporary result */
-    free(ret_oid->oid);
   }
 }
 
@@ -324,12 +323,11 @@ void
 snmp_set(struct snmp_datagram *sdg)
 {
   struct list_head *curr;
-  struct var_bind *vb_in, *vb_out;
+  struct var_bind *vb_in;
   struct oid_search_res ret_oid;
-  uint32_t oid_len, len_len, val_len;
   uint32_t vb_in_cnt = 0;
-  const uint32_t tag_len = 1;
 
+  snmp_response_init(sdg);
   memset(&ret_oid, 0, sizeof(ret_oid));
   ret_oid.request = SNMP_REQ_SET;
 
@@ -344,13 +342,6 @@ snmp_set(struct snmp_datagram *sdg)
     /* Search the mib node at the input oid and set it */
     mib_set(sdg, vb_in, &ret_oid);
 
-    val_len = ber_value_enc_try(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var));
-    vb_out = xmalloc(sizeof(*vb_out) + val_len);
-    vb_out->oid = ret_oid.oid;
-    vb_out->oid_len = ret_oid.id_len;
-    vb_out->value_type = vb_in->value_type;
-    vb_out->value_len = ber_value_enc(value(&ret_oid.var), val_len, tag(&ret_oid.var), vb_out->value);
-
     /* Invalid tags convert to error status for snmpset */
     if (!ret_oid.err_stat && !ASN1_TAG_VALID(tag(&ret_oid.var))) {
       ret_oid.err_stat = SNMP_ERR_STAT_NOT_WRITABLE;
@@ -365,92 +356,151 @@ snmp_set(struct snmp_datagram *sdg)
       }
     }
 
-    /* OID length encoding */
-    oid_len = ber_value_enc_try(vb_out->oid, vb_out->oid_len, ASN1_TAG_OBJID);
-    len_len = ber_length_enc_try(oid_len);
-    vb_out->vb_len = tag_len + len_len + oid_len;
+    if (!snmp_response_vb_add(sdg, ret_oid.oid, ret_oid.id_len, vb_in->value_type, &ret_oid.var)) {
+      snmp_too_big(sdg);
+      return;
+    }
+  }
 
-    /* Value length encoding */
-    len_len = ber_length_enc_try(vb_out->value_len);
-    vb_out->vb_len += tag_len + len_len + vb_out->value_len;
+  snmp_response(sdg);
+}
 
-    /* Varbind length encoding */
-    len_len = ber_length_enc_try(vb_out->vb_len);
-    sdg->vb_list_len += tag_len + len_len + vb_out->vb_len;
+/* Append the search result of the vb_idx-th request varbind to the response,
+ * return 0 if it would make the response exceed the size limit. */
+static int
+bulkget_vb_add(struct snmp_datagram *sdg, struct oid_search_res *ret_oid, uint32_t vb_idx)
+{
+  if (!snmp_response_vb_add(sdg, ret_oid->oid, ret_oid->id_len, tag(&ret_oid->var), &ret_oid->var)) {
+    return 0;
+  }
 
-    /* Add into list. */
-    list_add_tail(&vb_out->link, &sdg->vb_out_list);
-    sdg->vb_out_cnt++;
+  /* Error status */
+  if (ret_oid->err_stat) {
+    if (!sdg->pdu_hdr.err_stat) {
+      /* Report the first error varbind */
+      sdg->pdu_hdr.err_stat = ret_oid->err_stat;
+      sdg->pdu_hdr.err_idx = vb_idx;
+    }
   }
+  return 1;
+}
 
-  snmp_response(sdg);
+/* Search the successor of a request varbind */
+static void
+bulkget_vb_next(struct snmp_datagram *sdg, struct var_bind *vb_in, struct oid_search_res *ret_oid)
+{
+  /* Decode vb_in value first */
+  tag(&ret_oid->var) = vb_in->value_type;
+  length(&ret_oid->var) = ber_value_dec(vb_in->value, vb_in->value_len, tag(&ret_oid->var), value(&ret_oid->var));
+  ret_oid->err_stat = 0;
+  ret_oid->suspended = 0;
+
+  /* Search the mib node at the next input oid */
+  mib_getnext(sdg, vb_in, ret_oid);
 }
 
+/* GETBULK as RFC 3416: the first non-repeaters varbinds get one GETNEXT and
+ * the rest are walked max-repetitions times. */
 void
 snmp_bulkget(struct snmp_datagram *sdg)
 {
   struct list_head *curr;
-  struct var_bind *vb_in, *vb_out;
+  struct var_bind *vb_in;
   struct oid_search_res ret_oid;
-  uint32_t oid_len, len_len, val_len;
-  uint32_t vb_in_cnt = 0;
-  uint32_t repeat;
-  const uint32_t tag_len = 1;
+  uint32_t vb_in_cnt, vb_idx;
+  uint32_t non_rep, max_rep, cap, rep, ended_cnt;
+  uint8_t *ended;
+  oid_t *next_oid;
+  int added;
 
+  snmp_response_init(sdg);
   memset(&ret_oid, 0, sizeof(ret_oid));
   ret_oid.request = SNMP_REQ_GETNEXT;
-  repeat = sdg->pdu_hdr.err_idx;
+
+  /* Error status and error index stand for non-repeaters and max-repetitions */
+  non_rep = sdg->pdu_hdr.err_stat > 0 ? sdg->pdu_hdr.err_stat : 0;
+  max_rep = sdg->pdu_hdr.err_idx > 0 ? sdg->pdu_hdr.err_idx : 0;
+  sdg->pdu_hdr.err_stat = 0;
   sdg->pdu_hdr.err_idx = 0;
 
-  while (repeat-- > 0) {
-    list_for_each(curr, &sdg->vb_in_list) {
-      vb_in = list_entry(curr, struct var_bind, link);
-      vb_in_cnt++;
+  cap = prot_config.max_repetitions > 0 ? prot_config.max_repetitions : PROT_MAX_REPETITIONS;
+  if (max_rep > cap) {
+    max_rep = cap;
+  }
 
-      /* Decode vb_in value first */
-      tag(&ret_oid.var) = vb_in->value_type;
-      length(&ret_oid.var) = ber_value_dec(vb_in->value, vb_in->value_len, tag(&ret_oid.var), value(&ret_oid.var));
+  vb_in_cnt = 0;
+  list_for_each(curr, &sdg->vb_in_list) {
+    vb_in_cnt++;
+  }
+  if (non_rep > vb_in_cnt) {
+    non_rep = vb_in_cnt;
+  }
 
-      /* Search the mib node at the next input oid */
-      mib_getnext(sdg, vb_in, &ret_oid);
+  /* Non-repeaters */
+  vb_idx = 0;
+  list_for_each(curr, &sdg->vb_in_list) {
+    if (vb_idx == non_rep) {
+      break;
+    }
+    vb_in = list_entry(curr, struct var_bind, link);
+    bulkget_vb_next(sdg, vb_in, &ret_oid);
+    if (!bulkget_vb_add(sdg, &ret_oid, ++vb_idx)) {
+      /* Response is full, the rest is left out */
+      snmp_response(sdg);
+      return;
+    }
+  }
 
-      /* Return oid for the next query. */
-      free(vb_in->oid);
-      vb_in->oid = oid_dup(ret_oid.oid, ret_oid.id_len);
-      vb_in->oid_len = ret_oid.id_len;
+  if (non_rep == vb_in_cnt || max_rep == 0) {
+    snmp_response(sdg);
+    return;
+  }
+
+  /* Repeaters, a varbind at the end of mib view is not searched again */
+  ended = arena_alloc(&sdg->arena, vb_in_cnt - non_rep);
+  memset(ended, 0, vb_in_cnt - non_rep);
+  ended_cnt = 0;
+  /* Oids to search from in the next repetition */
+  next_oid = arena_alloc(&sdg->arena, (vb_in_cnt - non_rep) * ASN1_OID_MAX_LEN * sizeof(oid_t));
 
-      val_len = ber_value_enc_try(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var));
-      vb_out = xmalloc(sizeof(*vb_out) + val_len);
-      vb_out->oid = ret_oid.oid;
-      vb_out->oid_len = ret_oid.id_len;
-      vb_out->value_type = tag(&ret_oid.var);
-      vb_out->value_len = ber_value_enc(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var), vb_out->value);
-
-      /* Error status */
-      if (ret_oid.err_stat) {
-        if (!sdg->pdu_hdr.err_stat) {
-          /* Report the first error varbind */
-          sdg->pdu_hdr.err_stat = ret_oid.err_stat;
-          sdg->pdu_hdr.err_idx = vb_in_cnt;
-        }
+  for (rep = 0; rep < max_rep && ended_cnt < vb_in_cnt - non_rep; rep++) {
+    vb_idx = 0;
+    list_for_each(curr, &sdg->vb_in_list) {
+      if (vb_idx++ < non_rep) {
+        continue;
       }
+      vb_in = list_entry(curr, struct var_bind, link);
 
-      /* OID length encoding */
-      oid_len = ber_value_enc_try(vb_out->oid, vb_out->oid_len, ASN1_TAG_OBJID);
-      len_len = ber_length_enc_try(oid_len);
-      vb_out->vb_len = tag_len + len_len + oid_len;
+      if (ended[vb_idx - non_rep - 1]) {
+        oid_cpy(ret_oid.oid, vb_in->oid, vb_in->oid_len);
+        ret_oid.id_len = vb_in->oid_len;
+        ret_oid.err_stat = 0;
+        tag(&ret_oid.var) = ASN1_TAG_END_OF_MIB_VIEW;
+        length(&ret_oid.var) = 0;
+        added = bulkget_vb_add(sdg, &ret_oid, vb_idx);
+      } else {
+        bulkget_vb_next(sdg, vb_in, &ret_oid);
+        added = bulkget_vb_add(sdg, &ret_oid, vb_idx);
+      }
 
-      /* Value length encoding */
-      len_len = ber_length_enc_try(vb_out->value_len);
-      vb_out->vb_len += tag_len + len_len + vb_out->value_len;
+      if (!added) {
+        /* Stop adding repetitions as soon as the response is full */
+        snmp_response(sdg);
+        return;
+      }
+      if (ended[vb_idx - non_rep - 1]) {
+        continue;
+      }
 
-      /* Varbind length encoding */
-      len_len = ber_length_enc_try(vb_out->vb_len);
-      sdg->vb_list_len += tag_len + len_len + vb_out->vb_len;
+      /* A suspended handler ends the walk until the request is served again */
+      if (tag(&ret_oid.var) == ASN1_TAG_END_OF_MIB_VIEW || ret_oid.suspended) {
+        ended[vb_idx - non_rep - 1] = 1;
+        ended_cnt++;
+      }
 
-      /* Add into list. */
-      list_add_tail(&vb_out->link, &sdg->vb_out_list);
-      sdg->vb_out_cnt++;
+      /* Return oid for the next query */
+      vb_in->oid = oid_cpy(next_oid + (vb_idx - non_rep - 1) * ASN1_OID_MAX_LEN, ret_oid.oid, ret_oid.id_len);
+      vb_in->oid_len = ret_oid.id_len;
     }
   }
 
@@ -32,6 +32,7 @@
 #include "event_loop.h"
 
 static struct trap_datagram snmp_trap_datagram;
+static void snmp_trap_probe(void);
 
 static void
 trap_datagram_clear(struct trap_datagram *tdg)
@@ -278,7 +279,14 @@ snmp_trap_send(uint8_t version, const char *community, uint32_t comm_len, uint32
   return ret;
 }
 
-/* Enable SNMP trap feature */
+/* Traps are probed on schedule whatever the request load is */
+static void
+snmp_trap_timer(void *ud)
+{
+  snmp_trap_probe();
+}
+
+/* Enable SNMP trap feature, poll_interv is in ticks of 10 milliseconds */
 static int
 snmp_trap_open(lua_State *L, long poll_interv, int handler)
 {
@@ -293,7 +301,13 @@ snmp_trap_open(lua_State *L, long poll_interv, int handler)
   tdg->lua_handler = handler;
   INIT_LIST_HEAD(&tdg->vb_list);
 
-  snmp_event_timeout(poll_interv);
+  if (tdg->timer > 0) {
+    snmp_timer_remove(tdg->timer, snmp_trap_timer);
+  }
+  if (poll_interv < 1) {
+    poll_interv = 1;
+  }
+  tdg->timer = snmp_timer_add(poll_interv * 10, poll_interv * 10, snmp_trap_timer, NULL);
   return 0;
 }
 
@@ -305,7 +319,8 @@ snmp_trap_close(void)
 
   lua_State *L = tdg->lua_state;
   if (L != NULL) {
-    snmp_event_timeout(0);
+    snmp_timer_remove(tdg->timer, snmp_trap_timer);
+    tdg->timer = 0;
     luaL_unref(L, LUA_ENVIRONINDEX, tdg->lua_handler);
     close(snmp_trap_datagram.sock);
   }
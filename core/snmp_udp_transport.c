@@ -19,8 +19,13 @@
  *
  */
 
+#define _GNU_SOURCE
+
 #include <sys/socket.h>
 #include <sys/signalfd.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
 #include <netinet/in.h>
 
 #include <unistd.h>
@@ -28,6 +33,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <errno.h>
 
 #include "transport.h"
 #include "protocol.h"
@@ -37,13 +43,49 @@
 struct snmp_data_entry {
   int sock;
   int sigfd;
+  int port;
+  int worker_cnt;
+  pid_t workers[TRANSP_WORKERS_MAX];
+  struct sockaddr_in client_sin;
+};
+
+/* Outbound response with its own destination, the buffer is kept for reuse */
+struct snmp_send_entry {
   uint8_t *buf;
   int len;
-  struct sockaddr_in client_sin;
+  int cap;
+  struct sockaddr_in sin;
+};
+
+/* Bounded FIFO of responses waiting for the socket to become writable */
+struct snmp_send_queue {
+  int depth;
+  int policy;
+  int head;
+  int count;
+  int armed;
+  int paused;
+  struct snmp_send_entry *entry;
+};
+
+/* Datagrams drained by recvmmsg() and responses flushed by sendmmsg() */
+struct snmp_batch {
+  int size;
+  uint8_t *rx_buf[TRANSP_BATCH_MAX];
+  struct sockaddr_in rx_sin[TRANSP_BATCH_MAX];
+  struct iovec rx_iov[TRANSP_BATCH_MAX];
+  struct mmsghdr rx_msg[TRANSP_BATCH_MAX];
+  struct iovec tx_iov[TRANSP_BATCH_MAX];
+  struct mmsghdr tx_msg[TRANSP_BATCH_MAX];
 };
 
 static struct snmp_data_entry snmp_entry;
+static struct snmp_send_queue snmp_queue;
+static struct snmp_batch snmp_batch;
 static void transport_close(void);
+static void transport_workers_spawn(void);
+static void snmp_write_handler(int sock, unsigned char flag, void *ud);
+static transport_handler transport_read_handler(void);
 
 static void
 snmp_signal_handler(int sigfd, unsigned char flag, void *ud)
@@ -57,84 +99,513 @@ snmp_signal_handler(int sigfd, unsigned char flag, void *ud)
   }
 }
 
+static inline struct snmp_send_entry *
+send_queue_at(struct snmp_send_queue *q, int i)
+{
+  return &q->entry[(q->head + i) % q->depth];
+}
+
+/* Release the oldest response */
 static void
-snmp_write_handler(int sock, unsigned char flag, void *ud)
+send_queue_pop(struct snmp_send_queue *q)
 {
-  struct snmp_data_entry *entry = ud;
+  struct snmp_send_entry *e = send_queue_at(q, 0);
+
+  e->len = 0;
+  q->head = (q->head + 1) % q->depth;
+  q->count--;
+}
 
-  if (sendto(sock, entry->buf, entry->len, 0, (struct sockaddr *)&entry->client_sin, sizeof(struct sockaddr_in)) == -1) {
+/* Send one datagram, return -1 if the socket would block */
+static int
+send_queue_send_one(int sock, struct snmp_send_entry *e, int flags)
+{
+  while (sendto(sock, e->buf, e->len, flags, (struct sockaddr *)&e->sin, sizeof(struct sockaddr_in)) == -1) {
+    if (errno == EINTR) {
+      continue;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return -1;
+    }
     perror("sendto()");
-    snmp_event_done();
+    transp_stats.send_errors++;
+    return 0;
   }
-  free(entry->buf);
+  transp_stats.sent++;
+  return 0;
+}
+
+/* Send as many queued responses as the socket takes without blocking */
+static void
+send_queue_flush(int sock)
+{
+  int i, n;
+  struct snmp_send_queue *q = &snmp_queue;
+  struct snmp_batch *batch = &snmp_batch;
 
-  snmp_event_remove(sock, flag);
+  while (q->count > 0) {
+    if (batch->size > 1) {
+      /* Gather up to a batch of responses into one sendmmsg() */
+      n = q->count < batch->size ? q->count : batch->size;
+      for (i = 0; i < n; i++) {
+        struct snmp_send_entry *e = send_queue_at(q, i);
+        batch->tx_iov[i].iov_base = e->buf;
+        batch->tx_iov[i].iov_len = e->len;
+        batch->tx_msg[i].msg_hdr.msg_name = &e->sin;
+      }
+      n = sendmmsg(sock, batch->tx_msg, n, MSG_DONTWAIT);
+      if (n == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          break;
+        }
+        /* Skip the datagram that failed and go on with the rest */
+        perror("sendmmsg()");
+        transp_stats.send_errors++;
+        send_queue_pop(q);
+        continue;
+      }
+      transp_stats.sent += n;
+      while (n-- > 0) {
+        send_queue_pop(q);
+      }
+    } else {
+      if (send_queue_send_one(sock, send_queue_at(q, 0), MSG_DONTWAIT) < 0) {
+        break;
+      }
+      send_queue_pop(q);
+    }
+  }
+
+  /* Resume reading once half of the queue is drained */
+  if (q->paused && q->count <= q->depth / 2) {
+    q->paused = 0;
+    snmp_event_add(sock, SNMP_EV_READ | SNMP_EV_EDGE, transport_read_handler(), NULL);
+  }
+
+  /* Wait for writability only while something is left */
+  if (q->count > 0 && !q->armed) {
+    q->armed = 1;
+    snmp_event_add(sock, SNMP_EV_WRITE | SNMP_EV_EDGE, snmp_write_handler, NULL);
+  } else if (q->count == 0 && q->armed) {
+    q->armed = 0;
+    snmp_event_remove(sock, SNMP_EV_WRITE);
+  }
+}
+
+#ifndef USE_IO_URING
+/* Append a response, making room by the configured policy if full. The
+ * io_uring backend sends from its own ring slots instead */
+static void
+send_queue_push(int sock, uint8_t *buf, int len, const struct sockaddr_in *sin)
+{
+  struct snmp_send_queue *q = &snmp_queue;
+  struct snmp_send_entry *e;
+  struct snmp_send_entry now;
+
+  /* Nothing is waiting and responses are not gathered for sendmmsg(), try
+   * the socket right away */
+  if (q->count == 0 && snmp_batch.size <= 1) {
+    now.buf = buf;
+    now.len = len;
+    memcpy(&now.sin, sin, sizeof(struct sockaddr_in));
+    if (send_queue_send_one(sock, &now, MSG_DONTWAIT) == 0) {
+      transp_stats.enqueued++;
+      return;
+    }
+  }
+
+  if (q->count == q->depth) {
+    if (q->policy == TRANSP_QUEUE_BACKPRESSURE) {
+      /* Never lose a response, block on the oldest one instead */
+      send_queue_send_one(sock, send_queue_at(q, 0), 0);
+    } else {
+      transp_stats.dropped++;
+    }
+    send_queue_pop(q);
+  }
+
+  /* Copy out of the caller's buffer, slots only grow so it settles quickly */
+  e = send_queue_at(q, q->count++);
+  if (e->cap < len) {
+    e->buf = xrealloc(e->buf, len);
+    e->cap = len;
+  }
+  memcpy(e->buf, buf, len);
+  e->len = len;
+  memcpy(&e->sin, sin, sizeof(struct sockaddr_in));
+
+  transp_stats.enqueued++;
+  if (q->count > transp_stats.max_depth) {
+    transp_stats.max_depth = q->count;
+  }
+
+  /* Stop reading new requests while the queue is full */
+  if (q->policy == TRANSP_QUEUE_BACKPRESSURE && q->count == q->depth && !q->paused) {
+    q->paused = 1;
+    transp_stats.paused++;
+    snmp_event_remove(sock, SNMP_EV_READ);
+  }
+
+  /* Responses of resumed requests come from timer and fd callbacks, wait
+   * for writability here rather than for the next request */
+  if (!q->armed) {
+    q->armed = 1;
+    snmp_event_add(sock, SNMP_EV_WRITE | SNMP_EV_EDGE, snmp_write_handler, NULL);
+  }
 }
+#endif
 
+static void
+snmp_write_handler(int sock, unsigned char flag, void *ud)
+{
+  send_queue_flush(sock);
+}
+
+/* The socket is edge triggered, read until it would block or the budget
+ * of this wakeup is spent */
 static void
 snmp_read_handler(int sock, unsigned char flag, void *ud)
 {
-  socklen_t server_sz = sizeof(struct sockaddr_in);
-  int len;
-  uint8_t *buf;
+  socklen_t server_sz;
+  int len, budget = TRANSP_READ_BUDGET;
+  uint8_t *buf = snmp_batch.rx_buf[0];
+
+  while (!snmp_queue.paused) {
+    if (budget-- == 0) {
+      /* Come back on the next poll, re-adding triggers the edge again */
+      snmp_event_add(sock, SNMP_EV_READ | SNMP_EV_EDGE, snmp_read_handler, NULL);
+      break;
+    }
+
+    /* Receive UDP data, store the address of the sender in client_sin */
+    server_sz = sizeof(struct sockaddr_in);
+    len = recvfrom(sock, buf, TRANSP_BUF_SIZ, MSG_DONTWAIT, (struct sockaddr *)&snmp_entry.client_sin, &server_sz);
+    if (len == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("recvfrom()");
+        snmp_event_done();
+        return;
+      }
+      break;
+    }
+
+    /* Parse SNMP PDU in decoder */
+    if (len > 0) {
+      snmp_prot_ops.receive(buf, len);
+    }
+  }
 
-  buf = xmalloc(TRANSP_BUF_SIZ);
+  /* Responses left over are sent when the socket is writable */
+  send_queue_flush(sock);
+}
+
+/* The socket is edge triggered, read batches until one comes short or the
+ * budget of this wakeup is spent */
+static void
+snmp_batch_read_handler(int sock, unsigned char flag, void *ud)
+{
+  int i, n, budget = TRANSP_READ_BUDGET;
+  struct snmp_batch *batch = &snmp_batch;
+
+  while (!snmp_queue.paused) {
+    if (budget <= 0) {
+      /* Come back on the next poll, re-adding triggers the edge again */
+      snmp_event_add(sock, SNMP_EV_READ | SNMP_EV_EDGE, snmp_batch_read_handler, NULL);
+      break;
+    }
+
+    for (i = 0; i < batch->size; i++) {
+      batch->rx_msg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    }
 
-  /* Receive UDP data, store the address of the sender in client_sin */
-  len = recvfrom(sock, buf, TRANSP_BUF_SIZ, 0, (struct sockaddr *)&snmp_entry.client_sin, &server_sz);
-  if (len == -1) {
-    perror("recvfrom()");
-    snmp_event_done();
+    /* Drain up to batch size datagrams at a time */
+    n = recvmmsg(sock, batch->rx_msg, batch->size, MSG_DONTWAIT, NULL);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("recvmmsg()");
+        snmp_event_done();
+      }
+      return;
+    }
+
+    for (i = 0; i < n; i++) {
+      if (batch->rx_msg[i].msg_len > 0) {
+        memcpy(&snmp_entry.client_sin, &batch->rx_sin[i], sizeof(struct sockaddr_in));
+        snmp_prot_ops.receive(batch->rx_buf[i], batch->rx_msg[i].msg_len);
+      }
+    }
+
+    /* Flush all the responses produced in this batch */
+    send_queue_flush(sock);
+    budget -= n;
+    if (n < batch->size) {
+      break;
+    }
   }
+}
 
-  /* Parse SNMP PDU in decoder */
+#ifdef USE_IO_URING
+/* Datagram taken off the ring, the sender comes along with it */
+static void
+snmp_uring_recv_handler(int sock, uint8_t *buf, int len, struct sockaddr_in *sin)
+{
+  memcpy(&snmp_entry.client_sin, sin, sizeof(struct sockaddr_in));
   snmp_prot_ops.receive(buf, len);
 }
 
-/* Send snmp datagram as a UDP packet to the remote */
+static void
+snmp_uring_send_done(int res)
+{
+  if (res < 0) {
+    transp_stats.send_errors++;
+  } else {
+    transp_stats.sent++;
+  }
+}
+#endif
+
+/* Queue snmp datagram to be sent as a UDP packet to the current remote,
+ * buf still belongs to the caller */
 static void
 transport_send(uint8_t *buf, int len)
 {
-  snmp_entry.buf = buf;
-  snmp_entry.len = len;
-  snmp_event_add(snmp_entry.sock, SNMP_EV_WRITE, snmp_write_handler, &snmp_entry);
+#ifdef USE_IO_URING
+  /* The ring has its own send slots, the queue is not used */
+  if (snmp_event_send(snmp_entry.sock, buf, len, &snmp_entry.client_sin, snmp_uring_send_done) < 0) {
+    transp_stats.dropped++;
+  } else {
+    transp_stats.enqueued++;
+  }
+#else
+  send_queue_push(snmp_entry.sock, buf, len, &snmp_entry.client_sin);
+#endif
 }
 
 static void
-transport_running(void)
+transport_peer_get(struct sockaddr_in *sin)
+{
+  memcpy(sin, &snmp_entry.client_sin, sizeof(struct sockaddr_in));
+}
+
+static void
+transport_peer_set(const struct sockaddr_in *sin)
+{
+  memcpy(&snmp_entry.client_sin, sin, sizeof(struct sockaddr_in));
+}
+
+static transport_handler
+transport_read_handler(void)
 {
-  snmp_event_init();
-  snmp_event_add(snmp_entry.sock, SNMP_EV_READ, snmp_read_handler, NULL);
+  return snmp_batch.size > 1 ? snmp_batch_read_handler : snmp_read_handler;
+}
+
+static int
+transport_events_init(void)
+{
+  if (snmp_event_init() < 0) {
+    return -1;
+  }
+#ifdef USE_IO_URING
+  snmp_event_recv(snmp_entry.sock, snmp_uring_recv_handler);
+#else
+  snmp_event_add(snmp_entry.sock, SNMP_EV_READ | SNMP_EV_EDGE, transport_read_handler(), NULL);
+#endif
   snmp_event_add(snmp_entry.sigfd, SNMP_EV_READ, snmp_signal_handler, NULL);
+  return 0;
+}
+
+static void
+transport_running(void)
+{
+  transport_workers_spawn();
   snmp_event_run();
 }
 
 static int
 transport_step(long timeout)
 {
-  static int inited = 0;
-  if (inited == 0) {
-    snmp_event_init();
-    snmp_event_add(snmp_entry.sock, SNMP_EV_READ, snmp_read_handler, NULL);
-    snmp_event_add(snmp_entry.sigfd, SNMP_EV_READ, snmp_signal_handler, NULL);
-    inited = 1;
-  }
   return snmp_event_step(timeout);
 }
 
 static void
 transport_close(void)
 {
+  int i;
+
   snmp_event_done();
   close(snmp_entry.sock);
   close(snmp_entry.sigfd);
+
+  /* Stop the workers we forked */
+  for (i = 0; i < snmp_entry.worker_cnt; i++) {
+    kill(snmp_entry.workers[i], SIGINT);
+  }
+  for (i = 0; i < snmp_entry.worker_cnt; i++) {
+    waitpid(snmp_entry.workers[i], NULL, 0);
+  }
+  snmp_entry.worker_cnt = 0;
+
+  for (i = 0; i < TRANSP_BATCH_MAX; i++) {
+    free(snmp_batch.rx_buf[i]);
+    snmp_batch.rx_buf[i] = NULL;
+  }
+
+  for (i = 0; i < snmp_queue.depth; i++) {
+    free(snmp_queue.entry[i].buf);
+  }
+  free(snmp_queue.entry);
+  memset(&snmp_queue, 0, sizeof(snmp_queue));
+}
+
+/* Preallocate the receive ring, a single slot when batching is off */
+static void
+transport_batch_init(int size)
+{
+  int i;
+  struct snmp_batch *batch = &snmp_batch;
+
+  if (size < 1) {
+    size = 1;
+  } else if (size > TRANSP_BATCH_MAX) {
+    size = TRANSP_BATCH_MAX;
+  }
+
+  memset(batch, 0, sizeof(*batch));
+  batch->size = size;
+
+  for (i = 0; i < size; i++) {
+    batch->rx_buf[i] = xmalloc(TRANSP_BUF_SIZ);
+    batch->rx_iov[i].iov_base = batch->rx_buf[i];
+    batch->rx_iov[i].iov_len = TRANSP_BUF_SIZ;
+    batch->rx_msg[i].msg_hdr.msg_name = &batch->rx_sin[i];
+    batch->rx_msg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    batch->rx_msg[i].msg_hdr.msg_iov = &batch->rx_iov[i];
+    batch->rx_msg[i].msg_hdr.msg_iovlen = 1;
+
+    batch->tx_msg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    batch->tx_msg[i].msg_hdr.msg_iov = &batch->tx_iov[i];
+    batch->tx_msg[i].msg_hdr.msg_iovlen = 1;
+  }
+}
+
+/* Allocate the outbound queue, deep enough to hold a whole batch */
+static void
+transport_queue_init(int depth, int policy)
+{
+  struct snmp_send_queue *q = &snmp_queue;
+
+  if (depth <= 0) {
+    depth = TRANSP_QUEUE_DEPTH;
+  }
+  if (depth < snmp_batch.size) {
+    depth = snmp_batch.size;
+  }
+
+  memset(q, 0, sizeof(*q));
+  q->depth = depth;
+  q->policy = policy;
+  q->entry = xcalloc(depth, sizeof(struct snmp_send_entry));
+  memset(&transp_stats, 0, sizeof(transp_stats));
+}
+
+/* Create a UDP socket bound to port, shared by workers through SO_REUSEPORT */
+static int
+transport_socket(int port)
+{
+  int sock;
+  struct sockaddr_in sin;
+
+  sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock < 0) {
+    perror("usock");
+    return -1;
+  }
+
+  if (transp_config.workers > 1) {
+    int on = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on))) {
+      perror("setsockopt()");
+      close(sock);
+      return -1;
+    }
+  }
+
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+#ifdef LITTLE_ENDIAN
+  sin.sin_addr.s_addr = htonl(INADDR_ANY);
+  sin.sin_port = htons(port);
+#else
+  sin.sin_addr.s_addr = INADDR_ANY;
+  sin.sin_port = port;
+#endif
+
+  if (bind(sock, (struct sockaddr *)&sin, sizeof(sin))) {
+    perror("bind()");
+    close(sock);
+    return -1;
+  }
+
+  return sock;
+}
+
+/*
+ * Fork the extra workers. Each one inherits a copy of the Lua state and the
+ * mib tree loaded so far and opens its own socket on the same port, so the
+ * kernel spreads incoming requests across them.
+ */
+static void
+transport_workers_spawn(void)
+{
+  int i;
+  pid_t pid;
+
+  fflush(NULL);
+
+  for (i = 1; i < transp_config.workers; i++) {
+    pid = fork();
+    if (pid < 0) {
+      perror("fork()");
+      break;
+    }
+
+    if (pid == 0) {
+      /* Quit together with the parent */
+      prctl(PR_SET_PDEATHSIG, SIGINT);
+      snmp_entry.worker_cnt = 0;
+      close(snmp_entry.sock);
+      snmp_entry.sock = transport_socket(snmp_entry.port);
+      if (snmp_entry.sock < 0) {
+        exit(1);
+      }
+      /* Trap polling and Lua timer() jobs stay with the parent, otherwise
+       * every trap and periodic job would run once per worker */
+      snmp_timer_clear();
+      /* The poll fd of the parent is shared, build our own */
+      snmp_event_done();
+      if (transport_events_init() < 0) {
+        exit(1);
+      }
+      return;
+    }
+
+    snmp_entry.workers[snmp_entry.worker_cnt++] = pid;
+  }
 }
 
 static int
 transport_init(int port)
 {
   sigset_t mask;
-  struct sockaddr_in sin;
 
   /* SNMP signal */
   sigemptyset(&mask);
@@ -147,25 +618,24 @@ transport_init(int port)
     return -1;
   }
 
+  /* Workers */
+  if (transp_config.workers > TRANSP_WORKERS_MAX) {
+    transp_config.workers = TRANSP_WORKERS_MAX;
+  }
+
   /* SNMP socket */
-  snmp_entry.sock = socket(AF_INET, SOCK_DGRAM, 0);
+  snmp_entry.port = port;
+  snmp_entry.worker_cnt = 0;
+  snmp_entry.sock = transport_socket(port);
   if (snmp_entry.sock < 0) {
-    perror("usock");
     return -1;
   }
 
-  memset(&sin, 0, sizeof(sin));
-  sin.sin_family = AF_INET;
-#ifdef LITTLE_ENDIAN
-  sin.sin_addr.s_addr = htonl(INADDR_ANY);
-  sin.sin_port = htons(port);
-#else
-  sin.sin_addr.s_addr = INADDR_ANY;
-  sin.sin_port = port;
-#endif
+  transport_batch_init(transp_config.batch);
+  transport_queue_init(transp_config.queue_depth, transp_config.queue_policy);
 
-  if (bind(snmp_entry.sock, (struct sockaddr *)&sin, sizeof(sin))) {
-    perror("bind()");
+  /* Fail here rather than in a loop that never wakes up */
+  if (transport_events_init() < 0) {
     close(snmp_entry.sock);
     return -1;
   }
@@ -180,4 +650,6 @@ struct transport_operation snmp_transp_ops = {
   transport_close,
   transport_send,
   transport_step,
+  transport_peer_get,
+  transport_peer_set,
 };
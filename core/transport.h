@@ -23,8 +23,39 @@
 #define _TRANSPORT_H_
 
 #include <stdint.h>
+#include <netinet/in.h>
 
 #define TRANSP_BUF_SIZ  (65536)
+#define TRANSP_BATCH_MAX  (64)
+#define TRANSP_QUEUE_DEPTH  (64)
+/* Datagrams read per wakeup before other events get their turn */
+#define TRANSP_READ_BUDGET  (64)
+#define TRANSP_WORKERS_MAX  (64)
+
+/* What to do when the outbound queue is full */
+#define TRANSP_QUEUE_DROP_OLDEST  0
+#define TRANSP_QUEUE_BACKPRESSURE  1
+
+/* Transport tunables, filled in before init */
+struct transport_config {
+  /* Datagrams drained per wakeup, 0 or 1 means no batching */
+  int batch;
+  /* Outbound queue depth, 0 means TRANSP_QUEUE_DEPTH */
+  int queue_depth;
+  int queue_policy;
+  /* Processes serving the port through SO_REUSEPORT, 0 or 1 means one */
+  int workers;
+};
+
+/* Outbound queue counters */
+struct transport_stats {
+  uint32_t enqueued;
+  uint32_t sent;
+  uint32_t dropped;
+  uint32_t send_errors;
+  uint32_t max_depth;
+  uint32_t paused;
+};
 
 struct transport_operation {
   const char *name;
@@ -33,9 +64,15 @@ struct transport_operation {
   void (*close)(void);
   void (*send)(uint8_t *buf, int len);
   int (*step)(long timeout);
+  /* Sender of the datagram being received, kept by requests answered
+   * later, NULL for stream transports */
+  void (*peer_get)(struct sockaddr_in *sin);
+  void (*peer_set)(const struct sockaddr_in *sin);
 };
 
 extern struct transport_operation snmp_transp_ops;
 extern struct transport_operation agentx_transp_ops;
+extern struct transport_config transp_config;
+extern struct transport_stats transp_stats;
 
 #endif /* _TRANSPORT_H_ */
@@ -72,6 +72,8 @@ struct trap_datagram {
 
   lua_State *lua_state;
   int lua_handler;
+  /* Probing timer in the event loop */
+  int timer;
 
   void *send_buf;
   uint32_t send_len;
@@ -111,6 +111,33 @@ function _M.module_method_unregister(name)
     _M.module_methods[name] = nil
 end
 
+-- Wait until fd is ready for op, or for timeout milliseconds if given.
+-- Handlers serving GET, GETNEXT and GETBULK run as coroutines and yield
+-- to the agent meanwhile, elsewhere it waits in place.
+local wait = function (op, fd, timeout)
+    if coroutine.running() == nil then
+        return core.wait(op, fd, timeout)
+    end
+    return coroutine.yield(op, fd, timeout)
+end
+
+-- Wait until file (a descriptor or a Lua file) is readable, return true
+-- if it is, false on timeout.
+function _M.wait_readable(file, timeout)
+    return wait('read', core.fileno(file), timeout)
+end
+
+-- Wait until file (a descriptor or a Lua file) is writable, return true
+-- if it is, false on timeout.
+function _M.wait_writable(file, timeout)
+    return wait('write', core.fileno(file), timeout)
+end
+
+-- Sleep for ms milliseconds, 0 lets the pending requests be served.
+function _M.sleep(ms)
+    return wait('sleep', -1, ms)
+end
+
 -- Shell command invoke.
 function _M.sh_call(command, rmode)
     if type(command) ~= 'string' or type(rmode) ~= 'string' then
@@ -120,6 +147,7 @@ function _M.sh_call(command, rmode)
     local t = nil
     local f = io.popen(command)
     if f then
+        _M.wait_readable(f)
         t = f:read(rmode)
         f:close()
     end
@@ -346,9 +374,13 @@ local mib_group_indexes_generate = function (group, name)
 
                     -- indexes
                     assert(entry.indexes ~= nil, string.format("%s[%d][%d]: What is the entry.indexes?", name, obj_no, entry_no))
-                    assert(type(entry.indexes) == 'table', string.format("%s[%d][%d]: Entry indexes must be table", name, obj_no, entry_no))
+                    assert(type(entry.indexes) == 'table' or type(entry.indexes) == 'userdata', string.format("%s[%d][%d]: Entry indexes must be table or row index", name, obj_no, entry_no))
 
-                    if entry.indexes.cascade == true then
+                    if type(entry.indexes) == 'userdata' then
+                        -- rows are indexed in C which answers getnext itself,
+                        -- an empty dim makes the traversal here skip the table.
+                        table.insert(table_indexes, {})
+                    elseif entry.indexes.cascade == true then
                         for _, indexes in ipairs(entry.indexes) do
                             table.sort(indexes)
                             table.insert(table_indexes, indexes)
@@ -425,6 +457,46 @@ local mib_group_indexes_generate = function (group, name)
     return group_indexes
 end
 
+-- Generated index tables cached per group, weak keyed so that dropped groups
+-- can be collected.
+local group_index_cache = setmetatable({}, { __mode = 'k' })
+
+-- Record the indexes container of every table entry in the group
+local mib_group_indexes_sources = function (group)
+    local sources = {}
+    for obj_no, tab in pairs(group) do
+        if type(obj_no) == 'number' and tab.get_f == nil then
+            local _, entry = next(tab)
+            if type(entry) == 'table' then
+                table.insert(sources, { entry = entry, indexes = entry.indexes })
+            end
+        end
+    end
+    return sources
+end
+
+-- Reuse the generated index table until a table's indexes container is
+-- replaced or the group is invalidated explicitly.
+local mib_group_indexes_cached = function (group, name)
+    local cache = group_index_cache[group]
+    if cache ~= nil then
+        for _, src in ipairs(cache.sources) do
+            if src.entry.indexes ~= src.indexes then
+                cache = nil
+                break
+            end
+        end
+    end
+    if cache == nil then
+        cache = {
+            index_table = mib_group_indexes_generate(group, name),
+            sources = mib_group_indexes_sources(group),
+        }
+        group_index_cache[group] = cache
+    end
+    return cache.index_table
+end
+
 -- Only called by group_index_table_getnext
 local function getnext(
     oid,          -- request oid
@@ -476,6 +548,8 @@ local function getnext(
         -- then point to first element
         oid = concat(oid, #oid + 1, it[dim][1])
         if dim == #it then
+            record[dim].offset = offset
+            record[dim].pos = 1
             return oid
         else
             record[dim].offset = offset
@@ -504,6 +578,8 @@ local function getnext(
                 oid = concat(oid, offset, xl[i])
                 -- all dim found, return it
                 if dim == #it then
+                    record[dim].offset = offset
+                    record[dim].pos = i
                     return oid
                 else
                     record[dim].offset = offset
@@ -540,9 +616,86 @@ local function getnext(
     return getnext(oid, offset, record, it, dim)
 end
 
--- Group index table iterator
+-- Where the last getnexts stopped in each index table: the oid returned and
+-- the position reached in every dimension. A few are kept per table so that
+-- walks of several columns at once do not evict each other.
+local GETNEXT_CURSORS = 4
+local getnext_cursors = setmetatable({}, { __mode = 'k' })
+
+local getnext_cursor_find = function (cursors, oid)
+    if #oid == 0 then return nil end
+    for _, cursor in ipairs(cursors) do
+        if #cursor.oid == #oid then
+            local match = true
+            for i = 1, #oid do
+                if oid[i] ~= cursor.oid[i] then
+                    match = false
+                    break
+                end
+            end
+            if match then return cursor end
+        end
+    end
+    return nil
+end
+
+-- The oid following the cursor, the last dimension that is not exhausted
+-- moves on and the ones after it start over.
+local getnext_step = function (cursor, it)
+    local record = cursor.record
+    for dim = #it, 1, -1 do
+        local pos = record[dim].pos + 1
+        if pos <= #it[dim] then
+            local oid = {}
+            for i = 1, record[dim].offset - 1 do
+                oid[i] = cursor.oid[i]
+            end
+            for d = dim, #it do
+                record[d].offset = #oid + 1
+                record[d].pos = d == dim and pos or 1
+                local e = it[d][record[d].pos]
+                if type(e) == 'table' then
+                    for _, id in ipairs(e) do
+                        table.insert(oid, id)
+                    end
+                else
+                    table.insert(oid, e)
+                end
+            end
+            return oid
+        end
+    end
+    return {}
+end
+
+-- Group index table iterator, a walk asking for the oid returned last time
+-- steps on from its cursor instead of scanning the dimensions again.
 local function group_index_table_getnext(oid, it)
-    return getnext(oid, 1, {}, it, 1)
+    local cursors = getnext_cursors[it]
+    if cursors == nil then
+        cursors = { victim = 1 }
+        getnext_cursors[it] = cursors
+    end
+
+    local rsp_oid
+    local cursor = getnext_cursor_find(cursors, oid)
+    if cursor ~= nil then
+        rsp_oid = getnext_step(cursor, it)
+    else
+        cursor = { record = {} }
+        rsp_oid = getnext(oid, 1, cursor.record, it, 1)
+        if next(rsp_oid) ~= nil then
+            cursors[cursors.victim] = cursor
+            cursors.victim = cursors.victim % GETNEXT_CURSORS + 1
+        end
+    end
+
+    -- Callers modify the returned oid, keep a copy
+    cursor.oid = {}
+    for i, id in ipairs(rsp_oid) do
+        cursor.oid[i] = id
+    end
+    return rsp_oid
 end
 
 local ber_tag_match = {
@@ -569,13 +722,12 @@ local return_value_check = function(g, v, t)
     end
 end
 
--- Search and operation
-local mib_node_search = function(group, name, op, req_sub_oid, req_val, req_val_type)
+-- Operation on one request with the group indexes fetched
+local mib_node_handle = function(group, name, group_index_table, op, req_sub_oid, req_val, req_val_type)
     local err_stat = nil
     local rsp_sub_oid = nil
     local rsp_val = nil
     local rsp_val_type = nil
-    local group_index_table = nil
     -- Search obj_id in group index table.
     local effective_object_index = function (tab, id)
         for i in ipairs(tab) do
@@ -818,15 +970,34 @@ local mib_node_search = function(group, name, op, req_sub_oid, req_val, req_val_
         end
     end
 
+    local H = handlers[op]
+    return H()
+end
+
+-- Search and operation
+local mib_node_search = function(group, name, op, req_sub_oid, req_val, req_val_type)
     -- Pre-process IO for mib group
     if group.io_f ~= nil then
         group.io_f()
     end
-    -- Regenerate mib group indexes before handler process
-    group_index_table = mib_group_indexes_generate(group, name)
+    -- Fetch mib group indexes before handler process
+    local group_index_table = mib_group_indexes_cached(group, name)
+    return mib_node_handle(group, name, group_index_table, op, req_sub_oid, req_val, req_val_type)
+end
 
-    local H = handlers[op]
-    return H()
+-- Search a batch of requests, IO and indexes are done once for all of them.
+-- Results are returned as arrays in the order of requests.
+local mib_node_search_batch = function(group, name, op, req_sub_oids)
+    if group.io_f ~= nil then
+        group.io_f()
+    end
+    local group_index_table = mib_group_indexes_cached(group, name)
+    local errs, vals, tags = {}, {}, {}
+    for i, req_sub_oid in ipairs(req_sub_oids) do
+        local err, _, val, tag = mib_node_handle(group, name, group_index_table, op, req_sub_oid)
+        errs[i], vals[i], tags[i] = err, val, tag
+    end
+    return errs, vals, tags
 end
 
 --
@@ -834,8 +1005,11 @@ end
 --
 
 -- initialize snmp agent
-_M.init = function (protocol, port)
-    return core.init(protocol, port)
+_M.init = function (protocol, port, opts)
+    if opts ~= nil then
+        assert(type(opts) == 'table', 'Options must be table')
+    end
+    return core.init(protocol, port, opts)
 end
 
 -- open snmp agent
@@ -853,6 +1027,27 @@ _M.step = function (tm)
     core.step(tm)
 end
 
+-- outbound queue counters
+_M.transport_stats = function ()
+    return core.transport_stats()
+end
+
+-- run func after delay milliseconds, then every interval milliseconds
+_M.timer = function (delay, interval, func)
+    if func == nil then
+        func, interval = interval, 0
+    end
+    assert(type(delay) == 'number' and type(interval) == 'number')
+    assert(type(func) == 'function')
+    return core.timer_add(delay, interval, func)
+end
+
+-- cancel a timer
+_M.timer_cancel = function (id)
+    assert(type(id) == 'number')
+    core.timer_del(id)
+end
+
 -- set read only community
 _M.set_ro_community = function (community, oid)
     assert(type(community) == 'string')
@@ -909,12 +1104,37 @@ _M.security_setup = function (security_mode)
     core.mib_security_mode(security_mode)
 end
 
--- register an mib group node
-_M.register_mib_group = function (oid, group, name)
+-- register an mib group node, opts.cache_ttl caches its values in
+-- milliseconds
+_M.register_mib_group = function (oid, group, name, opts)
     local mib_search_handler = function (op, req_sub_oid, req_val, req_val_type)
         return mib_node_search(group, name, op, req_sub_oid, req_val, req_val_type)
     end
-    core.mib_node_reg(oid, mib_search_handler)
+    local mib_batch_handler = function (op, req_sub_oids)
+        return mib_node_search_batch(group, name, op, req_sub_oids)
+    end
+    if core.mib_node_reg(oid, mib_search_handler) == 0 then
+        core.mib_batch_reg(oid, mib_batch_handler)
+        if opts ~= nil and opts.cache_ttl ~= nil then
+            core.mib_cache_reg(oid, opts.cache_ttl)
+        end
+    end
+    -- attach tables indexed in C
+    for obj_no, tab in pairs(group) do
+        if type(obj_no) == 'number' and tab.get_f == nil then
+            local entry_no, entry = next(tab)
+            if type(entry) == 'table' and type(entry.indexes) == 'userdata' then
+                local columns = {}
+                for var_no, variable in pairs(entry) do
+                    if type(var_no) == 'number' and variable.access ~= MIB_ACES_UNA then
+                        table.insert(columns, var_no)
+                    end
+                end
+                table.sort(columns)
+                core.mib_table_reg(oid, obj_no, entry_no, columns, entry.indexes)
+            end
+        end
+    end
 end
 
 -- unregister an mib group node
@@ -922,6 +1142,35 @@ _M.unregister_mib_group = function(oid)
     core.mib_node_unreg(oid)
 end
 
+-- register an mib group served from a shared memory counter segment
+_M.register_shm_group = function (oid, path)
+    assert(type(oid) == 'table' and type(path) == 'string')
+    return core.mib_shm_reg(oid, path)
+end
+
+-- unregister an mib group served from a shared memory counter segment
+_M.unregister_shm_group = function (oid)
+    return core.mib_shm_unreg(oid)
+end
+
+-- load a C plugin serving its own mib groups
+_M.load_plugin = function (path)
+    assert(type(path) == 'string')
+    return core.plugin_load(path)
+end
+
+-- create a row index kept in C, used as entry.indexes of a table
+_M.row_index = function ()
+    return core.mib_index_new()
+end
+
+-- drop the cached indexes of an mib group after its indexes containers
+-- are modified in place
+_M.invalidate = function (group)
+    assert(type(group) == 'table')
+    group_index_cache[group] = nil
+end
+
 -- print group index table through group indexes generator
 _M.mib_group_indexes_check = function(group, name)
     local it = mib_group_indexes_generate(group, name)
@@ -74,6 +74,16 @@ __load_config()
 
 mib.module_methods.or_table_reg("1.3.6.1.2.1.4", "The MIB module for managing IP and ICMP inplementations")
 
+local ipGroup
+
+-- Row keys of the route and net-to-media tables are changed in place by
+-- SET, drop the cached indexes
+local ip_indexes_changed = function ()
+    if ipGroup ~= nil then
+        mib.invalidate(ipGroup)
+    end
+end
+
 local ip_AdEnt_entry_get = function(sub_oid, name)
     assert(type(name) == 'string')
     local value
@@ -120,6 +130,7 @@ local ip_RouteIf_entry_set = function(sub_oid, v, name)
             if name == '' then
                 ip_RouteIf_cache[table.concat(v, ".")] = ip_RouteIf_cache[key]
                 ip_RouteIf_cache[key] = nil
+                ip_indexes_changed()
             else
                 ip_RouteIf_cache[key][name] = v
             end
@@ -149,7 +160,7 @@ local ip_NetToMedia_entry_set = function(sub_oid, v, name)
     end
 end
 
-local ipGroup = {
+ipGroup = {
     io_f = load_config,
     [1]  = mib.Int(function () return ip_scalar_cache[1] end, function (v) ip_scalar_cache[1] = v end),
     [2]  = mib.Int(function () return ip_scalar_cache[2] end, function (v) ip_scalar_cache[2] = v end),
@@ -208,6 +219,7 @@ local ipGroup = {
                                       sub_oid[1] = value
                                       ip_NetToMedia_cache[table.concat(sub_oid, ".")] = old
                                       old = nil
+                                      ip_indexes_changed()
                                   end
                               end
                           end),
@@ -234,6 +246,7 @@ local ipGroup = {
                                          end
                                          ip_NetToMedia_cache[table.concat(sub_oid, ".")] = old
                                          old = nil
+                                         ip_indexes_changed()
                                      end
                                  end
                              end),
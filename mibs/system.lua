@@ -67,6 +67,15 @@ end
 
 mib_system_startup(os.time())
 
+local sysGroup
+
+-- or_entry_cache is modified in place, drop the cached indexes
+local or_table_changed = function ()
+    if sysGroup ~= nil then
+        mib.invalidate(sysGroup)
+    end
+end
+
 local or_table_reg = function (oid, desc)
     local entry = {}
     entry['oid'] = {}
@@ -78,6 +87,7 @@ local or_table_reg = function (oid, desc)
     table.insert(or_entry_cache, entry)
 
     or_last_changed_time = os.time()
+    or_table_changed()
 
     or_oid_cache[oid] = #or_entry_cache
 end
@@ -85,16 +95,10 @@ end
 local or_table_unreg = function (oid)
     local or_idx = or_oid_cache[oid]
 
-    if or_entry_cache[or_idx] ~= nil then
-        table.remove(or_entry_cache, or_idx)
-        or_last_changed_time = os.ti    local or_idx = or_oid_cache[oid]
-
     if or_entry_cache[or_idx] ~= nil then
         table.remove(or_entry_cache, or_idx)
         or_last_changed_time = os.time()
-    end
-
-    or_oid_cache[oid] = nilme()
+        or_table_changed()
     end
 
     or_oid_cache[oid] = nil
@@ -107,7 +111,7 @@ local sysMethods = {
 
 mib.module_method_register(sysMethods)
 
-local sysGroup = {
+sysGroup = {
     [sysDesc]         = mib.ConstOctString(function () return mib.sh_call("uname -a", "*line") end),
     [sysObjectID]     = mib.ConstOid(function () return { 1, 3, 6, 1, 2, 1, 1 } end),
     [sysUpTime]       = mib.ConstTimeticks(function () return os.difftime(os.time(), startup_time) * 100 end),
@@ -93,16 +93,22 @@ local hex2num = function(hex)
 end
 
 local __load_config = function()
-    tcp_scalar_cache = {}
-    tcp_conn_entry_cache = {}
+    -- Filled aside, requests served while it gives way see the last load
+    local scalar_cache = {}
+    local conn_entry_cache = {}
     for line in io.lines("/proc/net/snmp") do
         if string.match(line, "%w+") == 'Tcp' then
             for w in string.gmatch(line, "%d+") do
-                table.insert(tcp_scalar_cache, tonumber(w))
+                table.insert(scalar_cache, tonumber(w))
             end
         end
     end
+    local n = 0
     for line in io.lines("/proc/net/tcp") do
+        n = n + 1
+        if n % 256 == 0 then
+            mib.sleep(0)
+        end
         local loc_addr = string.match(line, ".-:%s+(.-):")
         local loc_port = string.match(line, ".-:%s+.-:(.-)%s+")
         local rem_addr = string.match(line, ".-:.-:.-%s+(.-):")
@@ -115,10 +121,12 @@ local __load_config = function()
             table.insert(key, ip_hex2num(rem_addr))
             table.insert(key, tostring(hex2num(rem_port)))
             conn_stat = hex2num(conn_stat)
-            tcp_conn_entry_cache[table.concat(key, '.')] = {}
-            tcp_conn_entry_cache[table.concat(key, '.')].conn_stat = tcp_snmp_conn_stat_map[conn_stat]
+            conn_entry_cache[table.concat(key, '.')] = {}
+            conn_entry_cache[table.concat(key, '.')].conn_stat = tcp_snmp_conn_stat_map[conn_stat]
         end
     end
+    tcp_scalar_cache = scalar_cache
+    tcp_conn_entry_cache = conn_entry_cache
 end
 
 local last_load_time = os.time()
@@ -0,0 +1,38 @@
+io_uring_test = """
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+int main(void)
+{
+  int fd;
+  struct io_uring_params p;
+  struct io_uring_buf_reg reg;
+
+  memset(&p, 0, sizeof(p));
+  fd = syscall(__NR_io_uring_setup, 4, &p);
+  if (fd < 0)
+    exit(-1);
+
+  if (!(p.features & IORING_FEAT_EXT_ARG))
+    exit(-1);
+
+  /* Multishot recvmsg and provided buffer rings (Linux 5.19) */
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_entries = 1;
+  if (IORING_RECV_MULTISHOT == 0 || IORING_REGISTER_PBUF_RING == 0)
+    exit(-1);
+
+  close(fd);
+
+  return 0;
+}
+"""
+def CheckIoUring(context):
+  context.Message("Checking for io_uring...")
+  # Run it, a kernel without the features only shows up at runtime
+  result = context.TryRun(io_uring_test, '.c')
+  context.Result(result[0])
+  return result[0]
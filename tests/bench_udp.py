@@ -0,0 +1,141 @@
+#
+# This file is part of SmithSNMP
+# Copyright (C) 2014, Credo Semiconductor Inc.
+# Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# UDP transport benchmark: flood the agent with SNMPv2c GET requests from
+# several sockets and report responses per second with and without batching.
+#
+# Usage: python tests/bench_udp.py [batch] [seconds]
+
+import os, sys, time, socket, select, subprocess, tempfile
+
+env = {
+	'LUA_PATH': "lualib/?/init.lua;lualib/?.lua;./?.lua",
+	'LUA_CPATH': "build/?.so",
+}
+
+lua_exe = "lua5.1"
+if os.environ.has_key('LUA') is True:
+	lua_exe = os.getenv('LUA')
+
+bench_port = 16161
+bench_clients = 8
+bench_window = 32
+
+# Minimal BER encoding for a GET request
+def ber_len(n):
+	if n < 0x80:
+		return chr(n)
+	s = ""
+	while n > 0:
+		s = chr(n & 0xff) + s
+		n >>= 8
+	return chr(0x80 | len(s)) + s
+
+def ber_tlv(tag, payload):
+	return chr(tag) + ber_len(len(payload)) + payload
+
+def ber_int(n):
+	n &= 0x7fffffff
+	s = chr(n & 0xff)
+	n >>= 8
+	while n > 0:
+		s = chr(n & 0xff) + s
+		n >>= 8
+	if ord(s[0]) & 0x80:
+		s = "\x00" + s
+	return ber_tlv(0x02, s)
+
+def snmp_get_request(req_id, community = "public", oid = "\x2b\x06\x01\x02\x01\x01\x01\x00"):
+	vb = ber_tlv(0x30, ber_tlv(0x06, oid) + ber_tlv(0x05, ""))
+	pdu = ber_tlv(0xa0, ber_int(req_id) + ber_int(0) + ber_int(0) + ber_tlv(0x30, vb))
+	return ber_tlv(0x30, ber_int(1) + ber_tlv(0x04, community) + pdu)
+
+def agent_start(batch):
+	conf = tempfile.NamedTemporaryFile(suffix = ".conf", delete = False)
+	conf.write(open("config/snmp.conf").read())
+	conf.write("\nport = %d\nbatch = %d\n" % (bench_port, batch))
+	conf.close()
+	agent = subprocess.Popen([lua_exe, "./bin/smithsnmpd", "-c", conf.name], env = env, stdout = open(os.devnull, 'w'))
+	# Wait until the agent answers
+	probe = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+	probe.settimeout(0.2)
+	for i in range(50):
+		try:
+			probe.sendto(snmp_get_request(i), ("127.0.0.1", bench_port))
+			probe.recv(65536)
+			break
+		except socket.timeout:
+			pass
+	probe.close()
+	return agent, conf.name
+
+def agent_stop(agent, conf_name):
+	agent.terminate()
+	agent.wait()
+	os.unlink(conf_name)
+
+def bench(batch, seconds):
+	agent, conf_name = agent_start(batch)
+	socks = [socket.socket(socket.AF_INET, socket.SOCK_DGRAM) for i in range(bench_clients)]
+	req_id = 0
+	for s in socks:
+		s.setblocking(0)
+		for i in range(bench_window):
+			s.sendto(snmp_get_request(req_id), ("127.0.0.1", bench_port))
+			req_id += 1
+
+	responses = 0
+	start = time.time()
+	while time.time() - start < seconds:
+		readable, _, _ = select.select(socks, [], [], 0.1)
+		if not readable:
+			# Lost requests, refill every window
+			for s in socks:
+				for i in range(bench_window):
+					s.sendto(snmp_get_request(req_id), ("127.0.0.1", bench_port))
+					req_id += 1
+			continue
+		for s in readable:
+			while True:
+				try:
+					s.recv(65536)
+				except socket.error:
+					break
+				responses += 1
+				s.sendto(snmp_get_request(req_id), ("127.0.0.1", bench_port))
+				req_id += 1
+	elapsed = time.time() - start
+
+	for s in socks:
+		s.close()
+	agent_stop(agent, conf_name)
+	return responses / elapsed
+
+if __name__ == "__main__":
+	batch = 16
+	seconds = 5
+	if len(sys.argv) > 1:
+		batch = int(sys.argv[1])
+	if len(sys.argv) > 2:
+		seconds = int(sys.argv[2])
+
+	plain = bench(0, seconds)
+	batched = bench(batch, seconds)
+	print("without batching: %10.1f packets/sec" % plain)
+	print("batch = %-8d: %10.1f packets/sec (%.2fx)" % (batch, batched, batched / plain))
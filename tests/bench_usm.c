@@ -0,0 +1,541 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*
+ * USM benchmark: requests per second of authPriv GET requests through the
+ * whole agent, one user per authentication protocol, all with AES-128 CFB
+ * privacy. Responses are checked for their MAC and error status while
+ * warming up. The HMAC of a request sized message is timed as well, from
+ * the hash states precomputed per user the way the agent does it, and for
+ * MD5 and SHA-1 also keyed from the raw auth key (MD5_hmac/SHA1_hmac).
+ * So is the AES-128 CFB of the same message, expanding the key for it and
+ * from the schedule kept per user.
+ *
+ * Usage: scons bench_usm && build/bench_usm [rounds] (from the project root)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "protocol.h"
+#include "snmp.h"
+#include "utils.h"
+
+#define BENCH_WARMUP_ROUNDS  100
+#define BENCH_ROUNDS  20000
+
+int luaopen_smithsnmp_core(lua_State *L);
+
+static const char *bench_setup =
+  "package.path = 'lualib/?/init.lua;lualib/?.lua;' .. package.path\n"
+  "local mib = require 'smithsnmp'\n"
+  "mib.init('snmp', 16199, {})\n"
+  "mib.security_setup(mib.MIB_SEC_REQ_AUTH_REQ_PRIV)\n"
+  "mib.user_create('md5User', 0, 'md5AuthPhrase', 1, 'md5PrivPhrase')\n"
+  "mib.user_create('shaUser', 1, 'shaAuthPhrase', 1, 'shaPrivPhrase')\n"
+  "mib.user_create('sha256User', 2, 'sha256AuthPhrase', 1, 'sha256PrivPhrase')\n"
+  "mib.user_create('sha512User', 3, 'sha512AuthPhrase', 1, 'sha512PrivPhrase')\n"
+  "mib.set_ro_user('md5User')\n"
+  "mib.set_ro_user('shaUser')\n"
+  "mib.set_ro_user('sha256User')\n"
+  "mib.set_ro_user('sha512User')\n"
+  "mib.register_mib_group({ 1, 3, 6, 1, 4, 1, 8888, 9 }, {\n"
+  "    [1] = mib.ConstOctString(function () return 'SmithSNMP' end),\n"
+  "    [2] = mib.ConstInt(function () return 42 end),\n"
+  "}, 'bench')\n";
+
+/* 1.3.6.1.4.1.8888.9.1.0 */
+static const uint8_t bench_oid[] = { 0x2b, 0x06, 0x01, 0x04, 0x01, 0xc5, 0x38, 0x09, 0x01, 0x00 };
+
+struct bench_user {
+  const char *name;
+  const char *title;
+  uint8_t auth_mode;
+  uint32_t mac_len;
+  const char *auth_phrase;
+  const char *priv_phrase;
+  uint8_t auth_key[SHA512_SECRETKEYLEN];
+  union {
+    MD5_CTX md5[2];
+    SHA_CTX sha1[2];
+    SHA256_CTX sha256[2];
+    SHA512_CTX sha512[2];
+  } auth_ctx;
+  uint8_t priv_key[AES_SECRETKEYLEN];
+  AES_KEY priv_sched;
+  uint8_t buf[256];
+  int len;
+};
+
+static struct bench_user bench_users[] = {
+  { "md5User", "HMAC-MD5-96", SNMP_USER_AUTH_MD5, SNMP_MSG_AUTH_PARA_LEN, "md5AuthPhrase", "md5PrivPhrase" },
+  { "shaUser", "HMAC-SHA-96", SNMP_USER_AUTH_SHA1, SNMP_MSG_AUTH_PARA_LEN, "shaAuthPhrase", "shaPrivPhrase" },
+  { "sha256User", "HMAC-192-SHA-256", SNMP_USER_AUTH_SHA256, SNMP_MSG_AUTH_PARA_SHA256_LEN, "sha256AuthPhrase", "sha256PrivPhrase" },
+  { "sha512User", "HMAC-384-SHA-512", SNMP_USER_AUTH_SHA512, SNMP_MSG_AUTH_PARA_SHA512_LEN, "sha512AuthPhrase", "sha512PrivPhrase" },
+};
+
+static struct bench_user *bench_user;
+static int bench_checking;
+static int bench_responses;
+static int bench_failures;
+static void (*bench_send)(uint8_t *buf, int len);
+
+static double
+bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Put a TLV in front of end, all values here are shorter than 256 bytes,
+ * val may be at out to wrap it up in place */
+static int
+bench_tlv(uint8_t *out, const uint8_t *end, uint8_t tag, const void *val, int len)
+{
+  int n = len < 0x80 ? 2 : 3;
+
+  if (len < 0 || len > 0xff || n + len > end - out) {
+    fprintf(stderr, "Request encoding overflow\n");
+    exit(1);
+  }
+  memmove(out + n, val, len);
+  out[0] = tag;
+  if (n == 3) {
+    out[1] = 0x81;
+  }
+  out[n - 1] = len;
+  return n + len;
+}
+
+/* Skip a TLV header and return the length of its value */
+static uint8_t *
+bench_ber_skip(uint8_t *p, uint32_t *len)
+{
+  int i, n;
+
+  p++;
+  if (*p & 0x80) {
+    n = *p++ & 0x7f;
+    for (*len = 0, i = 0; i < n; i++) {
+      *len = (*len << 8) | *p++;
+    }
+  } else {
+    *len = *p++;
+  }
+  return p;
+}
+
+static uint32_t
+bench_int(const uint8_t *p, uint32_t len)
+{
+  uint32_t v = 0;
+
+  while (len-- > 0) {
+    v = (v << 8) | *p++;
+  }
+  return v;
+}
+
+struct bench_usm {
+  uint32_t boots;
+  uint32_t time;
+  uint8_t *auth;
+  uint8_t *salt;
+  /* Encrypted scoped PDU */
+  uint8_t *scope;
+  uint32_t scope_len;
+};
+
+/* Find the USM fields of an SNMPv3 message */
+static void
+bench_usm_parse(uint8_t *buf, struct bench_usm *usm)
+{
+  uint8_t *p;
+  uint32_t l;
+
+  p = bench_ber_skip(buf, &l);
+  /* Version and global data */
+  p = bench_ber_skip(p, &l) + l;
+  p = bench_ber_skip(p, &l) + l;
+  /* Security parameters */
+  p = bench_ber_skip(p, &l);
+  p = bench_ber_skip(p, &l);
+  p = bench_ber_skip(p, &l) + l;
+  p = bench_ber_skip(p, &l);
+  usm->boots = bench_int(p, l);
+  p = bench_ber_skip(p + l, &l);
+  usm->time = bench_int(p, l);
+  p = bench_ber_skip(p + l, &l) + l;
+  usm->auth = bench_ber_skip(p, &l);
+  p = bench_ber_skip(usm->auth + l, &l);
+  usm->salt = p;
+  usm->scope = bench_ber_skip(p + l, &usm->scope_len);
+}
+
+static void
+bench_iv(uint8_t *iv, const struct bench_usm *usm)
+{
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    iv[i] = usm->boots >> (24 - 8 * i);
+    iv[4 + i] = usm->time >> (24 - 8 * i);
+  }
+  memcpy(iv + 8, usm->salt, SNMP_MSG_ENCRYPT_PARA_LEN);
+}
+
+static void
+bench_hmac_ctx(const struct bench_user *u, const uint8_t *buf, int len, uint8_t *mac)
+{
+  switch (u->auth_mode) {
+  case SNMP_USER_AUTH_MD5:
+    MD5_hmac_ctx(u->auth_ctx.md5, buf, len, mac, u->mac_len);
+    break;
+  case SNMP_USER_AUTH_SHA1:
+    SHA1_hmac_ctx(u->auth_ctx.sha1, buf, len, mac, u->mac_len);
+    break;
+  case SNMP_USER_AUTH_SHA256:
+    SHA256_hmac_ctx(u->auth_ctx.sha256, buf, len, mac, u->mac_len);
+    break;
+  case SNMP_USER_AUTH_SHA512:
+    SHA512_hmac_ctx(u->auth_ctx.sha512, buf, len, mac, u->mac_len);
+    break;
+  }
+}
+
+/* Keyed from the raw auth key where the glue can do it */
+static void
+bench_hmac(const struct bench_user *u, const uint8_t *buf, int len, uint8_t *mac)
+{
+  switch (u->auth_mode) {
+  case SNMP_USER_AUTH_MD5:
+    MD5_hmac(buf, len, mac, u->mac_len, u->auth_key, MD5_SECRETKEYLEN);
+    break;
+  case SNMP_USER_AUTH_SHA1:
+    SHA1_hmac(buf, len, mac, u->mac_len, u->auth_key, SHA1_SECRETKEYLEN);
+    break;
+  default:
+    bench_hmac_ctx(u, buf, len, mac);
+    break;
+  }
+}
+
+/* Keys are localized to the engine ID of the agent as in mib_user_create() */
+static void
+bench_user_keys(struct bench_user *u)
+{
+  uint8_t key[SHA512_SECRETKEYLEN];
+  const uint8_t *auth = (const uint8_t *)u->auth_phrase;
+  const uint8_t *priv = (const uint8_t *)u->priv_phrase;
+  const uint8_t *engine_id = snmpv3_engine_id;
+
+  switch (u->auth_mode) {
+  case SNMP_USER_AUTH_MD5:
+    MD5_key(auth, strlen(u->auth_phrase), engine_id, sizeof(snmpv3_engine_id), u->auth_key);
+    MD5_key(priv, strlen(u->priv_phrase), engine_id, sizeof(snmpv3_engine_id), key);
+    MD5_hmac_ctx_init(u->auth_ctx.md5, u->auth_key, MD5_SECRETKEYLEN);
+    break;
+  case SNMP_USER_AUTH_SHA1:
+    SHA1_key(auth, strlen(u->auth_phrase), engine_id, sizeof(snmpv3_engine_id), u->auth_key);
+    SHA1_key(priv, strlen(u->priv_phrase), engine_id, sizeof(snmpv3_engine_id), key);
+    SHA1_hmac_ctx_init(u->auth_ctx.sha1, u->auth_key, SHA1_SECRETKEYLEN);
+    break;
+  case SNMP_USER_AUTH_SHA256:
+    SHA256_key(auth, strlen(u->auth_phrase), engine_id, sizeof(snmpv3_engine_id), u->auth_key);
+    SHA256_key(priv, strlen(u->priv_phrase), engine_id, sizeof(snmpv3_engine_id), key);
+    SHA256_hmac_ctx_init(u->auth_ctx.sha256, u->auth_key, SHA256_SECRETKEYLEN);
+    break;
+  case SNMP_USER_AUTH_SHA512:
+    SHA512_key(auth, strlen(u->auth_phrase), engine_id, sizeof(snmpv3_engine_id), u->auth_key);
+    SHA512_key(priv, strlen(u->priv_phrase), engine_id, sizeof(snmpv3_engine_id), key);
+    SHA512_hmac_ctx_init(u->auth_ctx.sha512, u->auth_key, SHA512_SECRETKEYLEN);
+    break;
+  }
+  memcpy(u->priv_key, key, AES_SECRETKEYLEN);
+  AES_set_encrypt_key(u->priv_key, AES_SECRETKEYLEN * 8, &u->priv_sched);
+}
+
+/* An authPriv GET of bench_oid */
+static void
+bench_request_encode(struct bench_user *u)
+{
+  static const uint8_t salt[SNMP_MSG_ENCRYPT_PARA_LEN] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+  static const uint8_t zero[SNMP_MSG_AUTH_PARA_MAX_LEN];
+  uint8_t vb[32], pdu[64], scope[128], usm[128], global[32];
+  uint8_t cipher[128], iv[AES_SECRETKEYLEN], mac[SNMP_MSG_AUTH_PARA_MAX_LEN], *p, *end;
+  unsigned int clen;
+  int vb_len, pdu_len, scope_len, usm_len, global_len;
+  struct bench_usm parsed;
+
+  /* One varbind with a NULL value */
+  p = vb;
+  end = vb + sizeof(vb);
+  p += bench_tlv(p, end, 0x06, bench_oid, sizeof(bench_oid));
+  p += bench_tlv(p, end, 0x05, "", 0);
+  vb_len = bench_tlv(vb, end, 0x30, vb, p - vb);
+
+  /* Request id, error status and error index */
+  p = pdu;
+  end = pdu + sizeof(pdu);
+  p += bench_tlv(p, end, 0x02, "\x01", 1);
+  p += bench_tlv(p, end, 0x02, "\x00", 1);
+  p += bench_tlv(p, end, 0x02, "\x00", 1);
+  p += bench_tlv(p, end, 0x30, vb, vb_len);
+  pdu_len = bench_tlv(pdu, end, 0xa0, pdu, p - pdu);
+
+  /* Context engine ID and empty context name */
+  p = scope;
+  end = scope + sizeof(scope);
+  p += bench_tlv(p, end, 0x04, snmpv3_engine_id, sizeof(snmpv3_engine_id));
+  p += bench_tlv(p, end, 0x04, "", 0);
+  memcpy(p, pdu, pdu_len);
+  p += pdu_len;
+  scope_len = bench_tlv(scope, end, 0x30, scope, p - scope);
+
+  /* Security parameters with boots and time of 1 */
+  p = usm;
+  end = usm + sizeof(usm);
+  p += bench_tlv(p, end, 0x04, snmpv3_engine_id, sizeof(snmpv3_engine_id));
+  p += bench_tlv(p, end, 0x02, "\x01", 1);
+  p += bench_tlv(p, end, 0x02, "\x01", 1);
+  p += bench_tlv(p, end, 0x04, u->name, strlen(u->name));
+  p += bench_tlv(p, end, 0x04, zero, u->mac_len);
+  p += bench_tlv(p, end, 0x04, salt, sizeof(salt));
+  usm_len = bench_tlv(usm, end, 0x30, usm, p - usm);
+
+  /* Message id, max size of 1400, authPriv flags and USM */
+  p = global;
+  end = global + sizeof(global);
+  p += bench_tlv(p, end, 0x02, "\x01", 1);
+  p += bench_tlv(p, end, 0x02, "\x05\x78", 2);
+  p += bench_tlv(p, end, 0x04, "\x03", 1);
+  p += bench_tlv(p, end, 0x02, "\x03", 1);
+  global_len = p - global;
+
+  p = u->buf;
+  end = u->buf + sizeof(u->buf);
+  p += bench_tlv(p, end, 0x02, "\x03", 1);
+  p += bench_tlv(p, end, 0x30, global, global_len);
+  p += bench_tlv(p, end, 0x04, usm, usm_len);
+  p += bench_tlv(p, end, 0x04, scope, scope_len);
+  u->len = bench_tlv(u->buf, end, 0x30, u->buf, p - u->buf);
+
+  /* Encrypt the scoped PDU, then sign the whole message */
+  bench_usm_parse(u->buf, &parsed);
+  bench_iv(iv, &parsed);
+  clen = parsed.scope_len;
+  AES_Encrypt(&u->priv_sched, iv, sizeof(iv), parsed.scope, parsed.scope_len, cipher, &clen);
+  memcpy(parsed.scope, cipher, clen);
+  bench_hmac(u, u->buf, u->len, mac);
+  memcpy(parsed.auth, mac, u->mac_len);
+}
+
+/* Check the MAC and the error status of a response on its way out */
+static void
+bench_response_check(uint8_t *buf, int len)
+{
+  uint8_t msg[1500], mac[SNMP_MSG_AUTH_PARA_MAX_LEN], iv[AES_SECRETKEYLEN];
+  uint8_t plain[1500], *p;
+  unsigned int plen;
+  uint32_t l;
+  struct bench_usm usm;
+
+  bench_responses++;
+  if (bench_checking) {
+    memcpy(msg, buf, len);
+    bench_usm_parse(msg, &usm);
+    memcpy(mac, usm.auth, bench_user->mac_len);
+    memset(usm.auth, 0, bench_user->mac_len);
+    bench_hmac(bench_user, msg, len, usm.auth);
+    bench_iv(iv, &usm);
+    plen = usm.scope_len;
+    AES_Decrypt(&bench_user->priv_sched, iv, sizeof(iv), usm.scope, usm.scope_len, plain, &plen);
+
+    /* Context engine ID and context name */
+    p = bench_ber_skip(plain, &l);
+    p = bench_ber_skip(p, &l) + l;
+    p = bench_ber_skip(p, &l) + l;
+    if (memcmp(mac, usm.auth, bench_user->mac_len) || *p != 0xa2) {
+      bench_failures++;
+    } else {
+      /* Request id and error status */
+      p = bench_ber_skip(p, &l);
+      p = bench_ber_skip(p, &l) + l;
+      p = bench_ber_skip(p, &l);
+      if (*p != 0) {
+        bench_failures++;
+      }
+    }
+  }
+
+  bench_send(buf, len);
+}
+
+static int
+bench_round(lua_State *L)
+{
+  int rounds = luaL_checkint(L, 1);
+  uint8_t buf[256];
+
+  /* Decoding overwrites the MAC and the cipher text in place */
+  while (rounds-- > 0) {
+    memcpy(buf, bench_user->buf, bench_user->len);
+    snmp_prot_ops.receive(buf, bench_user->len);
+  }
+  return 0;
+}
+
+/* Requests are handled in a function sharing the environment of the core
+ * module, where the agent keeps its Lua handlers. */
+static void
+bench_run(lua_State *L, int rounds)
+{
+  lua_pushcfunction(L, bench_round);
+  lua_getglobal(L, "smithsnmp_lib");
+  lua_getfield(L, -1, "init");
+  lua_getfenv(L, -1);
+  lua_setfenv(L, -4);
+  lua_pop(L, 2);
+  lua_pushinteger(L, rounds);
+  if (lua_pcall(L, 1, 0, 0) != 0) {
+    fprintf(stderr, "%s\n", lua_tostring(L, -1));
+    exit(1);
+  }
+}
+
+/* Nanoseconds per HMAC of a request sized message */
+static void
+bench_hmac_run(struct bench_user *u, int rounds)
+{
+  uint8_t mac[SNMP_MSG_AUTH_PARA_MAX_LEN];
+  double t0, t1, t2;
+  int i;
+
+  t0 = bench_now();
+  for (i = 0; i < rounds; i++) {
+    bench_hmac(u, u->buf, u->len, mac);
+  }
+  t1 = bench_now();
+  for (i = 0; i < rounds; i++) {
+    bench_hmac_ctx(u, u->buf, u->len, mac);
+  }
+  t2 = bench_now();
+
+  if (u->auth_mode == SNMP_USER_AUTH_MD5 || u->auth_mode == SNMP_USER_AUTH_SHA1) {
+    printf("%s over %d bytes: %.0f ns from the raw key, %.0f ns precomputed\n",
+           u->title, u->len, (t1 - t0) / rounds * 1e9, (t2 - t1) / rounds * 1e9);
+  } else {
+    printf("%s over %d bytes: %.0f ns precomputed\n",
+           u->title, u->len, (t2 - t1) / rounds * 1e9);
+  }
+}
+
+/* CFB over the request, expanding the key per message as the agent used to
+ * and from the schedule it now keeps per user */
+static void
+bench_aes_run(struct bench_user *u, int rounds)
+{
+  uint8_t iv[AES_SECRETKEYLEN], out[256];
+  unsigned int len;
+  AES_KEY key;
+  double t0, t1, t2;
+  int i;
+
+  memset(iv, 0, sizeof(iv));
+  t0 = bench_now();
+  for (i = 0; i < rounds; i++) {
+    len = sizeof(out);
+    AES_set_encrypt_key(u->priv_key, AES_SECRETKEYLEN * 8, &key);
+    AES_Encrypt(&key, iv, sizeof(iv), u->buf, u->len, out, &len);
+  }
+  t1 = bench_now();
+  for (i = 0; i < rounds; i++) {
+    len = sizeof(out);
+    AES_Encrypt(&u->priv_sched, iv, sizeof(iv), u->buf, u->len, out, &len);
+  }
+  t2 = bench_now();
+
+  printf("AES-128 CFB over %d bytes: %.0f ns expanding the key, %.0f ns from the cached schedule\n",
+         u->len, (t1 - t0) / rounds * 1e9, (t2 - t1) / rounds * 1e9);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, rounds = BENCH_ROUNDS;
+  double t;
+  lua_State *L;
+
+  if (argc > 1) {
+    rounds = atoi(argv[1]);
+  }
+
+  L = luaL_newstate();
+  luaL_openlibs(L);
+
+  /* The core module is linked in */
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "preload");
+  lua_pushcfunction(L, luaopen_smithsnmp_core);
+  lua_setfield(L, -2, "smithsnmp.core");
+  lua_pop(L, 2);
+
+  if (luaL_dostring(L, bench_setup) != 0) {
+    fprintf(stderr, "%s\n", lua_tostring(L, -1));
+    return 1;
+  }
+
+  bench_send = snmp_prot_ops.send;
+  snmp_prot_ops.send = bench_response_check;
+
+  for (i = 0; i < elem_num(bench_users); i++) {
+    bench_user = &bench_users[i];
+    bench_user_keys(bench_user);
+    bench_request_encode(bench_user);
+
+    bench_checking = 1;
+    bench_responses = 0;
+    bench_run(L, BENCH_WARMUP_ROUNDS);
+    bench_checking = 0;
+    if (bench_responses != BENCH_WARMUP_ROUNDS || bench_failures) {
+      printf("%s: %d requests, %d responses, %d errors\nFAIL\n",
+             bench_user->title, BENCH_WARMUP_ROUNDS, bench_responses, bench_failures);
+      return 1;
+    }
+
+    t = bench_now();
+    bench_run(L, rounds);
+    t = bench_now() - t;
+    printf("authPriv GET, %s + AES-128: %d requests, %.0f requests/s\n", bench_user->title, rounds, rounds / t);
+
+    bench_hmac_run(bench_user, rounds);
+  }
+  bench_aes_run(&bench_users[0], rounds);
+
+  snmp_prot_ops.close();
+  lua_close(L);
+  return 0;
+}
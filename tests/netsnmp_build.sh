@@ -1,6 +1,6 @@
 #!/bin/sh
 
-export NET_SNMP_VERSION=5.7.3
+export NET_SNMP_VERSION=5.9.4
 export NET_SNMP_SRC_URL=https://sourceforge.net/projects/net-snmp/files/net-snmp/${NET_SNMP_VERSION}/net-snmp-${NET_SNMP_VERSION}.tar.gz
 export NET_SNMP_ROOT_DIR=`pwd`/tests
 
@@ -19,7 +19,7 @@ tar xzvf ${NET_SNMP_ROOT_DIR}/net-snmp-${NET_SNMP_VERSION}.tar.gz -C ${NET_SNMP_
 cd ${NET_SNMP_ROOT_DIR}/net-snmp-src/net-snmp-${NET_SNMP_VERSION}
 
 # Configure, make and install
-./configure --with-default-snmp-version="3" --with-sys-contact="contact" --with-sys-location="location" --with-logfile="/var/log/snmpd.log" --with-persistent-directory="/var/net-snmp" --prefix=${NET_SNMP_ROOT_DIR}/net-snmp-release --disable-manuals --disable-scripts --disable-mibs --disable-embedded-perl --disable-deprecated --without-perl-modules --with-out-mib-modules="mibII ucd_snmp agent_mibs notification notification-log-mib target utilities disman/event disman/schedule host" --with-mib_modules="mibII/vacm_vars"
+./configure --with-default-snmp-version="3" --with-sys-contact="contact" --with-sys-location="location" --with-logfile="/var/log/snmpd.log" --with-persistent-directory="/var/net-snmp" --prefix=${NET_SNMP_ROOT_DIR}/net-snmp-release --disable-manuals --disable-scripts --disable-mibs --disable-embedded-perl --disable-deprecated --enable-blumenthal-aes --without-perl-modules --with-out-mib-modules="mibII ucd_snmp agent_mibs notification notification-log-mib target utilities disman/event disman/schedule host" --with-mib_modules="mibII/vacm_vars"
 make
 make install
 
@@ -0,0 +1,367 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*
+ * Allocation counting test: once warmed up, the request path of
+ * GET/GETNEXT/GETBULK must not touch the heap at all, for groups served
+ * in Lua and in C alike.
+ *
+ * malloc/calloc/realloc/free are wrapped by the linker (see the test_alloc
+ * target in SConstruct). Lua runs on its own allocator which bypasses the
+ * wrappers, so only the C side of the agent is counted.
+ *
+ * Usage: scons test_alloc && build/test_alloc (from the project root)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "protocol.h"
+#include "utils.h"
+
+#define TEST_WARMUP_ROUNDS  100
+#define TEST_ROUNDS  1000
+
+int luaopen_smithsnmp_core(lua_State *L);
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nr, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+static int counting;
+static unsigned long heap_calls;
+
+void *
+__wrap_malloc(size_t size)
+{
+  heap_calls += counting;
+  return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t nr, size_t size)
+{
+  heap_calls += counting;
+  return __real_calloc(nr, size);
+}
+
+void *
+__wrap_realloc(void *ptr, size_t size)
+{
+  heap_calls += counting;
+  return __real_realloc(ptr, size);
+}
+
+void
+__wrap_free(void *ptr)
+{
+  heap_calls += counting && ptr != NULL;
+  __real_free(ptr);
+}
+
+static void *
+test_lua_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+  if (nsize == 0) {
+    __real_free(ptr);
+    return NULL;
+  }
+  return __real_realloc(ptr, nsize);
+}
+
+static const char *test_setup =
+  "package.path = 'lualib/?/init.lua;lualib/?.lua;' .. package.path\n"
+  "local mib = require 'smithsnmp'\n"
+  "mib.init('snmp', 16199, {})\n"
+  "mib.set_ro_community('public')\n"
+  "mib.register_mib_group({ 1, 3, 6, 1, 4, 1, 8888, 9 }, {\n"
+  "    [1] = mib.ConstOctString(function () return 'SmithSNMP' end),\n"
+  "    [2] = mib.ConstInt(function () return 42 end),\n"
+  "    [3] = mib.ConstCount(function () return 7 end),\n"
+  "}, 'alloc')\n";
+
+/* 1.3.6.1.4.1.8888.10 served in C */
+static const oid_t test_native_oid[] = { 1, 3, 6, 1, 4, 1, 8888, 10 };
+static uint32_t test_native_count;
+
+/* 1.3.6.1.4.1.8888, group 9 is served in Lua and group 10 in C */
+static const uint8_t test_group_oid[] = { 0x2b, 0x06, 0x01, 0x04, 0x01, 0xc5, 0x38 };
+
+struct test_request {
+  uint8_t pdu_type;
+  /* Sub-ids appended to the group oid */
+  uint8_t sub_id[3];
+  int sub_id_len;
+  /* GETBULK only */
+  uint8_t non_rep;
+  uint8_t max_rep;
+  uint8_t buf[128];
+  int len;
+};
+
+static struct test_request test_requests[] = {
+  { 0xa0, { 9, 1, 0 }, 3, 0, 0 },
+  { 0xa0, { 9, 2, 0 }, 3, 0, 0 },
+  { 0xa0, { 10, 1, 0 }, 3, 0, 0 },
+  { 0xa1, { 0 }, 0, 0, 0 },
+  { 0xa1, { 9, 3, 0 }, 3, 0, 0 },
+  { 0xa5, { 0 }, 0, 0, 6 },
+};
+
+/* Scalars 1.0 and 2.0 of the group served in C */
+static int
+test_native_handler(struct oid_search_res *ret_oid, void *ctx)
+{
+  uint32_t *counter = ctx;
+  Variable *var = &ret_oid->var;
+  oid_t obj = 0, scalar[2];
+
+  if (ret_oid->request == SNMP_REQ_GET) {
+    if (ret_oid->inst_id_len == 2 && ret_oid->inst_id[1] == 0) {
+      obj = ret_oid->inst_id[0];
+    }
+  } else if (ret_oid->request == SNMP_REQ_GETNEXT) {
+    /* The first scalar after the given instance */
+    for (obj = 1; obj <= 2; obj++) {
+      scalar[0] = obj;
+      scalar[1] = 0;
+      if (oid_cmp(scalar, 2, ret_oid->inst_id, ret_oid->inst_id_len) > 0) {
+        break;
+      }
+    }
+    if (obj <= 2) {
+      ret_oid->inst_id[0] = obj;
+      ret_oid->inst_id[1] = 0;
+      ret_oid->inst_id_len = 2;
+    }
+  }
+
+  switch (obj) {
+  case 1:
+    tag(var) = ASN1_TAG_CNT;
+    length(var) = 1;
+    count(var) = ++*counter;
+    break;
+  case 2:
+    tag(var) = ASN1_TAG_INT;
+    length(var) = 1;
+    integer(var) = 42;
+    break;
+  default:
+    tag(var) = ret_oid->request == SNMP_REQ_GET ? ASN1_TAG_NO_SUCH_INST : ASN1_TAG_NO_SUCH_OBJ;
+    break;
+  }
+  return 0;
+}
+
+static int test_responses;
+static int test_failures;
+static void (*test_send)(uint8_t *buf, int len);
+
+/* Put a primitive TLV, all values here are shorter than 128 bytes */
+static int
+test_tlv(uint8_t *out, uint8_t tag, const void *val, int len)
+{
+  out[0] = tag;
+  out[1] = len;
+  memcpy(out + 2, val, len);
+  return len + 2;
+}
+
+/* Fill in the header of a constructed TLV ending at end */
+static void
+test_tlv_head(uint8_t *out, uint8_t tag, const uint8_t *end)
+{
+  out[0] = tag;
+  out[1] = end - out - 2;
+}
+
+static void
+test_request_encode(struct test_request *req)
+{
+  uint8_t *msg, *pdu, *vb_list, *vb, *p;
+
+  p = msg = req->buf;
+  p += 2;
+  /* Version 2c and community */
+  p += test_tlv(p, 0x02, "\x01", 1);
+  p += test_tlv(p, 0x04, "public", 6);
+
+  /* Request id, non-repeaters and max-repetitions double as error status
+   * and error index */
+  pdu = p;
+  p += 2;
+  p += test_tlv(p, 0x02, "\x01", 1);
+  p += test_tlv(p, 0x02, &req->non_rep, 1);
+  p += test_tlv(p, 0x02, &req->max_rep, 1);
+
+  /* One varbind with a NULL value */
+  vb_list = p;
+  p += 2;
+  vb = p;
+  p += 2;
+  *p++ = 0x06;
+  *p++ = sizeof(test_group_oid) + req->sub_id_len;
+  memcpy(p, test_group_oid, sizeof(test_group_oid));
+  p += sizeof(test_group_oid);
+  memcpy(p, req->sub_id, req->sub_id_len);
+  p += req->sub_id_len;
+  *p++ = 0x05;
+  *p++ = 0x00;
+
+  test_tlv_head(vb, 0x30, p);
+  test_tlv_head(vb_list, 0x30, p);
+  test_tlv_head(pdu, req->pdu_type, p);
+  test_tlv_head(msg, 0x30, p);
+  req->len = p - req->buf;
+}
+
+/* Skip a TLV header and return the length of its value */
+static const uint8_t *
+test_ber_skip(const uint8_t *p, uint32_t *len)
+{
+  int i, n;
+
+  p++;
+  if (*p & 0x80) {
+    n = *p++ & 0x7f;
+    for (*len = 0, i = 0; i < n; i++) {
+      *len = (*len << 8) | *p++;
+    }
+  } else {
+    *len = *p++;
+  }
+  return p;
+}
+
+/* Check the error status of every response on its way to the transport */
+static void
+test_response_check(uint8_t *buf, int len)
+{
+  const uint8_t *p = buf;
+  uint32_t l;
+
+  p = test_ber_skip(p, &l);
+  /* Version and community */
+  p = test_ber_skip(p, &l) + l;
+  p = test_ber_skip(p, &l) + l;
+  if (*p != 0xa2) {
+    test_failures++;
+  } else {
+    /* Request id and error status */
+    p = test_ber_skip(p, &l);
+    p = test_ber_skip(p, &l) + l;
+    p = test_ber_skip(p, &l);
+    if (*p != 0) {
+      test_failures++;
+    }
+  }
+  test_responses++;
+
+  test_send(buf, len);
+}
+
+static int
+test_round(lua_State *L)
+{
+  int i, rounds = luaL_checkint(L, 1);
+
+  while (rounds-- > 0) {
+    for (i = 0; i < elem_num(test_requests); i++) {
+      snmp_prot_ops.receive(test_requests[i].buf, test_requests[i].len);
+    }
+  }
+  return 0;
+}
+
+/* Requests are handled in a function sharing the environment of the core
+ * module, where the agent keeps its Lua handlers. */
+static void
+test_run(lua_State *L, int rounds)
+{
+  lua_pushcfunction(L, test_round);
+  lua_getglobal(L, "smithsnmp_lib");
+  lua_getfield(L, -1, "init");
+  lua_getfenv(L, -1);
+  lua_setfenv(L, -4);
+  lua_pop(L, 2);
+  lua_pushinteger(L, rounds);
+  if (lua_pcall(L, 1, 0, 0) != 0) {
+    fprintf(stderr, "%s\n", lua_tostring(L, -1));
+    exit(1);
+  }
+}
+
+int
+main(void)
+{
+  int i;
+  lua_State *L;
+
+  L = lua_newstate(test_lua_alloc, NULL);
+  luaL_openlibs(L);
+
+  /* The core module is linked in */
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "preload");
+  lua_pushcfunction(L, luaopen_smithsnmp_core);
+  lua_setfield(L, -2, "smithsnmp.core");
+  lua_pop(L, 2);
+
+  if (luaL_dostring(L, test_setup) != 0) {
+    fprintf(stderr, "%s\n", lua_tostring(L, -1));
+    return 1;
+  }
+  if (smithsnmp_native_reg(test_native_oid, elem_num(test_native_oid), test_native_handler, &test_native_count) != 0) {
+    fprintf(stderr, "Register native group failure\n");
+    return 1;
+  }
+
+  for (i = 0; i < elem_num(test_requests); i++) {
+    test_request_encode(&test_requests[i]);
+  }
+  test_send = snmp_prot_ops.send;
+  snmp_prot_ops.send = test_response_check;
+
+  /* Let the arena and the outbound queue settle */
+  test_run(L, TEST_WARMUP_ROUNDS);
+
+  test_responses = 0;
+  counting = 1;
+  test_run(L, TEST_ROUNDS);
+  counting = 0;
+
+  printf("%d requests, %d responses, %d errors, %lu heap calls\n",
+         TEST_ROUNDS * (int)elem_num(test_requests), test_responses, test_failures, heap_calls);
+
+  snmp_prot_ops.close();
+  lua_close(L);
+
+  if (test_responses != TEST_ROUNDS * elem_num(test_requests) || test_failures || heap_calls) {
+    printf("FAIL\n");
+    return 1;
+  }
+  printf("OK\n");
+  return 0;
+}
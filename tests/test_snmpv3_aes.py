@@ -0,0 +1,49 @@
+import unittest
+from smithsnmp_testcases import *
+
+class SNMPv3AES192TestCase(unittest.TestCase, SmithSNMPTestFramework, SmithSNMPTestCase):
+	def setUp(self):
+		self.snmp_setup("config/snmp.conf")
+		self.version = "3"
+		self.user = "rwAes192AuthPrivUser"
+		self.level = "authPriv"
+		self.auth_protocol = "SHA"
+		self.auth_key = "rwAes192AuthPrivUser"
+		self.priv_protocol = "AES-192"
+		self.priv_key = "rwAes192AuthPrivUser"
+		self.ip = "127.0.0.1"
+		self.port = 161
+		if self.snmp.isalive() == False:
+			self.snmp.read()
+			raise Exception("SNMP daemon start error!")
+
+	def tearDown(self):
+		if self.snmp.isalive() == False:
+			self.snmp.read()
+			raise Exception("SNMP daemon start error!")
+		self.snmp_teardown()
+
+class SNMPv3AES256TestCase(unittest.TestCase, SmithSNMPTestFramework, SmithSNMPTestCase):
+	def setUp(self):
+		self.snmp_setup("config/snmp.conf")
+		self.version = "3"
+		self.user = "rwAes256AuthPrivUser"
+		self.level = "authPriv"
+		self.auth_protocol = "MD5"
+		self.auth_key = "rwAes256AuthPrivUser"
+		self.priv_protocol = "AES-256"
+		self.priv_key = "rwAes256AuthPrivUser"
+		self.ip = "127.0.0.1"
+		self.port = 161
+		if self.snmp.isalive() == False:
+			self.snmp.read()
+			raise Exception("SNMP daemon start error!")
+
+	def tearDown(self):
+		if self.snmp.isalive() == False:
+			self.snmp.read()
+			raise Exception("SNMP daemon start error!")
+		self.snmp_teardown()
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,49 @@
+import unittest
+from smithsnmp_testcases import *
+
+class SNMPv3SHA256TestCase(unittest.TestCase, SmithSNMPTestFramework, SmithSNMPTestCase):
+	def setUp(self):
+		self.snmp_setup("config/snmp.conf")
+		self.version = "3"
+		self.user = "rwSha256AuthPrivUser"
+		self.level = "authPriv"
+		self.auth_protocol = "SHA-256"
+		self.auth_key = "rwSha256AuthPrivUser"
+		self.priv_protocol = "AES"
+		self.priv_key = "rwSha256AuthPrivUser"
+		self.ip = "127.0.0.1"
+		self.port = 161
+		if self.snmp.isalive() == False:
+			self.snmp.read()
+			raise Exception("SNMP daemon start error!")
+
+	def tearDown(self):
+		if self.snmp.isalive() == False:
+			self.snmp.read()
+			raise Exception("SNMP daemon start error!")
+		self.snmp_teardown()
+
+class SNMPv3SHA512TestCase(unittest.TestCase, SmithSNMPTestFramework, SmithSNMPTestCase):
+	def setUp(self):
+		self.snmp_setup("config/snmp.conf")
+		self.version = "3"
+		self.user = "rwSha512AuthPrivUser"
+		self.level = "authPriv"
+		self.auth_protocol = "SHA-512"
+		self.auth_key = "rwSha512AuthPrivUser"
+		self.priv_protocol = "AES"
+		self.priv_key = "rwSha512AuthPrivUser"
+		self.ip = "127.0.0.1"
+		self.port = 161
+		if self.snmp.isalive() == False:
+			self.snmp.read()
+			raise Exception("SNMP daemon start error!")
+
+	def tearDown(self):
+		if self.snmp.isalive() == False:
+			self.snmp.read()
+			raise Exception("SNMP daemon start error!")
+		self.snmp_teardown()
+
+if __name__ == '__main__':
+    unittest.main()